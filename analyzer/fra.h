@@ -0,0 +1,278 @@
+#ifndef FRA_H
+#define FRA_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <math.h>
+#include <string.h>
+
+#include "util/errdef.h"
+#include "util/mathdef.h"
+#include "util/typedef.h"
+#include "wavegenerator/sine.h"
+
+/*
+ * Stepped-sine frequency response analyzer.
+ * Each tick the caller injects out->stim, then hands back the signal at the injection point (x)
+ * and the response (y) of the same tick. Both are correlated against the stimulus over an integer
+ * number of periods, H = Y / X. Closed loop: x = ref + stim, y = fdb. Open loop with the
+ * stimulus added to the controller output u = c + stim: x = u, y = -c.
+ */
+
+#ifndef FRA_POINT_MAX
+#define FRA_POINT_MAX (32U)
+#endif
+
+typedef enum {
+  FRA_STATE_IDLE,
+  FRA_STATE_SETTLE,
+  FRA_STATE_MEASURE,
+  FRA_STATE_DONE,
+} fra_state_e;
+
+typedef struct {
+  FP32 freq_hz;       // 调用频率
+  FP32 freq_start_hz; // 起始扫频频率
+  FP32 freq_stop_hz;  // 终止扫频频率
+  U32  point_num;     // 频点数, 对数分布
+  FP32 amp;           // 激励幅值
+  U32  settle_cycles; // 每个频点的稳定周期数
+  U32  meas_cycles;   // 每个频点的积分周期数
+  BOOL is_open_loop;  // 开环测量, 求穿越频率和相位裕度, 否则求带宽
+} fra_cfg_t;
+
+typedef struct {
+  FP32 x, y;
+} fra_in_t;
+
+typedef struct {
+  FP32        stim;
+  fra_state_e e_state;
+  U32         point_cnt;
+  FP32        freq_hz[FRA_POINT_MAX];
+  FP32        mag_db[FRA_POINT_MAX];
+  FP32        phase_deg[FRA_POINT_MAX];
+  FP32        bandwidth_hz;     // -3dB, 闭环
+  FP32        crossover_hz;     // 0dB, 开环
+  FP32        phase_margin_deg; // 开环
+} fra_out_t;
+
+typedef struct {
+  sine_t sine;
+  FP32   ref_phase_rad;
+  U32    tick_cnt;
+  U32    settle_ticks;
+  U32    meas_ticks;
+  FP32   x_re, x_im;
+  FP32   y_re, y_im;
+} fra_lo_t;
+
+typedef struct {
+  fra_cfg_t cfg;
+  fra_in_t  in;
+  fra_out_t out;
+  fra_lo_t  lo;
+} fra_t;
+
+#define DECL_FRA_PTRS(fra)                                                                         \
+  fra_t     *p   = (fra);                                                                          \
+  fra_cfg_t *cfg = &p->cfg;                                                                        \
+  fra_in_t  *in  = &p->in;                                                                         \
+  fra_out_t *out = &p->out;                                                                        \
+  fra_lo_t  *lo  = &p->lo;
+
+#define DECL_FRA_PTRS_PREFIX(fra, prefix)                                                          \
+  fra_t     *prefix##_p   = (fra);                                                                 \
+  fra_cfg_t *prefix##_cfg = &prefix##_p->cfg;                                                      \
+  fra_in_t  *prefix##_in  = &prefix##_p->in;                                                       \
+  fra_out_t *prefix##_out = &prefix##_p->out;                                                      \
+  fra_lo_t  *prefix##_lo  = &prefix##_p->lo;
+
+/*
+ * FAIL without a stimulus or with a sweep that does not start above 0 hz, nothing is changed.
+ */
+static inline ret_e
+fra_init(fra_t *fra, fra_cfg_t fra_cfg) {
+  DECL_FRA_PTRS(fra);
+
+  if (!(fra_cfg.amp > FP32_0) || !(fra_cfg.freq_start_hz > FP32_0)
+      || !(fra_cfg.freq_stop_hz > FP32_0))
+    return FAIL;
+
+  *cfg = fra_cfg;
+  if (cfg->point_num > FRA_POINT_MAX)
+    cfg->point_num = FRA_POINT_MAX;
+  if (cfg->meas_cycles == 0)
+    cfg->meas_cycles = 1;
+
+  memset(in, 0, sizeof(*in));
+  memset(out, 0, sizeof(*out));
+  memset(lo, 0, sizeof(*lo));
+
+  sine_cfg_t sine_cfg;
+  sine_cfg.freq_hz = cfg->freq_hz;
+  sine_init(&lo->sine, sine_cfg);
+  return OK;
+}
+
+static inline void
+fra_point_start(fra_t *fra) {
+  DECL_FRA_PTRS(fra);
+  DECL_SINE_PTRS_PREFIX(&fra->lo.sine, sine);
+
+  U32  den     = (cfg->point_num > 1) ? cfg->point_num - 1 : 1;
+  FP32 ratio   = (FP32)out->point_cnt / (FP32)den;
+  FP32 freq_hz = cfg->freq_start_hz * powf(cfg->freq_stop_hz / cfg->freq_start_hz, ratio);
+
+  // round to whole periods so the correlation has no leakage from the stimulus itself
+  FP32 period_ticks = cfg->freq_hz / freq_hz;
+  lo->settle_ticks  = (U32)(period_ticks * (FP32)cfg->settle_cycles + FP32_1_DIV_2);
+  lo->meas_ticks    = (U32)(period_ticks * (FP32)cfg->meas_cycles + FP32_1_DIV_2);
+  if (lo->meas_ticks == 0)
+    lo->meas_ticks = 1;
+
+  out->freq_hz[out->point_cnt] = freq_hz;
+  lo->tick_cnt                 = 0;
+
+  lo->x_re = lo->x_im = lo->y_re = lo->y_im = FP32_0;
+
+  sine_in->freq_hz    = freq_hz;
+  sine_in->amp_rad    = cfg->amp;
+  sine_in->phase_rad  = FP32_0;
+  sine_in->offset_rad = FP32_0;
+  lo->ref_phase_rad   = sine_in->phase_rad;
+  sine_run(sine_p);
+  out->stim = sine_out->val;
+
+  out->e_state = FRA_STATE_SETTLE;
+}
+
+static inline void
+fra_start(fra_t *fra) {
+  DECL_FRA_PTRS(fra);
+
+  out->point_cnt        = 0;
+  out->bandwidth_hz     = FP32_0;
+  out->crossover_hz     = FP32_0;
+  out->phase_margin_deg = FP32_0;
+  if (cfg->point_num == 0) {
+    out->e_state = FRA_STATE_DONE;
+    return;
+  }
+  fra_point_start(fra);
+}
+
+static inline void
+fra_stop(fra_t *fra) {
+  DECL_FRA_PTRS(fra);
+
+  out->stim    = FP32_0;
+  out->e_state = FRA_STATE_IDLE;
+}
+
+static inline FP32
+fra_log_interp(FP32 f0, FP32 f1, FP32 ratio) {
+  return f0 * powf(f1 / f0, ratio);
+}
+
+static inline void
+fra_summary(fra_t *fra) {
+  DECL_FRA_PTRS(fra);
+
+  // -3 db of a closed loop is its bandwidth, 0 db of an open loop its crossover
+  for (U32 i = 1; i < out->point_cnt; i++) {
+    FP32 m0 = out->mag_db[i - 1], m1 = out->mag_db[i];
+
+    if (!cfg->is_open_loop && out->bandwidth_hz == FP32_0 && m0 >= -3.0f && m1 < -3.0f)
+      out->bandwidth_hz
+          = fra_log_interp(out->freq_hz[i - 1], out->freq_hz[i], (m0 + 3.0f) / (m0 - m1));
+
+    if (cfg->is_open_loop && out->crossover_hz == FP32_0 && m0 >= FP32_0 && m1 < FP32_0) {
+      FP32 ratio            = m0 / (m0 - m1);
+      out->crossover_hz     = fra_log_interp(out->freq_hz[i - 1], out->freq_hz[i], ratio);
+      out->phase_margin_deg = 180.0f + out->phase_deg[i - 1]
+                              + ratio * (out->phase_deg[i] - out->phase_deg[i - 1]);
+    }
+  }
+}
+
+static inline void
+fra_point_finish(fra_t *fra) {
+  DECL_FRA_PTRS(fra);
+
+  // H = Y / X
+  FP32 den = lo->x_re * lo->x_re + lo->x_im * lo->x_im;
+  FP32 re  = (lo->y_re * lo->x_re + lo->y_im * lo->x_im) / den;
+  FP32 im  = (lo->y_im * lo->x_re - lo->y_re * lo->x_im) / den;
+
+  U32  i     = out->point_cnt;
+  FP32 phase = RAD_TO_DEG(FP32_ATAN2(im, re));
+
+  // unwrap against the previous point so phase margin can be read across -180
+  if (i > 0) {
+    while (phase - out->phase_deg[i - 1] > 180.0f)
+      phase -= 360.0f;
+    while (phase - out->phase_deg[i - 1] < -180.0f)
+      phase += 360.0f;
+  }
+
+  out->mag_db[i]    = 10.0f * log10f(re * re + im * im);
+  out->phase_deg[i] = phase;
+
+  if (++out->point_cnt < cfg->point_num) {
+    fra_point_start(fra);
+    return;
+  }
+
+  out->stim    = FP32_0;
+  out->e_state = FRA_STATE_DONE;
+  fra_summary(fra);
+}
+
+static inline void
+fra_run(fra_t *fra) {
+  DECL_FRA_PTRS(fra);
+  DECL_SINE_PTRS_PREFIX(&fra->lo.sine, sine);
+
+  if (out->e_state != FRA_STATE_SETTLE && out->e_state != FRA_STATE_MEASURE)
+    return;
+
+  if (out->e_state == FRA_STATE_MEASURE) {
+    FP32 c = FP32_COS(lo->ref_phase_rad);
+    FP32 s = FP32_SIN(lo->ref_phase_rad);
+    lo->x_re += in->x * c;
+    lo->x_im -= in->x * s;
+    lo->y_re += in->y * c;
+    lo->y_im -= in->y * s;
+  }
+
+  lo->tick_cnt++;
+  if (out->e_state == FRA_STATE_SETTLE && lo->tick_cnt >= lo->settle_ticks) {
+    out->e_state = FRA_STATE_MEASURE;
+    lo->tick_cnt = 0;
+  } else if (out->e_state == FRA_STATE_MEASURE && lo->tick_cnt >= lo->meas_ticks) {
+    fra_point_finish(fra);
+    return;
+  }
+
+  lo->ref_phase_rad = sine_in->phase_rad;
+  sine_run(sine_p);
+  out->stim = sine_out->val;
+}
+
+static inline void
+fra_run_in(fra_t *fra, FP32 x, FP32 y) {
+  DECL_FRA_PTRS(fra);
+
+  in->x = x;
+  in->y = y;
+  fra_run(fra);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // !FRA_H
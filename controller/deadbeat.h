@@ -0,0 +1,166 @@
+#ifndef DEADBEAT_H
+#define DEADBEAT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+
+#include "util/mathdef.h"
+#include "util/typedef.h"
+
+/*
+ * Deadbeat predictive current control.
+ * The forward Euler dq model is solved for the voltage that lands the current on the reference
+ * at the end of the period, so the reference is reached in one period, or two with is_delay_comp
+ * where the current at the end of the running period is predicted first from the voltage the
+ * bridge is applying now.
+ * The model error is lumped into one voltage per axis and estimated by a disturbance observer
+ * from the one step prediction error, which takes out wrong rs / flux and any offset in the
+ * voltage path. obs_gain = 1 is a deadbeat observer, smaller values trade speed for noise.
+ */
+
+typedef struct {
+  FP32          freq_hz;
+  motor_param_t motor;
+  BOOL          is_delay_comp; // 计算延时补偿, 输出在下一周期生效时开启
+  FP32          obs_gain;      // 扰动观测器增益, 0 ~ 1
+  FP32          v_ratio;       // 可用电压矢量幅值 / 母线电压
+} deadbeat_cfg_t;
+
+typedef struct {
+  fp32_dq_t i_dq, i_dq_ref;
+  FP32      vel_rads;
+  FP32      v_bus;
+} deadbeat_in_t;
+
+typedef struct {
+  fp32_dq_t v_dq;
+  fp32_dq_t dist;   // 扰动电压估计
+  fp32_dq_t i_pred; // 控制所用的电流, 延时补偿时为下一周期预测值
+} deadbeat_out_t;
+
+typedef struct {
+  fp32_dq_t i_prev;   // 上周期电流采样
+  fp32_dq_t v_apply;  // 上周期实际作用的电压
+  fp32_dq_t v_last;   // 上周期输出, 延时补偿时本周期作用
+  FP32      vel_prev; // 上周期电角速度
+  BOOL      is_run;
+} deadbeat_lo_t;
+
+typedef struct {
+  deadbeat_cfg_t cfg;
+  deadbeat_in_t  in;
+  deadbeat_out_t out;
+  deadbeat_lo_t  lo;
+} deadbeat_t;
+
+#define DECL_DEADBEAT_PTRS(db)                                                                     \
+  deadbeat_t     *p   = (db);                                                                      \
+  deadbeat_cfg_t *cfg = &p->cfg;                                                                   \
+  deadbeat_in_t  *in  = &p->in;                                                                    \
+  deadbeat_out_t *out = &p->out;                                                                   \
+  deadbeat_lo_t  *lo  = &p->lo;
+
+#define DECL_DEADBEAT_PTRS_PREFIX(db, prefix)                                                      \
+  deadbeat_t     *prefix##_p   = (db);                                                             \
+  deadbeat_cfg_t *prefix##_cfg = &prefix##_p->cfg;                                                 \
+  deadbeat_in_t  *prefix##_in  = &prefix##_p->in;                                                  \
+  deadbeat_out_t *prefix##_out = &prefix##_p->out;                                                 \
+  deadbeat_lo_t  *prefix##_lo  = &prefix##_p->lo;
+
+static inline void
+deadbeat_init(deadbeat_t *db, deadbeat_cfg_t db_cfg) {
+  DECL_DEADBEAT_PTRS(db);
+
+  *cfg = db_cfg;
+  memset(in, 0, sizeof(*in));
+  memset(out, 0, sizeof(*out));
+  memset(lo, 0, sizeof(*lo));
+}
+
+/*
+ * Restart the prediction history, call when the controller takes over the bridge.
+ * The disturbance estimate is kept.
+ */
+static inline void
+deadbeat_reset(deadbeat_t *db) {
+  DECL_DEADBEAT_PTRS(db);
+
+  memset(&lo->v_apply, 0, sizeof(lo->v_apply));
+  memset(&lo->v_last, 0, sizeof(lo->v_last));
+  lo->is_run = FALSE;
+}
+
+/*
+ * One forward Euler step of the dq model with the disturbance voltage included.
+ */
+static inline fp32_dq_t
+deadbeat_predict(const deadbeat_t *db, fp32_dq_t i, fp32_dq_t v, FP32 we) {
+  const motor_param_t *m  = &db->cfg.motor;
+  FP32                 ts = FP32_HZ_TO_S(db->cfg.freq_hz);
+
+  fp32_dq_t i_next;
+  i_next.d = i.d + ts / m->ld * (v.d - m->rs * i.d + we * m->lq * i.q + db->out.dist.d);
+  i_next.q = i.q + ts / m->lq * (v.q - m->rs * i.q - we * (m->ld * i.d + m->flux) + db->out.dist.q);
+  return i_next;
+}
+
+static inline void
+deadbeat_run(deadbeat_t *db) {
+  DECL_DEADBEAT_PTRS(db);
+
+  const motor_param_t *m  = &cfg->motor;
+  FP32                 ts = FP32_HZ_TO_S(cfg->freq_hz);
+  FP32                 we = in->vel_rads;
+
+  // what the model missed over the last period is disturbance
+  if (lo->is_run) {
+    fp32_dq_t i_pred = deadbeat_predict(db, lo->i_prev, lo->v_apply, lo->vel_prev);
+    out->dist.d += cfg->obs_gain * m->ld / ts * (in->i_dq.d - i_pred.d);
+    out->dist.q += cfg->obs_gain * m->lq / ts * (in->i_dq.q - i_pred.q);
+  }
+
+  // the voltage decided last tick is on the bridge now, predict through it first
+  fp32_dq_t i = in->i_dq;
+  if (cfg->is_delay_comp)
+    i = deadbeat_predict(db, i, lo->v_last, we);
+  out->i_pred = i;
+
+  out->v_dq.d = m->ld / ts * (in->i_dq_ref.d - i.d) + m->rs * i.d - we * m->lq * i.q - out->dist.d;
+  out->v_dq.q = m->lq / ts * (in->i_dq_ref.q - i.q) + m->rs * i.q + we * (m->ld * i.d + m->flux)
+                - out->dist.q;
+
+  // keep the stored voltage what the bridge can give, or saturation ends up in the observer
+  FP32 v_max = cfg->v_ratio * in->v_bus;
+  FP32 mag   = FP32_SQRT(out->v_dq.d * out->v_dq.d + out->v_dq.q * out->v_dq.q);
+  if (mag > v_max) {
+    FP32 scale = v_max / mag;
+    out->v_dq.d *= scale;
+    out->v_dq.q *= scale;
+  }
+
+  lo->v_apply  = cfg->is_delay_comp ? lo->v_last : out->v_dq;
+  lo->v_last   = out->v_dq;
+  lo->i_prev   = in->i_dq;
+  lo->vel_prev = we;
+  lo->is_run   = TRUE;
+}
+
+static inline void
+deadbeat_run_in(deadbeat_t *db, fp32_dq_t i_dq, fp32_dq_t i_dq_ref, FP32 vel_rads, FP32 v_bus) {
+  DECL_DEADBEAT_PTRS(db);
+
+  in->i_dq     = i_dq;
+  in->i_dq_ref = i_dq_ref;
+  in->vel_rads = vel_rads;
+  in->v_bus    = v_bus;
+  deadbeat_run(db);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // !DEADBEAT_H
@@ -0,0 +1,286 @@
+#ifndef MPC_H
+#define MPC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+
+#include "util/mathdef.h"
+#include "util/typedef.h"
+
+/*
+ * Finite-control-set model predictive current control.
+ * Every inverter switching state is a candidate voltage, the dq current one period ahead is
+ * predicted for each with the forward Euler motor model and the state with the least squared
+ * current error wins. The candidates are kept as SoA lanes so the prediction and cost run as one
+ * branch free loop over MPC_VEC_NUM lanes. With is_delay_comp the prediction first steps through
+ * the voltage chosen last tick, which is the one the inverter is applying while this tick computes.
+ *
+ * A single vector held for a whole period moves the current by v_bus * ts / L, amps on a low
+ * inductance motor, so the plain finite set trades a ripple far above a modulated loop for its one
+ * tick response. With is_modulated the candidates are the switching sequences instead: each
+ * sector's two active vectors and the zero vector share the period, the duties minimising the same
+ * predicted cost are solved per sector on the duty triangle, the cheapest sector wins and its
+ * average vector goes to svpwm like any other voltage, at the fixed switching frequency.
+ */
+
+#define MPC_VEC_NUM (8U) // 000 ~ 111, 两个零矢量都参与, 按开关次数取舍
+#define MPC_SEC_NUM (6U)
+
+/* 有效矢量按角度排列, 0, 60, ..., 300 度 */
+static const U32 MPC_SEC_IDX[MPC_SEC_NUM] = {1U, 3U, 2U, 6U, 4U, 5U};
+
+typedef struct {
+  FP32          freq_hz;
+  motor_param_t motor;
+  BOOL          is_delay_comp; // 计算延时补偿, 输出在下一周期生效时开启
+  BOOL          is_modulated;  // 扇区内两有效矢量和零矢量按代价分配占空比, 经 svpwm 输出
+} mpc_cfg_t;
+
+typedef struct {
+  fp32_dq_t i_dq, i_dq_ref;
+  FP32      theta_rad; // 本周期电角度
+  FP32      vel_rads;
+  FP32      v_bus;
+} mpc_in_t;
+
+typedef struct {
+  U32       idx; // 开关状态, bit0 u, bit1 v, bit2 w; 调制型时为扇区
+  u32_uvw_t state;
+  fp32_ab_t v_ab;
+  fp32_dq_t v_dq;
+  FP32      cost;
+} mpc_out_t;
+
+typedef struct {
+  FP32 va[MPC_VEC_NUM], vb[MPC_VEC_NUM]; // 单位母线电压下的候选矢量
+  FP32 cost[MPC_VEC_NUM];
+  U32  prev_idx;
+  FP32 prev_va, prev_vb; // 上周期输出的平均矢量, 单位母线电压
+} mpc_lo_t;
+
+typedef struct {
+  mpc_cfg_t cfg;
+  mpc_in_t  in;
+  mpc_out_t out;
+  mpc_lo_t  lo;
+} mpc_t;
+
+#define DECL_MPC_PTRS(mpc)                                                                         \
+  mpc_t     *p   = (mpc);                                                                          \
+  mpc_cfg_t *cfg = &p->cfg;                                                                        \
+  mpc_in_t  *in  = &p->in;                                                                         \
+  mpc_out_t *out = &p->out;                                                                        \
+  mpc_lo_t  *lo  = &p->lo;
+
+#define DECL_MPC_PTRS_PREFIX(mpc, prefix)                                                          \
+  mpc_t     *prefix##_p   = (mpc);                                                                 \
+  mpc_cfg_t *prefix##_cfg = &prefix##_p->cfg;                                                      \
+  mpc_in_t  *prefix##_in  = &prefix##_p->in;                                                       \
+  mpc_out_t *prefix##_out = &prefix##_p->out;                                                      \
+  mpc_lo_t  *prefix##_lo  = &prefix##_p->lo;
+
+static inline void
+mpc_init(mpc_t *mpc, mpc_cfg_t mpc_cfg) {
+  DECL_MPC_PTRS(mpc);
+
+  *cfg = mpc_cfg;
+  memset(in, 0, sizeof(*in));
+  memset(out, 0, sizeof(*out));
+  memset(lo, 0, sizeof(*lo));
+
+  // amplitude invariant clarke of the pole voltages
+  for (U32 i = 0; i < MPC_VEC_NUM; i++) {
+    FP32 u = (FP32)(i & 1U), v = (FP32)((i >> 1) & 1U), w = (FP32)((i >> 2) & 1U);
+    lo->va[i] = FP32_2_DIV_3 * (u - FP32_1_DIV_2 * (v + w));
+    lo->vb[i] = FP32_1_DIV_SQRT_3 * (v - w);
+  }
+}
+
+/*
+ * cost[n] = |i_ref - (a + k * v_n)|^2 with v_n rotated into dq, e = i_ref - a precomputed.
+ */
+static inline void
+mpc_cost(FP32       *cost,
+         const FP32 *va,
+         const FP32 *vb,
+         U32         num,
+         FP32        c,
+         FP32        s,
+         FP32        ed,
+         FP32        eq,
+         FP32        kd,
+         FP32        kq) {
+  for (U32 i = 0; i < num; i++) {
+    FP32 dd = ed - kd * (c * va[i] + s * vb[i]);
+    FP32 dq = eq - kq * (c * vb[i] - s * va[i]);
+    cost[i] = dd * dd + dq * dq;
+  }
+}
+
+static inline U32
+mpc_switch_cnt(U32 a, U32 b) {
+  U32 x = a ^ b;
+  return (x & 1U) + ((x >> 1) & 1U) + ((x >> 2) & 1U);
+}
+
+/*
+ * One switching state for the whole period.
+ */
+static inline void
+mpc_select(mpc_t *mpc) {
+  DECL_MPC_PTRS(mpc);
+
+  U32 best = 0;
+  for (U32 i = 1; i < MPC_VEC_NUM; i++) {
+    if (lo->cost[i] < lo->cost[best])
+      best = i;
+  }
+
+  // both zero vectors cost the same, take the one closer to the present state
+  if (best == 0 || best == MPC_VEC_NUM - 1U)
+    best = (mpc_switch_cnt(lo->prev_idx, 0U) <= mpc_switch_cnt(lo->prev_idx, MPC_VEC_NUM - 1U))
+               ? 0U
+               : MPC_VEC_NUM - 1U;
+
+  out->idx     = best;
+  out->cost    = lo->cost[best];
+  out->state.u = best & 1U;
+  out->state.v = (best >> 1) & 1U;
+  out->state.w = (best >> 2) & 1U;
+  lo->prev_idx = best;
+  lo->prev_va  = lo->va[best];
+  lo->prev_vb  = lo->vb[best];
+}
+
+/*
+ * |e - da * ua - db * ub|^2 with ua, ub the dq current steps of the two active vectors.
+ */
+static inline FP32
+mpc_seq_cost(FP32 ee, FP32 ea, FP32 eb, FP32 gaa, FP32 gab, FP32 gbb, FP32 da, FP32 db) {
+  return ee - FP32_2 * (da * ea + db * eb) + da * da * gaa + FP32_2 * da * db * gab
+       + db * db * gbb;
+}
+
+/*
+ * Two adjacent active vectors and the zero vector per sector. The cost is quadratic in the duties,
+ * the unconstrained minimum is taken when it lies in da, db >= 0, da + db <= 1, otherwise the best
+ * point on the three edges of that triangle.
+ */
+static inline void
+mpc_modulate(mpc_t *mpc, FP32 c, FP32 s, FP32 ed, FP32 eq, FP32 kd, FP32 kq) {
+  DECL_MPC_PTRS(mpc);
+
+  FP32 ee   = ed * ed + eq * eq;
+  U32  best = 0;
+  FP32 best_j = ee, best_da = FP32_0, best_db = FP32_0;
+  for (U32 k = 0; k < MPC_SEC_NUM; k++) {
+    U32  a  = MPC_SEC_IDX[k], b = MPC_SEC_IDX[(k + 1U < MPC_SEC_NUM) ? k + 1U : 0U];
+    FP32 ad = kd * (c * lo->va[a] + s * lo->vb[a]), aq = kq * (c * lo->vb[a] - s * lo->va[a]);
+    FP32 bd = kd * (c * lo->va[b] + s * lo->vb[b]), bq = kq * (c * lo->vb[b] - s * lo->va[b]);
+    FP32 gaa = ad * ad + aq * aq, gbb = bd * bd + bq * bq, gab = ad * bd + aq * bq;
+    FP32 ea = ad * ed + aq * eq, eb = bd * ed + bq * eq;
+    FP32 det = gaa * gbb - gab * gab;
+    if (!(det > FP32_0))
+      continue;
+
+    FP32 da = (gbb * ea - gab * eb) / det, db = (gaa * eb - gab * ea) / det;
+    if (da < FP32_0 || db < FP32_0 || da + db > FP32_1) {
+      // da = 0, db = 0 and da + db = 1, each a 1-d least squares clamped to the edge
+      FP32 t0 = eb / gbb, t1 = ea / gaa;
+      FP32 gw = gaa - FP32_2 * gab + gbb;
+      FP32 t2 = (ea - eb - gab + gbb) / gw;
+      CLAMP(t0, FP32_0, FP32_1);
+      CLAMP(t1, FP32_0, FP32_1);
+      CLAMP(t2, FP32_0, FP32_1);
+
+      FP32 j0 = mpc_seq_cost(ee, ea, eb, gaa, gab, gbb, FP32_0, t0);
+      FP32 j1 = mpc_seq_cost(ee, ea, eb, gaa, gab, gbb, t1, FP32_0);
+      FP32 j2 = mpc_seq_cost(ee, ea, eb, gaa, gab, gbb, t2, FP32_1 - t2);
+      da = FP32_0;
+      db = t0;
+      if (j1 < j0) {
+        da = t1;
+        db = FP32_0;
+        j0 = j1;
+      }
+      if (j2 < j0) {
+        da = t2;
+        db = FP32_1 - t2;
+      }
+    }
+
+    FP32 j = mpc_seq_cost(ee, ea, eb, gaa, gab, gbb, da, db);
+    if (j < best_j) {
+      best    = k;
+      best_j  = j;
+      best_da = da;
+      best_db = db;
+    }
+  }
+
+  U32 a = MPC_SEC_IDX[best], b = MPC_SEC_IDX[(best + 1U < MPC_SEC_NUM) ? best + 1U : 0U];
+  out->idx    = best;
+  out->cost   = best_j;
+  lo->prev_va = best_da * lo->va[a] + best_db * lo->va[b];
+  lo->prev_vb = best_da * lo->vb[a] + best_db * lo->vb[b];
+}
+
+static inline void
+mpc_run(mpc_t *mpc) {
+  DECL_MPC_PTRS(mpc);
+
+  const motor_param_t *m = &cfg->motor;
+
+  FP32 ts = FP32_HZ_TO_S(cfg->freq_hz);
+  FP32 kd = ts / m->ld * in->v_bus, kq = ts / m->lq * in->v_bus;
+  FP32 id = in->i_dq.d, iq = in->i_dq.q, we = in->vel_rads;
+
+  // the voltage decided last tick is on the bridge now, predict through it first
+  FP32 theta = in->theta_rad + we * ts * FP32_1_DIV_2;
+  if (cfg->is_delay_comp) {
+    FP32 c  = FP32_COS(theta), s = FP32_SIN(theta);
+    FP32 va = lo->prev_va, vb = lo->prev_vb;
+    FP32 vd = (c * va + s * vb) * in->v_bus, vq = (c * vb - s * va) * in->v_bus;
+    FP32 nd = id + ts * (vd - m->rs * id + we * m->lq * iq) / m->ld;
+    iq += ts * (vq - m->rs * iq - we * (m->ld * id + m->flux)) / m->lq;
+    id = nd;
+    theta += we * ts;
+  }
+
+  FP32 c  = FP32_COS(theta), s = FP32_SIN(theta);
+  FP32 ed = in->i_dq_ref.d - (id + ts * (-m->rs * id + we * m->lq * iq) / m->ld);
+  FP32 eq = in->i_dq_ref.q - (iq + ts * (-m->rs * iq - we * (m->ld * id + m->flux)) / m->lq);
+  if (cfg->is_modulated) {
+    mpc_modulate(mpc, c, s, ed, eq, kd, kq);
+  } else {
+    mpc_cost(lo->cost, lo->va, lo->vb, MPC_VEC_NUM, c, s, ed, eq, kd, kq);
+    mpc_select(mpc);
+  }
+
+  out->v_ab.a = lo->prev_va * in->v_bus;
+  out->v_ab.b = lo->prev_vb * in->v_bus;
+  out->v_dq.d = c * out->v_ab.a + s * out->v_ab.b;
+  out->v_dq.q = c * out->v_ab.b - s * out->v_ab.a;
+}
+
+static inline void
+mpc_run_in(
+    mpc_t *mpc, fp32_dq_t i_dq, fp32_dq_t i_dq_ref, FP32 theta_rad, FP32 vel_rads, FP32 v_bus) {
+  DECL_MPC_PTRS(mpc);
+
+  in->i_dq      = i_dq;
+  in->i_dq_ref  = i_dq_ref;
+  in->theta_rad = theta_rad;
+  in->vel_rads  = vel_rads;
+  in->v_bus     = v_bus;
+  mpc_run(mpc);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // !MPC_H
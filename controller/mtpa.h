@@ -0,0 +1,236 @@
+#ifndef MTPA_H
+#define MTPA_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+
+#include "util/errdef.h"
+#include "util/mathdef.h"
+#include "util/typedef.h"
+
+/*
+ * Torque to dq current reference by table lookup.
+ * The table holds the minimum current operating point (MTPA) for each torque, pushed onto the
+ * voltage ellipse (field weakening) where the speed requires it, and the torque reduced where
+ * even that is not enough. The speed axis is |we| / v_bus, which makes one table valid for any
+ * bus voltage since the stator resistance is left out. Torque sign is applied to iq at runtime.
+ *
+ * The table is a flat blob, mtpa_tbl_t followed by I16 pairs (id, iq) in [speed][torque] order,
+ * so it can be linked in as const data or loaded from a file as is.
+ * The generator is offline code (FP64, libm, seconds of brute force) and is only compiled where
+ * MTPA_GEN is defined before the include.
+ */
+
+#define MTPA_TBL_MAGIC (0x4150544DU) // "MTPA"
+
+typedef struct {
+  U32  magic;
+  U16  torque_num; // 转矩轴点数
+  U16  speed_num;  // 速度轴点数
+  FP32 torque_max; // 转矩轴满量程, N*m
+  FP32 speed_max;  // 速度轴满量程, 电角速度 / 母线电压, rad/s/V
+  FP32 cur_lsb;    // 电流分辨率, A/LSB
+  I16  data[];     // id, iq 交织
+} mtpa_tbl_t;
+
+#define MTPA_TBL_SIZE(torque_num, speed_num)                                                       \
+  (sizeof(mtpa_tbl_t) + (size_t)(torque_num) * (speed_num) * 2U * sizeof(I16))
+
+typedef struct {
+  const mtpa_tbl_t *tbl;
+} mtpa_cfg_t;
+
+typedef struct {
+  FP32 torque_nm;
+  FP32 vel_rads; // 电角速度
+  FP32 v_bus;
+} mtpa_in_t;
+
+typedef struct {
+  fp32_dq_t i_dq;
+} mtpa_out_t;
+
+typedef struct {
+  FP32 torque_scale;
+  FP32 speed_scale;
+  FP32 torque_idx_max;
+  FP32 speed_idx_max;
+} mtpa_lo_t;
+
+typedef struct {
+  mtpa_cfg_t cfg;
+  mtpa_in_t  in;
+  mtpa_out_t out;
+  mtpa_lo_t  lo;
+} mtpa_t;
+
+#define DECL_MTPA_PTRS(mtpa)                                                                       \
+  mtpa_t     *p   = (mtpa);                                                                        \
+  mtpa_cfg_t *cfg = &p->cfg;                                                                       \
+  mtpa_in_t  *in  = &p->in;                                                                        \
+  mtpa_out_t *out = &p->out;                                                                       \
+  mtpa_lo_t  *lo  = &p->lo;
+
+#define DECL_MTPA_PTRS_PREFIX(mtpa, prefix)                                                        \
+  mtpa_t     *prefix##_p   = (mtpa);                                                               \
+  mtpa_cfg_t *prefix##_cfg = &prefix##_p->cfg;                                                     \
+  mtpa_in_t  *prefix##_in  = &prefix##_p->in;                                                      \
+  mtpa_out_t *prefix##_out = &prefix##_p->out;                                                     \
+  mtpa_lo_t  *prefix##_lo  = &prefix##_p->lo;
+
+#ifdef MTPA_GEN
+
+typedef struct {
+  motor_param_t motor;
+  U16           torque_num;
+  U16           speed_num;
+  FP32          cur_max;   // 电流幅值上限
+  FP32          v_max;     // 可用电压矢量幅值 / 母线电压, 线性调制为 1/sqrt(3)
+  FP32          speed_max; // rad/s/V
+} mtpa_gen_cfg_t;
+
+/*
+ * Offline solve of one operating point, brute force over id.
+ * Returns FALSE when the torque cannot be produced within the current and voltage limits.
+ */
+static inline BOOL
+mtpa_solve(const mtpa_gen_cfg_t *gen, FP64 torque_nm, FP64 speed, FP64 *id, FP64 *iq) {
+  const motor_param_t *m      = &gen->motor;
+  FP64                 i2_max = (FP64)gen->cur_max * gen->cur_max;
+  FP64                 v2_max = (FP64)gen->v_max * gen->v_max;
+  FP64                 i2_min = i2_max + 1.0;
+
+  for (U32 n = 0; n <= 4000U; n++) {
+    FP64 d   = -(FP64)gen->cur_max * n / 4000.0;
+    FP64 den = 1.5 * m->npp * (m->flux + (m->ld - m->lq) * d);
+    if (den <= 0.0)
+      break;
+
+    FP64 q  = torque_nm / den;
+    FP64 i2 = d * d + q * q;
+    FP64 vd = speed * m->lq * q, vq = speed * (m->ld * d + m->flux);
+    if (i2 > i2_max || vd * vd + vq * vq > v2_max || i2 >= i2_min)
+      continue;
+
+    i2_min = i2;
+    *id    = d;
+    *iq    = q;
+  }
+
+  return i2_min <= i2_max;
+}
+
+static inline void
+mtpa_tbl_gen(mtpa_tbl_t *tbl, mtpa_gen_cfg_t gen) {
+  const motor_param_t *m = &gen.motor;
+
+  // the mtpa torque at the current limit spans the torque axis
+  FP64 torque_max = 0.0;
+  for (U32 n = 0; n <= 4000U; n++) {
+    FP64 beta   = FP32_PI_DIV_2 * n / 4000.0;
+    FP64 d      = -gen.cur_max * sin(beta), q = gen.cur_max * cos(beta);
+    FP64 torque = 1.5 * m->npp * (m->flux * q + (m->ld - m->lq) * d * q);
+    torque_max  = torque > torque_max ? torque : torque_max;
+  }
+
+  tbl->magic      = MTPA_TBL_MAGIC;
+  tbl->torque_num = gen.torque_num;
+  tbl->speed_num  = gen.speed_num;
+  tbl->torque_max = (FP32)torque_max;
+  tbl->speed_max  = gen.speed_max;
+  tbl->cur_lsb    = gen.cur_max / 32767.0f;
+
+  for (U32 s = 0; s < gen.speed_num; s++) {
+    FP64 speed = (FP64)gen.speed_max * s / (gen.speed_num - 1U);
+    for (U32 t = 0; t < gen.torque_num; t++) {
+      FP64 torque = torque_max * t / (gen.torque_num - 1U);
+      FP64 id = -gen.cur_max, iq = 0.0;
+
+      // back the torque off until the point fits under both limits
+      for (U32 k = 0; k <= 1000U; k++) {
+        if (mtpa_solve(&gen, torque * (1.0 - k / 1000.0), speed, &id, &iq))
+          break;
+      }
+
+      I16 *p = &tbl->data[2U * (s * gen.torque_num + t)];
+      p[0]   = (I16)lround(id / tbl->cur_lsb);
+      p[1]   = (I16)lround(iq / tbl->cur_lsb);
+    }
+  }
+}
+
+#endif // MTPA_GEN
+
+static inline ret_e
+mtpa_init(mtpa_t *mtpa, mtpa_cfg_t mtpa_cfg) {
+  DECL_MTPA_PTRS(mtpa);
+
+  memset(cfg, 0, sizeof(*cfg));
+  memset(in, 0, sizeof(*in));
+  memset(out, 0, sizeof(*out));
+  memset(lo, 0, sizeof(*lo));
+
+  const mtpa_tbl_t *tbl = mtpa_cfg.tbl;
+  if (!tbl || tbl->magic != MTPA_TBL_MAGIC || tbl->torque_num < 2 || tbl->speed_num < 2
+      || tbl->torque_max <= FP32_0 || tbl->speed_max <= FP32_0)
+    return FAIL;
+
+  *cfg               = mtpa_cfg;
+  lo->torque_idx_max = (FP32)(tbl->torque_num - 1U);
+  lo->speed_idx_max  = (FP32)(tbl->speed_num - 1U);
+  lo->torque_scale   = lo->torque_idx_max / tbl->torque_max;
+  lo->speed_scale    = lo->speed_idx_max / tbl->speed_max;
+
+  return OK;
+}
+
+static inline void
+mtpa_run(mtpa_t *mtpa) {
+  DECL_MTPA_PTRS(mtpa);
+
+  const mtpa_tbl_t *tbl = cfg->tbl;
+
+  FP32 t = FP32_ABS(in->torque_nm) * lo->torque_scale;
+  FP32 s = (in->v_bus > FP32_1) ? FP32_ABS(in->vel_rads) / in->v_bus * lo->speed_scale : FP32_0;
+  CLAMP(t, FP32_0, lo->torque_idx_max);
+  CLAMP(s, FP32_0, lo->speed_idx_max);
+
+  U32 ti = (U32)t, si = (U32)s;
+  if (ti > tbl->torque_num - 2U)
+    ti = tbl->torque_num - 2U;
+  if (si > tbl->speed_num - 2U)
+    si = tbl->speed_num - 2U;
+  FP32 ft = t - (FP32)ti, fs = s - (FP32)si;
+
+  const I16 *p0 = &tbl->data[2U * (si * tbl->torque_num + ti)];
+  const I16 *p1 = p0 + 2U * tbl->torque_num;
+
+  FP32 d0 = (FP32)p0[0] + ft * (FP32)(p0[2] - p0[0]);
+  FP32 q0 = (FP32)p0[1] + ft * (FP32)(p0[3] - p0[1]);
+  FP32 d1 = (FP32)p1[0] + ft * (FP32)(p1[2] - p1[0]);
+  FP32 q1 = (FP32)p1[1] + ft * (FP32)(p1[3] - p1[1]);
+
+  out->i_dq.d = (d0 + fs * (d1 - d0)) * tbl->cur_lsb;
+  out->i_dq.q = (q0 + fs * (q1 - q0)) * tbl->cur_lsb;
+  if (in->torque_nm < FP32_0)
+    out->i_dq.q = -out->i_dq.q;
+}
+
+static inline void
+mtpa_run_in(mtpa_t *mtpa, FP32 torque_nm, FP32 vel_rads, FP32 v_bus) {
+  DECL_MTPA_PTRS(mtpa);
+
+  in->torque_nm = torque_nm;
+  in->vel_rads  = vel_rads;
+  in->v_bus     = v_bus;
+  mtpa_run(mtpa);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // !MTPA_H
@@ -87,6 +87,29 @@ pid_run_in(pid_ctrl_t *pid, FP32 ref, FP32 fdb) {
   pid_run(pid);
 }
 
+/*
+ * One step on the running gains, then pid_cfg takes over with the integrator moved so this step's
+ * output, clamped to the new limits, is kp * err + ki_out under the new gains. The step after runs
+ * on the new gains alone. Without kd the output stays continuous across the change.
+ */
+static inline void
+pid_swap_run_in(pid_ctrl_t *pid, const pid_cfg_t *pid_cfg, FP32 ref, FP32 fdb) {
+  DECL_PID_PTRS(pid);
+
+  pid_run_in(pid, ref, fdb);
+  FP32 val = out->val;
+  CLAMP(val, -pid_cfg->out_max, pid_cfg->out_max);
+
+  *cfg       = *pid_cfg;
+  lo->kp_out = cfg->kp * lo->err;
+  lo->ki_out = val - lo->kp_out;
+  CLAMP(lo->ki_out, -cfg->integral_max, cfg->integral_max);
+  lo->kd_out = FP32_0;
+
+  out->val = lo->kp_out + lo->ki_out;
+  CLAMP(out->val, -cfg->out_max, cfg->out_max);
+}
+
 #ifdef __cpluscplus
 }
 #endif
@@ -0,0 +1,171 @@
+#ifndef RESONANT_H
+#define RESONANT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+
+#include "util/mathdef.h"
+#include "util/typedef.h"
+
+/*
+ * Multi-resonant bank for the dq current loops, one resonator per harmonic order of the
+ * electrical angle (6 and 12 for dead time and flux harmonics) on each axis.
+ * Each resonator is an integrator in a frame turning at h * theta: the error is demodulated by
+ * e^-jh*theta, integrated and modulated back, which is a resonant controller whose centre follows
+ * the angle exactly instead of a velocity estimate.
+ * The modulation leads by the angle of the plant r + jwl and by the delay, so the loop closes on a
+ * real gain at every order. The integrator gain is bw * |r + jwl|, every order converges at bw.
+ * One sincos of theta per tick, the orders come from rotating it, the delay rotation is a short
+ * series. Orders with h * |we| * ts beyond FP32_PI_DIV_2 are held off.
+ */
+
+#ifndef RES_HARM_MAX
+#define RES_HARM_MAX (4U)
+#endif
+
+typedef struct {
+  FP32 freq_hz;            // 调用频率
+  U32  harm_num;           // 谐振器个数, 0 为旁路
+  U32  harm[RES_HARM_MAX]; // 谐波次数, 升序
+  FP32 bw;                 // 收敛带宽, rad/s
+  FP32 l, r;               // 被控对象, 电感和等效电阻
+  FP32 delay;              // 采样到电压生效的周期数
+  FP32 vel_min;            // 电角速度低于该值时关闭
+  FP32 out_max;            // 单个谐振器输出限幅
+} res_cfg_t;
+
+typedef struct {
+  fp32_dq_t err;
+  FP32      theta_rad;
+  FP32      vel_rads;
+} res_in_t;
+
+typedef struct {
+  fp32_dq_t val;
+} res_out_t;
+
+typedef struct {
+  FP32 dc[RES_HARM_MAX], ds[RES_HARM_MAX]; // d 轴积分器
+  FP32 qc[RES_HARM_MAX], qs[RES_HARM_MAX]; // q 轴积分器
+} res_lo_t;
+
+typedef struct {
+  res_cfg_t cfg;
+  res_in_t  in;
+  res_out_t out;
+  res_lo_t  lo;
+} res_ctrl_t;
+
+#define DECL_RES_PTRS(res)                                                                         \
+  res_ctrl_t *p   = (res);                                                                         \
+  res_cfg_t  *cfg = &p->cfg;                                                                       \
+  res_in_t   *in  = &p->in;                                                                        \
+  res_out_t  *out = &p->out;                                                                       \
+  res_lo_t   *lo  = &p->lo;
+
+#define DECL_RES_PTRS_PREFIX(res, prefix)                                                          \
+  res_ctrl_t *prefix##_p   = (res);                                                                \
+  res_cfg_t  *prefix##_cfg = &prefix##_p->cfg;                                                     \
+  res_in_t   *prefix##_in  = &prefix##_p->in;                                                      \
+  res_out_t  *prefix##_out = &prefix##_p->out;                                                     \
+  res_lo_t   *prefix##_lo  = &prefix##_p->lo;
+
+static inline void
+res_init(res_ctrl_t *res, res_cfg_t res_cfg) {
+  DECL_RES_PTRS(res);
+
+  *cfg = res_cfg;
+  if (cfg->harm_num > RES_HARM_MAX)
+    cfg->harm_num = RES_HARM_MAX;
+
+  memset(in, 0, sizeof(*in));
+  memset(out, 0, sizeof(*out));
+  memset(lo, 0, sizeof(*lo));
+}
+
+static inline void
+res_reset(res_ctrl_t *res) {
+  DECL_RES_PTRS(res);
+
+  memset(out, 0, sizeof(*out));
+  memset(lo, 0, sizeof(*lo));
+}
+
+static inline void
+res_run(res_ctrl_t *res) {
+  DECL_RES_PTRS(res);
+
+  FP32 ts = FP32_HZ_TO_S(cfg->freq_hz);
+  FP32 we = FP32_ABS(in->vel_rads);
+
+  out->val.d = out->val.q = FP32_0;
+  if (we < cfg->vel_min) {
+    memset(lo, 0, sizeof(*lo));
+    return;
+  }
+
+  // e^j*theta, and e^j*(theta + delay) with the delay rotation from its series
+  FP32 c1  = FP32_COS(in->theta_rad), s1 = FP32_SIN(in->theta_rad);
+  FP32 x   = in->vel_rads * ts * cfg->delay, x2 = x * x;
+  FP32 cx  = FP32_1 - x2 * FP32_1_DIV_2 * (FP32_1 - x2 / 12.0f);
+  FP32 sx  = x * (FP32_1 - x2 / 6.0f * (FP32_1 - x2 / 20.0f));
+  FP32 c1r = c1 * cx - s1 * sx, s1r = s1 * cx + c1 * sx;
+
+  FP32 c = FP32_1, s = FP32_0, cr = FP32_1, sr = FP32_0;
+  U32  h = 0;
+  for (U32 i = 0; i < cfg->harm_num; i++) {
+    for (; h < cfg->harm[i]; h++) {
+      FP32 t = c * c1 - s * s1;
+      s      = s * c1 + c * s1;
+      c      = t;
+      t      = cr * c1r - sr * s1r;
+      sr     = sr * c1r + cr * s1r;
+      cr     = t;
+    }
+
+    FP32 w = (FP32)h * we;
+    if (w * ts > FP32_PI_DIV_2)
+      break;
+
+    // lead by the plant angle, integrate at bw * |z|
+    FP32 zr = cfg->r, zi = w * cfg->l;
+    FP32 z2 = zr * zr + zi * zi;
+    FP32 zn = FP32_1 / FP32_SQRT(z2);
+    FP32 k  = cfg->bw * z2 * zn * ts;
+    FP32 pc = zr * zn, ps = zi * zn;
+    if (in->vel_rads < FP32_0)
+      ps = -ps;
+    FP32 mc = cr * pc - sr * ps, ms = sr * pc + cr * ps;
+
+    lo->dc[i] += k * in->err.d * c;
+    lo->ds[i] += k * in->err.d * s;
+    lo->qc[i] += k * in->err.q * c;
+    lo->qs[i] += k * in->err.q * s;
+    CLAMP(lo->dc[i], -cfg->out_max, cfg->out_max);
+    CLAMP(lo->ds[i], -cfg->out_max, cfg->out_max);
+    CLAMP(lo->qc[i], -cfg->out_max, cfg->out_max);
+    CLAMP(lo->qs[i], -cfg->out_max, cfg->out_max);
+
+    out->val.d += FP32_2 * (lo->dc[i] * mc + lo->ds[i] * ms);
+    out->val.q += FP32_2 * (lo->qc[i] * mc + lo->qs[i] * ms);
+  }
+}
+
+static inline void
+res_run_in(res_ctrl_t *res, fp32_dq_t err, FP32 theta_rad, FP32 vel_rads) {
+  DECL_RES_PTRS(res);
+
+  in->err       = err;
+  in->theta_rad = theta_rad;
+  in->vel_rads  = vel_rads;
+  res_run(res);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // !RESONANT_H
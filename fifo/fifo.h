@@ -62,6 +62,7 @@ typedef struct {
     pthread_spin_init(&(fifo)->lock, PTHREAD_PROCESS_PRIVATE);                                     \
   } while (0)
 
+/* SMP_* 在 util.h 中为空, 跨核无锁使用 fifo/spsc.h */
 #define FIFO_PUT(fifo, txbuf, len)                                                                 \
   do {                                                                                             \
     U32 size = MIN((len), (fifo)->size - (fifo)->w + (fifo)->r);                                   \
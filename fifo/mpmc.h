@@ -0,0 +1,151 @@
+#ifndef MPMC_H
+#define MPMC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+
+#include "util/errdef.h"
+#include "util/typedef.h"
+
+/*
+ * Bounded multi producer, multi consumer queue of fixed size records (Vyukov).
+ * Every cell has a sequence number that says whose turn it is: equal to the position when free
+ * for the producer claiming that position, position + 1 when full for the consumer claiming it.
+ * A producer claims a position with one CAS on enq, copies the record and hands the cell over
+ * with a release store of its sequence, so producers only contend on the CAS and a slow one
+ * holds up nobody but the consumer of its own cell. Records from one producer come out in order.
+ * The batch calls check how many cells in a row are ready and claim them all with one CAS.
+ * Same __atomic builtins and cache line separation as fifo/spsc.h.
+ */
+
+#ifndef MPMC_CACHE_LINE
+#define MPMC_CACHE_LINE (64U)
+#endif
+
+#define MPMC_ALIGNED __attribute__((aligned(MPMC_CACHE_LINE)))
+
+/* 单元为序号加记录, 按 8 字节对齐 */
+#define MPMC_CELL_SIZE(rec_size)     ((sizeof(U32) + (rec_size) + 7U) & ~7U)
+#define MPMC_BUF_SIZE(num, rec_size) ((num) * MPMC_CELL_SIZE(rec_size))
+
+typedef struct {
+  volatile U32 enq MPMC_ALIGNED; // 下一个写位置
+  volatile U32 deq MPMC_ALIGNED; // 下一个读位置
+
+  /* 初始化后只读 */
+  U8 *buf MPMC_ALIGNED;
+  U32 num; // 单元数, 2 的幂
+  U32 mask;
+  U32 rec_size;
+  U32 cell_size;
+} mpmc_t;
+
+static inline volatile U32 *
+mpmc_seq(const mpmc_t *mpmc, U32 pos) {
+  return (volatile U32 *)(mpmc->buf + (pos & mpmc->mask) * mpmc->cell_size);
+}
+
+static inline U8 *
+mpmc_rec(const mpmc_t *mpmc, U32 pos) {
+  return mpmc->buf + (pos & mpmc->mask) * mpmc->cell_size + sizeof(U32);
+}
+
+/*
+ * buf holds MPMC_BUF_SIZE(num, rec_size) bytes, 4 byte aligned.
+ */
+static inline ret_e
+mpmc_init(mpmc_t *mpmc, void *buf, U32 num, U32 rec_size) {
+  if (!buf || !num || (num & (num - 1U)) || !rec_size)
+    return FAIL;
+
+  memset(mpmc, 0, sizeof(*mpmc));
+  mpmc->buf       = (U8 *)buf;
+  mpmc->num       = num;
+  mpmc->mask      = num - 1U;
+  mpmc->rec_size  = rec_size;
+  mpmc->cell_size = MPMC_CELL_SIZE(rec_size);
+  for (U32 i = 0; i < num; i++)
+    *mpmc_seq(mpmc, i) = i;
+  return OK;
+}
+
+/*
+ * Claims up to num positions of *cnt in a row, off is how far past a position the sequence of a
+ * ready cell is: 0 to put, 1 to get. Returns the first position, *claim_num how many were claimed.
+ */
+static inline U32
+mpmc_claim(mpmc_t *mpmc, volatile U32 *cnt, U32 num, U32 off, U32 *claim_num) {
+  U32 pos = __atomic_load_n(cnt, __ATOMIC_RELAXED);
+  for (;;) {
+    U32 n = 0;
+    while (n < num) {
+      U32 seq = __atomic_load_n(mpmc_seq(mpmc, pos + n), __ATOMIC_ACQUIRE);
+      if (seq != pos + n + off)
+        break;
+      n++;
+    }
+
+    if (!n) {
+      // a cell a lap behind is full (or empty), one ahead means pos was taken meanwhile
+      U32 seq = __atomic_load_n(mpmc_seq(mpmc, pos), __ATOMIC_ACQUIRE);
+      if ((I32)(seq - (pos + off)) < 0) {
+        *claim_num = 0;
+        return pos;
+      }
+      pos = __atomic_load_n(cnt, __ATOMIC_RELAXED);
+      continue;
+    }
+
+    if (__atomic_compare_exchange_n(cnt, &pos, pos + n, TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+      *claim_num = n;
+      return pos;
+    }
+  }
+}
+
+/*
+ * Up to num records from buf, returns how many went in, 0 when full.
+ */
+static inline U32
+mpmc_put_batch(mpmc_t *mpmc, const void *buf, U32 num) {
+  U32 n;
+  U32 pos = mpmc_claim(mpmc, &mpmc->enq, num, 0U, &n);
+  for (U32 i = 0; i < n; i++) {
+    memcpy(mpmc_rec(mpmc, pos + i), (const U8 *)buf + i * mpmc->rec_size, mpmc->rec_size);
+    __atomic_store_n(mpmc_seq(mpmc, pos + i), pos + i + 1U, __ATOMIC_RELEASE);
+  }
+  return n;
+}
+
+/*
+ * Up to num records into buf, returns how many came out, 0 when empty.
+ */
+static inline U32
+mpmc_get_batch(mpmc_t *mpmc, void *buf, U32 num) {
+  U32 n;
+  U32 pos = mpmc_claim(mpmc, &mpmc->deq, num, 1U, &n);
+  for (U32 i = 0; i < n; i++) {
+    memcpy((U8 *)buf + i * mpmc->rec_size, mpmc_rec(mpmc, pos + i), mpmc->rec_size);
+    __atomic_store_n(mpmc_seq(mpmc, pos + i), pos + i + mpmc->num, __ATOMIC_RELEASE);
+  }
+  return n;
+}
+
+static inline ret_e
+mpmc_put(mpmc_t *mpmc, const void *rec) {
+  return mpmc_put_batch(mpmc, rec, 1U) ? OK : FAIL;
+}
+
+static inline ret_e
+mpmc_get(mpmc_t *mpmc, void *rec) {
+  return mpmc_get_batch(mpmc, rec, 1U) ? OK : FAIL;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // !MPMC_H
@@ -0,0 +1,149 @@
+#ifndef SPSC_H
+#define SPSC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+
+#include "util/errdef.h"
+#include "util/mathdef.h"
+#include "util/typedef.h"
+
+/*
+ * Single producer, single consumer byte ring that is safe across cores without a lock.
+ * The producer owns w, the consumer owns r, each is published with a release store and read by the
+ * other side with an acquire load, so the bytes are visible before the index that covers them. The
+ * orders are the C11 ones through the __atomic builtins, which keeps the header usable from C++.
+ * Each side has its own cache line, with its index and a copy of the other side's index that is
+ * only reloaded when the copy says the ring is full (or empty), so a steady stream touches the
+ * shared line about once per lap instead of once per call.
+ * The _defer calls copy without publishing, one spsc_publish() / spsc_release() then makes a whole
+ * batch visible with a single store.
+ */
+
+#ifndef SPSC_CACHE_LINE
+#define SPSC_CACHE_LINE (64U)
+#endif
+
+#define SPSC_ALIGNED __attribute__((aligned(SPSC_CACHE_LINE)))
+
+typedef struct {
+  /* 生产者 */
+  volatile U32 w SPSC_ALIGNED; // 已发布的写位置
+  U32          w_next;         // 已写入未发布
+  U32          r_cache;        // r 的缓存
+
+  /* 消费者 */
+  volatile U32 r SPSC_ALIGNED; // 已释放的读位置
+  U32          r_next;         // 已读出未释放
+  U32          w_cache;        // w 的缓存
+
+  /* 初始化后只读 */
+  U8 *buf SPSC_ALIGNED;
+  U32 size; // 2 的幂
+  U32 mask;
+} spsc_t;
+
+static inline ret_e
+spsc_init(spsc_t *spsc, void *buf, U32 size) {
+  if (!buf || !size || (size & (size - 1U)))
+    return FAIL;
+
+  memset(spsc, 0, sizeof(*spsc));
+  spsc->buf  = (U8 *)buf;
+  spsc->size = size;
+  spsc->mask = size - 1U;
+  return OK;
+}
+
+/*
+ * Producer side. Free space, the other index is only read again when the cached one is short.
+ */
+static inline U32
+spsc_free(spsc_t *spsc, U32 len) {
+  U32 space = spsc->size - (spsc->w_next - spsc->r_cache);
+  if (space < len) {
+    spsc->r_cache = __atomic_load_n(&spsc->r, __ATOMIC_ACQUIRE);
+    space         = spsc->size - (spsc->w_next - spsc->r_cache);
+  }
+  return space;
+}
+
+/*
+ * Copies all of buf or nothing, returns len or 0. Not visible to the consumer until published.
+ */
+static inline U32
+spsc_put_defer(spsc_t *spsc, const void *buf, U32 len) {
+  if (spsc_free(spsc, len) < len)
+    return 0;
+
+  U32 off = spsc->w_next & spsc->mask;
+  U32 l   = MIN(len, spsc->size - off);
+  memcpy(spsc->buf + off, buf, l);
+  memcpy(spsc->buf, (const U8 *)buf + l, len - l);
+  spsc->w_next += len;
+  return len;
+}
+
+static inline void
+spsc_publish(spsc_t *spsc) {
+  __atomic_store_n(&spsc->w, spsc->w_next, __ATOMIC_RELEASE);
+}
+
+static inline U32
+spsc_put(spsc_t *spsc, const void *buf, U32 len) {
+  U32 ret = spsc_put_defer(spsc, buf, len);
+  if (ret)
+    spsc_publish(spsc);
+  return ret;
+}
+
+/*
+ * Consumer side, the bytes published and not read yet.
+ */
+static inline U32
+spsc_avail(spsc_t *spsc, U32 len) {
+  U32 avail = spsc->w_cache - spsc->r_next;
+  if (avail < len) {
+    spsc->w_cache = __atomic_load_n(&spsc->w, __ATOMIC_ACQUIRE);
+    avail         = spsc->w_cache - spsc->r_next;
+  }
+  return avail;
+}
+
+/*
+ * Reads all of len or nothing, returns len or 0. The space is not handed back until released.
+ */
+static inline U32
+spsc_get_defer(spsc_t *spsc, void *buf, U32 len) {
+  if (spsc_avail(spsc, len) < len)
+    return 0;
+
+  U32 off = spsc->r_next & spsc->mask;
+  U32 l   = MIN(len, spsc->size - off);
+  memcpy(buf, spsc->buf + off, l);
+  memcpy((U8 *)buf + l, spsc->buf, len - l);
+  spsc->r_next += len;
+  return len;
+}
+
+static inline void
+spsc_release(spsc_t *spsc) {
+  __atomic_store_n(&spsc->r, spsc->r_next, __ATOMIC_RELEASE);
+}
+
+static inline U32
+spsc_get(spsc_t *spsc, void *buf, U32 len) {
+  U32 ret = spsc_get_defer(spsc, buf, len);
+  if (ret)
+    spsc_release(spsc);
+  return ret;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // !SPSC_H
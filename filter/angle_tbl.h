@@ -0,0 +1,166 @@
+#ifndef ANGLE_TBL_H
+#define ANGLE_TBL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+
+#include "util/mathdef.h"
+#include "util/typedef.h"
+
+/*
+ * Periodic table over one mechanical revolution, linearly interpolated.
+ * Calibration drops samples into per-bin accumulators with angle_tbl_acc(), then
+ * angle_tbl_update() folds the smoothed bin means into the table with a gain and removes the table
+ * mean.
+ * gain = 1 on a zeroed table stores the measured profile, gain < 1 per revolution is an
+ * iterative learning update.
+ * Any angle is taken, it is wrapped into [0, 2pi) before it picks a bin.
+ */
+
+#ifndef ANGLE_TBL_MAX
+#define ANGLE_TBL_MAX (256U)
+#endif
+
+typedef struct {
+  U32 num; // 表格点数, 0 为旁路
+} angle_tbl_cfg_t;
+
+typedef struct {
+  FP32 theta_rad;
+  FP32 val;
+} angle_tbl_in_t;
+
+typedef struct {
+  FP32 val;
+} angle_tbl_out_t;
+
+typedef struct {
+  FP32 scale;
+  FP32 val[ANGLE_TBL_MAX];
+  FP32 sum[ANGLE_TBL_MAX];
+  U32  cnt[ANGLE_TBL_MAX];
+} angle_tbl_lo_t;
+
+typedef struct {
+  angle_tbl_cfg_t cfg;
+  angle_tbl_in_t  in;
+  angle_tbl_out_t out;
+  angle_tbl_lo_t  lo;
+} angle_tbl_t;
+
+#define DECL_ANGLE_TBL_PTRS(tbl)                                                                   \
+  angle_tbl_t     *p   = (tbl);                                                                    \
+  angle_tbl_cfg_t *cfg = &p->cfg;                                                                  \
+  angle_tbl_in_t  *in  = &p->in;                                                                   \
+  angle_tbl_out_t *out = &p->out;                                                                  \
+  angle_tbl_lo_t  *lo  = &p->lo;
+
+#define DECL_ANGLE_TBL_PTRS_PREFIX(tbl, prefix)                                                    \
+  angle_tbl_t     *prefix##_p   = (tbl);                                                           \
+  angle_tbl_cfg_t *prefix##_cfg = &prefix##_p->cfg;                                                \
+  angle_tbl_in_t  *prefix##_in  = &prefix##_p->in;                                                 \
+  angle_tbl_out_t *prefix##_out = &prefix##_p->out;                                                \
+  angle_tbl_lo_t  *prefix##_lo  = &prefix##_p->lo;
+
+static inline void
+angle_tbl_init(angle_tbl_t *tbl, angle_tbl_cfg_t tbl_cfg) {
+  DECL_ANGLE_TBL_PTRS(tbl);
+
+  *cfg = tbl_cfg;
+  if (cfg->num > ANGLE_TBL_MAX)
+    cfg->num = ANGLE_TBL_MAX;
+
+  memset(in, 0, sizeof(*in));
+  memset(out, 0, sizeof(*out));
+  memset(lo, 0, sizeof(*lo));
+  lo->scale = (FP32)cfg->num / FP32_2PI;
+}
+
+/*
+ * Table position of an angle, in [0, num).
+ */
+static inline FP32
+angle_tbl_pos(const angle_tbl_t *tbl, FP32 theta_rad) {
+  WARP_2PI(theta_rad);
+  FP32 x = theta_rad * tbl->lo.scale;
+
+  // 2pi itself after rounding is angle 0, a nan angle reads bin 0 instead of a wild index
+  return (x >= FP32_0 && x < (FP32)tbl->cfg.num) ? x : FP32_0;
+}
+
+static inline void
+angle_tbl_run(angle_tbl_t *tbl) {
+  DECL_ANGLE_TBL_PTRS(tbl);
+
+  FP32 x = angle_tbl_pos(tbl, in->theta_rad);
+  U32  i = (U32)x;
+  FP32 f = x - (FP32)i;
+  U32  j = (i + 1U < cfg->num) ? i + 1U : 0U;
+
+  out->val = lo->val[i] + f * (lo->val[j] - lo->val[i]);
+}
+
+static inline FP32
+angle_tbl_run_in(angle_tbl_t *tbl, FP32 theta_rad) {
+  DECL_ANGLE_TBL_PTRS(tbl);
+
+  in->theta_rad = theta_rad;
+  angle_tbl_run(tbl);
+  return out->val;
+}
+
+static inline void
+angle_tbl_acc(angle_tbl_t *tbl, FP32 theta_rad, FP32 val) {
+  DECL_ANGLE_TBL_PTRS(tbl);
+
+  U32 i = (U32)(angle_tbl_pos(tbl, theta_rad) + FP32_1_DIV_2);
+  if (i >= cfg->num)
+    i -= cfg->num;
+
+  lo->sum[i] += val;
+  lo->cnt[i]++;
+}
+
+static inline void
+angle_tbl_update(angle_tbl_t *tbl, FP32 gain) {
+  DECL_ANGLE_TBL_PTRS(tbl);
+
+  for (U32 i = 0; i < cfg->num; i++)
+    lo->sum[i] = lo->cnt[i] ? lo->sum[i] / (FP32)lo->cnt[i] : FP32_0;
+
+  // [1 2 1] / 4 across bins, keeps bin noise from building up in the learning loop
+  FP32 mean = FP32_0, first = lo->sum[0], prev = lo->sum[cfg->num - 1U];
+  for (U32 i = 0; i < cfg->num; i++) {
+    FP32 next = (i + 1U < cfg->num) ? lo->sum[i + 1U] : first;
+    FP32 cur  = lo->sum[i];
+    lo->val[i] += gain * (prev + FP32_2 * cur + next) * 0.25f;
+    prev = cur;
+    mean += lo->val[i];
+  }
+
+  // a constant part is an angle offset or a load, neither belongs in the table
+  mean /= (FP32)cfg->num;
+  for (U32 i = 0; i < cfg->num; i++)
+    lo->val[i] -= mean;
+
+  memset(lo->sum, 0, sizeof(lo->sum));
+  memset(lo->cnt, 0, sizeof(lo->cnt));
+}
+
+static inline void
+angle_tbl_reset(angle_tbl_t *tbl) {
+  DECL_ANGLE_TBL_PTRS(tbl);
+
+  memset(lo->val, 0, sizeof(lo->val));
+  memset(lo->sum, 0, sizeof(lo->sum));
+  memset(lo->cnt, 0, sizeof(lo->cnt));
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // !ANGLE_TBL_H
@@ -0,0 +1,203 @@
+#ifndef DECIM_H
+#define DECIM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+
+#include "util/mathdef.h"
+#include "util/typedef.h"
+
+/*
+ * Decimator for an oversampled block, num conversions of ch_num interleaved channels in, one value
+ * per channel out.
+ * Without taps it is a CIC of the given order, integrators at the input rate and combs at the
+ * output rate, in wrapping U32 so the integrators may overflow as long as the output fits:
+ * input bits + order * log2(num) <= 32. Order 1 is the block mean and needs no history, higher
+ * orders reach back order - 1 blocks.
+ * With tap (num weights, summing to 1) the block is weighted instead, e.g. to drop the conversions
+ * next to a switching edge.
+ * A short block, e.g. a missed dma transfer, fits neither the taps nor the comb spacing. It gives
+ * the plain mean of what arrived, and the cic history is seeded as if the input had been that
+ * mean all along, so the next full blocks do not see a step from the gap.
+ */
+
+#ifndef DECIM_CH_MAX
+#define DECIM_CH_MAX (8U)
+#endif
+
+#define DECIM_ORDER_MAX (3U)
+
+typedef struct {
+  U32         num;    // 每个输出的输入个数
+  U32         ch_num; // 交织通道数
+  U32         order;  // CIC 阶数, 1 ~ DECIM_ORDER_MAX
+  const FP32 *tap;    // FIR 权值, num 个, 为空用 CIC
+} decim_cfg_t;
+
+typedef struct {
+  const I32 *buf;    // 交织数据, 第 i 次转换的通道 ch 在 buf[i * stride + ch]
+  U32        num;    // 本块转换次数
+  U32        stride; // 相邻两次转换的间隔, 单位 I32
+} decim_in_t;
+
+typedef struct {
+  FP32 val[DECIM_CH_MAX];
+} decim_out_t;
+
+typedef struct {
+  U32  integ[DECIM_ORDER_MAX][DECIM_CH_MAX];
+  U32  comb[DECIM_ORDER_MAX][DECIM_CH_MAX];
+  FP32 gain; // 1 / num^order
+} decim_lo_t;
+
+typedef struct {
+  decim_cfg_t cfg;
+  decim_in_t  in;
+  decim_out_t out;
+  decim_lo_t  lo;
+} decim_t;
+
+#define DECL_DECIM_PTRS(decim)                                                                     \
+  decim_t     *p   = (decim);                                                                      \
+  decim_cfg_t *cfg = &p->cfg;                                                                      \
+  decim_in_t  *in  = &p->in;                                                                       \
+  decim_out_t *out = &p->out;                                                                      \
+  decim_lo_t  *lo  = &p->lo;
+
+#define DECL_DECIM_PTRS_PREFIX(decim, prefix)                                                      \
+  decim_t     *prefix##_p   = (decim);                                                             \
+  decim_cfg_t *prefix##_cfg = &prefix##_p->cfg;                                                    \
+  decim_in_t  *prefix##_in  = &prefix##_p->in;                                                     \
+  decim_out_t *prefix##_out = &prefix##_p->out;                                                    \
+  decim_lo_t  *prefix##_lo  = &prefix##_p->lo;
+
+static inline void
+decim_init(decim_t *decim, decim_cfg_t decim_cfg) {
+  DECL_DECIM_PTRS(decim);
+
+  *cfg = decim_cfg;
+  if (cfg->ch_num > DECIM_CH_MAX)
+    cfg->ch_num = DECIM_CH_MAX;
+  if (cfg->order < 1U)
+    cfg->order = 1U;
+  if (cfg->order > DECIM_ORDER_MAX)
+    cfg->order = DECIM_ORDER_MAX;
+  if (cfg->num < 1U)
+    cfg->num = 1U;
+
+  memset(in, 0, sizeof(*in));
+  memset(out, 0, sizeof(*out));
+  memset(lo, 0, sizeof(*lo));
+
+  lo->gain = FP32_1;
+  for (U32 k = 0; k < cfg->order; k++)
+    lo->gain /= (FP32)cfg->num;
+}
+
+/*
+ * t * (t + 1) * ... * (t + order - 1) / order!, exact for any sign of t.
+ */
+static inline I64
+decim_poly(I64 t, U32 order) {
+  I64 p = 1;
+  for (U32 k = 0; k < order; k++)
+    p = p * (t + (I64)k) / (I64)(k + 1U);
+  return p;
+}
+
+/*
+ * With val held forever the last integrator at input tick t is val * decim_poly(t, order), taking
+ * now as t = 0. Now is a block boundary and comb k holds its input there, the k-th backward
+ * difference of that integrator with step num. All of it wraps in U32 like the running cic.
+ */
+static inline void
+decim_cic_seed(decim_t *decim, U32 ch, I32 val) {
+  DECL_DECIM_PTRS(decim);
+
+  for (U32 k = 0; k < DECIM_ORDER_MAX; k++)
+    lo->integ[k][ch] = 0;
+
+  for (U32 k = 0; k < cfg->order; k++) {
+    I64 d = 0, c = 1;
+    for (U32 j = 0; j <= k; j++) {
+      I64 t = -(I64)cfg->num * (I64)j;
+      d += ((j & 1U) ? -c : c) * decim_poly(t, cfg->order);
+      c = c * (I64)(k - j) / (I64)(j + 1U);
+    }
+    lo->comb[k][ch] = (U32)((I64)val * d);
+  }
+}
+
+static inline void
+decim_run(decim_t *decim) {
+  DECL_DECIM_PTRS(decim);
+
+  U32 num = (in->num < cfg->num) ? in->num : cfg->num;
+  if (num == 0)
+    return;
+
+  if (num < cfg->num) {
+    for (U32 ch = 0; ch < cfg->ch_num; ch++) {
+      I64 sum = 0;
+      for (U32 i = 0; i < num; i++)
+        sum += in->buf[i * in->stride + ch];
+      out->val[ch] = (FP32)sum / (FP32)num;
+      if (!cfg->tap) {
+        I64 half = (sum >= 0) ? (I64)(num / 2U) : -(I64)(num / 2U);
+        decim_cic_seed(decim, ch, (I32)((sum + half) / (I64)num));
+      }
+    }
+    return;
+  }
+
+  if (cfg->tap) {
+    for (U32 ch = 0; ch < cfg->ch_num; ch++) {
+      FP32 acc = FP32_0;
+      for (U32 i = 0; i < num; i++)
+        acc += cfg->tap[i] * (FP32)in->buf[i * in->stride + ch];
+      out->val[ch] = acc;
+    }
+    return;
+  }
+
+  FP32 gain = lo->gain;
+  for (U32 ch = 0; ch < cfg->ch_num; ch++) {
+    U32 i0 = lo->integ[0][ch], i1 = lo->integ[1][ch], i2 = lo->integ[2][ch];
+    for (U32 i = 0; i < num; i++) {
+      i0 += (U32)in->buf[i * in->stride + ch];
+      i1 += i0;
+      i2 += i1;
+    }
+    lo->integ[0][ch] = i0;
+    lo->integ[1][ch] = i1;
+    lo->integ[2][ch] = i2;
+
+    // the last integrator feeds the first comb
+    U32 y = lo->integ[cfg->order - 1U][ch];
+    for (U32 k = 0; k < cfg->order; k++) {
+      U32 d           = y - lo->comb[k][ch];
+      lo->comb[k][ch] = y;
+      y               = d;
+    }
+    out->val[ch] = (FP32)(I32)y * gain;
+  }
+}
+
+static inline void
+decim_run_in(decim_t *decim, const I32 *buf, U32 num, U32 stride) {
+  DECL_DECIM_PTRS(decim);
+
+  in->buf    = buf;
+  in->num    = num;
+  in->stride = stride;
+  decim_run(decim);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // !DECIM_H
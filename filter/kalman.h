@@ -0,0 +1,192 @@
+#ifndef KALMAN_H
+#define KALMAN_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+
+#include "util/mathdef.h"
+#include "util/typedef.h"
+
+/*
+ * Constant-acceleration Kalman estimator of angle, velocity and acceleration from a wrapped
+ * angle measurement. State x = [theta, vel, acc], white jerk process noise of density q,
+ * measurement noise variance r. The 3x3 covariance is symmetric and kept as six scalars.
+ * With is_steady the gain is solved once in vel_kf_init() and the tick cost is a predict
+ * plus three multiply-adds.
+ */
+
+typedef struct {
+  FP32 freq_hz;
+  FP32 q;         // 加加速度噪声谱密度, rad^2/s^5
+  FP32 r;         // 角度测量方差, rad^2
+  BOOL is_steady; // 使用稳态增益
+} kf_cfg_t;
+
+typedef struct {
+  FP32 theta_rad;
+} kf_vel_in_t;
+
+typedef struct {
+  FP32 theta_rad;
+  FP32 vel_rads;
+  FP32 acc_rads2;
+} kf_out_t;
+
+typedef struct {
+  BOOL is_init;
+  FP32 err;
+  FP32 k0, k1, k2;
+  FP32 p00, p01, p02, p11, p12, p22;
+  FP32 q00, q01, q02, q11, q12, q22;
+} kf_vel_lo_t;
+
+typedef struct {
+  kf_cfg_t    cfg;
+  kf_vel_in_t in;
+  kf_out_t    out;
+  kf_vel_lo_t lo;
+} vel_kf_filter_t;
+
+#define DECL_VEL_KF_PTRS(kf)                                                                       \
+  vel_kf_filter_t *p   = (kf);                                                                     \
+  kf_cfg_t        *cfg = &p->cfg;                                                                  \
+  kf_vel_in_t     *in  = &p->in;                                                                   \
+  kf_out_t        *out = &p->out;                                                                  \
+  kf_vel_lo_t     *lo  = &p->lo;
+
+#define DECL_VEL_KF_PTRS_PREFIX(kf, prefix)                                                        \
+  vel_kf_filter_t *prefix##_p   = (kf);                                                            \
+  kf_cfg_t        *prefix##_cfg = &prefix##_p->cfg;                                                \
+  kf_vel_in_t     *prefix##_in  = &prefix##_p->in;                                                 \
+  kf_out_t        *prefix##_out = &prefix##_p->out;                                                \
+  kf_vel_lo_t     *prefix##_lo  = &prefix##_p->lo;
+
+static inline void
+vel_kf_steady_gain(vel_kf_filter_t *kf) {
+  DECL_VEL_KF_PTRS(kf);
+
+  // iterate the riccati recursion in double, the float one is poorly conditioned at high rates
+  FP64 t = FP32_HZ_TO_S((FP64)cfg->freq_hz), h = t * t / 2.0;
+  FP64 q00 = lo->q00, q01 = lo->q01, q02 = lo->q02, q11 = lo->q11, q12 = lo->q12, q22 = lo->q22;
+  FP64 p00 = 0.0, p01 = 0.0, p02 = 0.0, p11 = 0.0, p12 = 0.0, p22 = 0.0;
+  FP64 k0 = 0.0, k1 = 0.0, k2 = 0.0;
+
+  for (U32 i = 0; i < 100000U; i++) {
+    FP64 a00 = p00 + t * p01 + h * p02, a01 = p01 + t * p11 + h * p12;
+    FP64 a02 = p02 + t * p12 + h * p22, a11 = p11 + t * p12, a12 = p12 + t * p22;
+
+    FP64 n00 = a00 + t * a01 + h * a02 + q00, n01 = a01 + t * a02 + q01, n02 = a02 + q02;
+    FP64 n11 = a11 + t * a12 + q11, n12 = a12 + q12, n22 = p22 + q22;
+
+    FP64 s  = n00 + (FP64)cfg->r;
+    FP64 g0 = n00 / s, g1 = n01 / s, g2 = n02 / s;
+
+    p00 = n00 - g0 * n00;
+    p01 = n01 - g0 * n01;
+    p02 = n02 - g0 * n02;
+    p11 = n11 - g1 * n01;
+    p12 = n12 - g1 * n02;
+    p22 = n22 - g2 * n02;
+
+    FP64 d = fabs(g0 - k0) + fabs(g1 - k1) + fabs(g2 - k2);
+    k0     = g0;
+    k1     = g1;
+    k2     = g2;
+    if (i > 10U && d < 1e-12 * (1.0 + fabs(k2)))
+      break;
+  }
+
+  lo->k0 = (FP32)k0;
+  lo->k1 = (FP32)k1;
+  lo->k2 = (FP32)k2;
+}
+
+static inline void
+vel_kf_init(vel_kf_filter_t *kf, kf_cfg_t kf_cfg) {
+  DECL_VEL_KF_PTRS(kf);
+
+  *cfg = kf_cfg;
+  memset(in, 0, sizeof(*in));
+  memset(out, 0, sizeof(*out));
+  memset(lo, 0, sizeof(*lo));
+
+  FP32 t = FP32_HZ_TO_S(cfg->freq_hz);
+
+  lo->q00 = cfg->q * t * t * t * t * t / 20.0f;
+  lo->q01 = cfg->q * t * t * t * t / 8.0f;
+  lo->q02 = cfg->q * t * t * t / 6.0f;
+  lo->q11 = cfg->q * t * t * t / 3.0f;
+  lo->q12 = cfg->q * t * t / 2.0f;
+  lo->q22 = cfg->q * t;
+
+  // start uncertain about everything but the first angle sample
+  lo->p00 = cfg->r;
+  lo->p11 = 1e4f;
+  lo->p22 = 1e8f;
+
+  if (cfg->is_steady)
+    vel_kf_steady_gain(kf);
+}
+
+static inline void
+vel_kf_run(vel_kf_filter_t *kf) {
+  DECL_VEL_KF_PTRS(kf);
+
+  if (!lo->is_init) {
+    out->theta_rad = in->theta_rad;
+    lo->is_init    = TRUE;
+    return;
+  }
+
+  FP32 t = FP32_HZ_TO_S(cfg->freq_hz), h = t * t * FP32_1_DIV_2;
+
+  out->theta_rad += out->vel_rads * t + out->acc_rads2 * h;
+  out->vel_rads += out->acc_rads2 * t;
+
+  if (!cfg->is_steady) {
+    FP32 a00 = lo->p00 + t * lo->p01 + h * lo->p02, a01 = lo->p01 + t * lo->p11 + h * lo->p12;
+    FP32 a02 = lo->p02 + t * lo->p12 + h * lo->p22, a11 = lo->p11 + t * lo->p12;
+    FP32 a12 = lo->p12 + t * lo->p22;
+
+    FP32 n00 = a00 + t * a01 + h * a02 + lo->q00, n01 = a01 + t * a02 + lo->q01;
+    FP32 n02 = a02 + lo->q02, n11 = a11 + t * a12 + lo->q11, n12 = a12 + lo->q12;
+    FP32 n22 = lo->p22 + lo->q22;
+
+    FP32 s_inv = FP32_1 / (n00 + cfg->r);
+    lo->k0     = n00 * s_inv;
+    lo->k1     = n01 * s_inv;
+    lo->k2     = n02 * s_inv;
+
+    lo->p00 = n00 - lo->k0 * n00;
+    lo->p01 = n01 - lo->k0 * n01;
+    lo->p02 = n02 - lo->k0 * n02;
+    lo->p11 = n11 - lo->k1 * n01;
+    lo->p12 = n12 - lo->k1 * n02;
+    lo->p22 = n22 - lo->k2 * n02;
+  }
+
+  lo->err = in->theta_rad - out->theta_rad;
+  WARP_PI(lo->err);
+
+  out->theta_rad += lo->k0 * lo->err;
+  out->vel_rads += lo->k1 * lo->err;
+  out->acc_rads2 += lo->k2 * lo->err;
+  WARP_2PI(out->theta_rad);
+}
+
+static inline void
+vel_kf_run_in(vel_kf_filter_t *kf, FP32 theta_rad) {
+  DECL_VEL_KF_PTRS(kf);
+
+  in->theta_rad = theta_rad;
+  vel_kf_run(kf);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // !KALMAN_H
@@ -0,0 +1,339 @@
+#ifndef NOTCH_H
+#define NOTCH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+
+#include "util/mathdef.h"
+#include "util/seqlock.h"
+#include "util/typedef.h"
+
+#ifndef ANF_NOTCH_MAX
+#define ANF_NOTCH_MAX (3U)
+#endif
+
+typedef struct {
+  FP32 freq_hz;   // 调用频率
+  FP32 center_hz; // 陷波中心频率
+  FP32 q;         // 品质因数, 越大越窄
+  FP32 depth;     // 中心增益, 0 为完全陷波
+} notch_cfg_t;
+
+typedef struct {
+  FP32 val;
+} notch_in_t;
+
+typedef struct {
+  FP32 val;
+} notch_out_t;
+
+typedef struct {
+  FP32 b0, b1, b2;
+  FP32 a1, a2;
+  FP32 z1, z2;
+} notch_lo_t;
+
+typedef struct {
+  notch_cfg_t cfg;
+  notch_in_t  in;
+  notch_out_t out;
+  notch_lo_t  lo;
+} notch_filter_t;
+
+#define DECL_NOTCH_PTRS(notch)                                                                     \
+  notch_filter_t *p   = (notch);                                                                   \
+  notch_cfg_t    *cfg = &p->cfg;                                                                   \
+  notch_in_t     *in  = &p->in;                                                                    \
+  notch_out_t    *out = &p->out;                                                                   \
+  notch_lo_t     *lo  = &p->lo;
+
+#define DECL_NOTCH_PTRS_PREFIX(notch, prefix)                                                      \
+  notch_filter_t *prefix##_p   = (notch);                                                          \
+  notch_cfg_t    *prefix##_cfg = &prefix##_p->cfg;                                                 \
+  notch_in_t     *prefix##_in  = &prefix##_p->in;                                                  \
+  notch_out_t    *prefix##_out = &prefix##_p->out;                                                 \
+  notch_lo_t     *prefix##_lo  = &prefix##_p->lo;
+
+static inline void
+notch_set(notch_filter_t *notch, FP32 center_hz) {
+  DECL_NOTCH_PTRS(notch);
+
+  cfg->center_hz = center_hz;
+
+  FP32 w0    = FP32_2PI * cfg->center_hz / cfg->freq_hz;
+  FP32 c     = FP32_COS(w0);
+  FP32 alpha = FP32_SIN(w0) / (FP32_2 * cfg->q);
+  FP32 a0    = FP32_1 / (FP32_1 + alpha);
+
+  // gain at w0 is exactly depth, filter states are kept so retuning is glitch free
+  lo->b0 = (FP32_1 + cfg->depth * alpha) * a0;
+  lo->b1 = -FP32_2 * c * a0;
+  lo->b2 = (FP32_1 - cfg->depth * alpha) * a0;
+  lo->a1 = lo->b1;
+  lo->a2 = (FP32_1 - alpha) * a0;
+}
+
+static inline void
+notch_init(notch_filter_t *notch, notch_cfg_t notch_cfg) {
+  DECL_NOTCH_PTRS(notch);
+
+  *cfg = notch_cfg;
+  memset(lo, 0, sizeof(*lo));
+  notch_set(notch, cfg->center_hz);
+}
+
+static inline void
+notch_run(notch_filter_t *notch) {
+  DECL_NOTCH_PTRS(notch);
+
+  out->val = lo->b0 * in->val + lo->z1;
+  lo->z1   = lo->b1 * in->val - lo->a1 * out->val + lo->z2;
+  lo->z2   = lo->b2 * in->val - lo->a2 * out->val;
+}
+
+static inline FP32
+notch_run_in(notch_filter_t *notch, FP32 val) {
+  DECL_NOTCH_PTRS(notch);
+
+  in->val = val;
+  notch_run(notch);
+  return out->val;
+}
+
+/*
+ * Adaptive notch bank.
+ * Peaks from the spectrum (fft_out_t::freq_hz_max/value_max, psd_out_t peak list or sdft_t bins)
+ * are handed in with anf_peak_update(), off the control tick. Each notch is latched onto a peak
+ * and keeps its place when the peak is suppressed by the notch itself: a new peak competes with
+ * the amplitude a notch was taken at, not with the residual left behind the notch.
+ * anf_peak_update() and anf_reset() run in one context and only touch the request: targets, which
+ * notches are on and an arm count bumped every time a notch is newly taken. The request is
+ * published through a seqlock, the tick takes it when a copy is consistent and keeps the last one
+ * otherwise. All filter coefficients and states belong to the tick: anf_run() arms at most one
+ * newly taken notch (states cleared, set on its target) or slews one towards its target, then
+ * filters through every active notch, so the per-tick cost is ANF_NOTCH_MAX biquads plus one
+ * sincos.
+ */
+
+typedef struct {
+  FP32 freq_hz;     // 调用频率
+  U32  notch_num;   // 陷波器个数, 0 为旁路
+  FP32 q;           // 品质因数
+  FP32 depth;       // 中心增益
+  FP32 amp_on;      // 峰值超过该值才分配陷波器
+  FP32 match_hz;    // 峰值与陷波器的关联距离
+  FP32 slew_hz;     // 每次重调的最大频率变化
+  FP32 freq_min_hz; // 跟踪频率下限
+  FP32 freq_max_hz; // 跟踪频率上限
+} anf_cfg_t;
+
+typedef struct {
+  FP32 val;
+} anf_in_t;
+
+typedef struct {
+  FP32 val;
+  BOOL active[ANF_NOTCH_MAX];
+  FP32 center_hz[ANF_NOTCH_MAX];
+} anf_out_t;
+
+typedef struct {
+  FP32 target_hz[ANF_NOTCH_MAX];
+  U32  on_mask;                // 位 i 为陷波器 i 已分配
+  U32  arm_seq[ANF_NOTCH_MAX]; // 每次新分配加一
+} anf_req_t;
+
+typedef struct {
+  /* 控制周期 */
+  notch_filter_t notch[ANF_NOTCH_MAX];
+  anf_req_t      tick_req;                // 最近一次一致的请求
+  U32            arm_done[ANF_NOTCH_MAX]; // 已处理的 arm_seq
+  U32            tune_idx;
+
+  /* anf_peak_update() 所在上下文 */
+  anf_req_t req;
+  FP32      amp[ANF_NOTCH_MAX];   // 分配时的峰值, 之后只增不减
+  FP32      resid[ANF_NOTCH_MAX]; // 陷波后残余的峰值
+
+  seqlock_t lock;
+  anf_req_t pub;
+} anf_lo_t;
+
+typedef struct {
+  anf_cfg_t cfg;
+  anf_in_t  in;
+  anf_out_t out;
+  anf_lo_t  lo;
+} anf_filter_t;
+
+#define DECL_ANF_PTRS(anf)                                                                         \
+  anf_filter_t *p   = (anf);                                                                       \
+  anf_cfg_t    *cfg = &p->cfg;                                                                     \
+  anf_in_t     *in  = &p->in;                                                                      \
+  anf_out_t    *out = &p->out;                                                                     \
+  anf_lo_t     *lo  = &p->lo;
+
+#define DECL_ANF_PTRS_PREFIX(anf, prefix)                                                          \
+  anf_filter_t *prefix##_p   = (anf);                                                              \
+  anf_cfg_t    *prefix##_cfg = &prefix##_p->cfg;                                                   \
+  anf_in_t     *prefix##_in  = &prefix##_p->in;                                                    \
+  anf_out_t    *prefix##_out = &prefix##_p->out;                                                   \
+  anf_lo_t     *prefix##_lo  = &prefix##_p->lo;
+
+static inline void
+anf_init(anf_filter_t *anf, anf_cfg_t anf_cfg) {
+  DECL_ANF_PTRS(anf);
+
+  *cfg = anf_cfg;
+  if (cfg->notch_num > ANF_NOTCH_MAX)
+    cfg->notch_num = ANF_NOTCH_MAX;
+
+  memset(in, 0, sizeof(*in));
+  memset(out, 0, sizeof(*out));
+  memset(lo, 0, sizeof(*lo));
+  seqlock_init(&lo->lock);
+
+  notch_cfg_t notch_cfg;
+  notch_cfg.freq_hz   = cfg->freq_hz;
+  notch_cfg.center_hz = cfg->freq_max_hz;
+  notch_cfg.q         = cfg->q;
+  notch_cfg.depth     = cfg->depth;
+  for (U32 i = 0; i < ANF_NOTCH_MAX; i++)
+    notch_init(&lo->notch[i], notch_cfg);
+}
+
+static inline void
+anf_peak_update(anf_filter_t *anf, const FP32 *freq_hz, const FP32 *amp, U32 num) {
+  DECL_ANF_PTRS(anf);
+
+  anf_req_t *req = &lo->req;
+  for (U32 k = 0; k < num; k++) {
+    FP32 f = freq_hz[k];
+    if (f < cfg->freq_min_hz || f > cfg->freq_max_hz)
+      continue;
+
+    // follow the notch already sitting on this resonance
+    U32  best      = ANF_NOTCH_MAX;
+    FP32 best_dist = cfg->match_hz;
+    for (U32 i = 0; i < cfg->notch_num; i++) {
+      FP32 dist = FP32_ABS(req->target_hz[i] - f);
+      if ((req->on_mask & LF(i)) && dist <= best_dist) {
+        best      = i;
+        best_dist = dist;
+      }
+    }
+
+    if (best == ANF_NOTCH_MAX) {
+      if (amp[k] < cfg->amp_on)
+        continue;
+
+      // take a free notch, or replace the weakest one if this peak is stronger
+      FP32 weakest = amp[k];
+      for (U32 i = 0; i < cfg->notch_num; i++) {
+        if (!(req->on_mask & LF(i))) {
+          best = i;
+          break;
+        }
+        if (lo->amp[i] < weakest) {
+          best    = i;
+          weakest = lo->amp[i];
+        }
+      }
+      if (best == ANF_NOTCH_MAX)
+        continue;
+
+      req->on_mask |= LF(best);
+      req->arm_seq[best]++;
+      lo->amp[best] = amp[k];
+    }
+
+    req->target_hz[best] = f;
+    lo->resid[best]      = amp[k];
+    if (amp[k] > lo->amp[best])
+      lo->amp[best] = amp[k];
+  }
+
+  seqlock_write(&lo->lock, &lo->pub, req, sizeof(*req));
+}
+
+/*
+ * Drops every notch, from the anf_peak_update() context.
+ */
+static inline void
+anf_reset(anf_filter_t *anf) {
+  DECL_ANF_PTRS(anf);
+
+  lo->req.on_mask = 0;
+  memset(lo->amp, 0, sizeof(lo->amp));
+  memset(lo->resid, 0, sizeof(lo->resid));
+  seqlock_write(&lo->lock, &lo->pub, &lo->req, sizeof(lo->req));
+}
+
+static inline void
+anf_tune(anf_filter_t *anf) {
+  DECL_ANF_PTRS(anf);
+
+  anf_req_t req;
+  if (seqlock_try_read(&lo->lock, &req, &lo->pub, sizeof(req)))
+    lo->tick_req = req;
+
+  for (U32 i = 0; i < cfg->notch_num; i++)
+    out->active[i] = (lo->tick_req.on_mask & LF(i)) && lo->arm_done[i] == lo->tick_req.arm_seq[i];
+
+  for (U32 n = 0; n < cfg->notch_num; n++) {
+    U32 i        = lo->tune_idx;
+    lo->tune_idx = (lo->tune_idx + 1U < cfg->notch_num) ? lo->tune_idx + 1U : 0U;
+    if (!(lo->tick_req.on_mask & LF(i)))
+      continue;
+
+    FP32 target = lo->tick_req.target_hz[i];
+    if (!out->active[i]) {
+      lo->notch[i].lo.z1 = lo->notch[i].lo.z2 = FP32_0;
+      lo->arm_done[i]                         = lo->tick_req.arm_seq[i];
+      notch_set(&lo->notch[i], target);
+      out->center_hz[i] = target;
+      out->active[i]    = TRUE;
+      return;
+    }
+
+    FP32 err = target - lo->notch[i].cfg.center_hz;
+    if (err == FP32_0)
+      continue;
+
+    CLAMP(err, -cfg->slew_hz, cfg->slew_hz);
+    notch_set(&lo->notch[i], lo->notch[i].cfg.center_hz + err);
+    out->center_hz[i] = lo->notch[i].cfg.center_hz;
+    return;
+  }
+}
+
+static inline void
+anf_run(anf_filter_t *anf) {
+  DECL_ANF_PTRS(anf);
+
+  anf_tune(anf);
+
+  out->val = in->val;
+  for (U32 i = 0; i < cfg->notch_num; i++) {
+    if (out->active[i])
+      out->val = notch_run_in(&lo->notch[i], out->val);
+  }
+}
+
+static inline FP32
+anf_run_in(anf_filter_t *anf, FP32 val) {
+  DECL_ANF_PTRS(anf);
+
+  in->val = val;
+  anf_run(anf);
+  return out->val;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // !NOTCH_H
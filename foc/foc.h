@@ -5,30 +5,77 @@
 extern "C" {
 #endif
 
+#include "analyzer/fra.h"
+#include "controller/deadbeat.h"
+#include "controller/mpc.h"
+#include "controller/mtpa.h"
 #include "controller/pid.h"
+#include "controller/resonant.h"
+#include "filter/angle_tbl.h"
+#include "filter/decim.h"
+#include "filter/kalman.h"
+#include "filter/notch.h"
 #include "filter/pll.h"
 #include "observer/smo.h"
 #include "transform/clarkepark.h"
 #include "util/mathdef.h"
+#include "util/seqlock.h"
 #include "util/typedef.h"
+#include "wavegenerator/scurve.h"
 
 typedef struct {
-  i32_uvw_t i32_i_uvw, i32_v_uvw;
+  i32_uvw_t i32_i_uvw, i32_v_uvw; // 单电阻时 u, v 为母线电流的两次采样
   I32       i32_v_bus;
 } adc_raw_t;
 
+#define FOC_ADC_CH_NUM (sizeof(adc_raw_t) / sizeof(I32))
+
+#define SVPWM_MI_II    (0.9514F) // 过调制二区起点, 调制比以六拍基波幅值为 1
+#define SVPWM_OVM1_NUM (16U)
+
+/* 过调制一区, 基波幅值 [1/sqrt(3), SVPWM_MI_II * 2/pi] 等分点上, 被六边形截后基波不变的圆半径 */
+static const FP32 SVPWM_OVM1_TBL[SVPWM_OVM1_NUM + 1] = {
+  0.5773503f, 0.5793306f, 0.5815336f, 0.5839250f, 0.5865042f, 0.5892809f,
+  0.5922722f, 0.5955026f, 0.5990058f, 0.6028281f, 0.6070341f, 0.6117184f,
+  0.6170267f, 0.6232054f, 0.6307360f, 0.6408619f, 0.6666667f,
+};
+
 typedef struct {
+  FP32       mi;
   FP32       v_max, v_min, v_avg;
   fp32_uvw_t fp32_pwm_duty;
   u32_uvw_t  u32_pwm_duty;
+
+  /* 单电阻移相, 上升半周期与下降半周期占空比不同, 平均值不变 */
+  u32_uvw_t u32_pwm_duty_up, u32_pwm_duty_down;
+  U32       u32_adc_trig[2];  // 上升半周期内两次采样的计数值
+  U32       idx_max, idx_min; // 占空比最大和最小相, 决定两次采样对应的相
 } svpwm_t;
 
+typedef enum {
+  FOC_SHUNT_3, // 三相电流全部采样
+  FOC_SHUNT_2, // 采样 u, v 两相
+  FOC_SHUNT_1, // 母线单电阻, 每周期采样两次
+} foc_shunt_e;
+
+/*
+ * Center aligned carrier edges. Single update samples at the valley and loads the duty at the next
+ * valley. Double update samples at both edges and the duty is loaded at the edge following the
+ * sample, so it is in force for the next half period only.
+ */
+typedef enum {
+  FOC_PWM_EDGE_VALLEY, // 计数器为 0
+  FOC_PWM_EDGE_PEAK,   // 计数器为满值
+} foc_pwm_edge_e;
+
 typedef struct {
   FP32 theta_rad, vel_rads;
   FP32 sensor_theta_rad, sensor_vel_rads;
   FP32 obs_theta_rad, obs_vel_rads;
   FP32 force_theta_rad, force_vel_rads;
   FP32 mech_theta_rad;
+  FP32 pos_rad; // 多圈机械位置
+  FP32 park_theta_rad, inv_park_theta_rad;
 } theta_t;
 
 typedef struct {
@@ -39,38 +86,144 @@ typedef struct {
   FP32      adc2cur, adc2vbus;
   adc_raw_t adc_offset;
 
+  /* ADC 过采样, 需要 f_adc_block_get */
+  U32         adc_os_num;   // 每周期转换次数
+  U32         adc_os_order; // CIC 阶数
+  const FP32 *adc_os_tap;   // FIR 权值, 为空用 CIC
+  FP32        adc_drift_hz; // 零漂跟踪带宽, 0 为关闭
+
   /* PWM */
   U32  pwm_freq_hz;
   U32  pwm_full_val;
   FP32 modulation_ratio;
   FP32 fp32_pwm_min, fp32_pwm_max;
+  BOOL is_overmod;       // 过调制至六拍, 否则限幅到六边形内切圆
+  BOOL is_double_update; // 双更新, 波谷波峰各采样装载一次, 控制频率加倍, 不支持单电阻
+
+  /* SHUNT */
+  foc_shunt_e e_shunt;
+  FP32        shunt_win_s;    // 单电阻最小采样窗口, 死区 + 振铃 + 采样保持
+  FP32        shunt_settle_s; // 窗口起点到触发点的等待时间
+
+  /* DEADTIME */
+  FP32 dead_time_s; // 死区时间
+  FP32 v_drop;      // 开关管及二极管导通压降
+  FP32 dt_cur_band; // 过零平滑区间, 电流绝对值低于该值时线性过渡
 
   /* TIMER */
   U32 timer_freq_hz;
 } periph_param_t;
 
 typedef struct {
-  FP32           freq_hz;
+  /* 延时单位均为控制周期 */
+  FP32 park_delay;     // 采样到 Park 角度的延时
+  FP32 inv_park_delay; // 计算到电压生效的延时, 一般为 1.5
+  FP32 sensor_delay;   // 传感器角度延时
+  FP32 obs_delay;      // 观测器角度延时
+
+  /* 融合, 电角速度低于 vel_min 用传感器, 高于 vel_max 用观测器 */
+  FP32 fusion_vel_min;
+  FP32 fusion_vel_max;
+
+  /* 卡尔曼测速, 0 取默认值 */
+  FP32 kf_q; // 加加速度噪声谱密度, rad^2/s^5
+  FP32 kf_r; // 角度测量方差, rad^2
+} theta_param_t;
+
+typedef struct {
+  U32  div;        // 外环分频, 每 div 个控制周期运行一次
+  FP32 vel_kp;     // 速度环, N*m/(rad/s)
+  FP32 vel_ki;     // 速度环, N*m/rad
+  FP32 pos_kp;     // 位置环, (rad/s)/rad
+  FP32 torque_max; // 速度环输出限幅
+
+  /* 轨迹限制, 机械角 */
+  FP32 vel_max;
+  FP32 acc_max;
+  FP32 jerk_max;
+} loop_param_t;
+
+/*
+ * Fault bits, the same positions as the fields of foc_stat_t.
+ */
+#define FOC_FAULT_OVER_CUR   (1U << 1)
+#define FOC_FAULT_OVER_VOLT  (1U << 2)
+#define FOC_FAULT_UNDER_VOLT (1U << 3)
+#define FOC_FAULT_I2T        (1U << 4)
+#define FOC_FAULT_CUR_SUM    (1U << 5)
+#define FOC_FAULT_PHASE_LOSS (1U << 6)
+#define FOC_FAULT_OBS_STALL  (1U << 7)
+#define FOC_FAULT_CUR_TRACK  (1U << 8)
+#define FOC_FAULT_ALL        (0x1FEU)
+
+typedef struct {
+  U32  mask;        // 使能的故障位
+  FP32 cur_max;     // 相电流瞬时值上限
+  FP32 v_bus_max;   // 母线电压上限
+  FP32 v_bus_min;   // 母线电压下限
+  FP32 i2t_cur;     // 允许持续的电流幅值
+  FP32 i2t_max;     // 超出部分的 I^2*t 上限, A^2*s
+  FP32 cur_sum_max; // 三相电流和上限, 仅三电阻
+  FP32 loss_cur;    // 缺相, 三相平均电流高于该值时检查
+  FP32 loss_ratio;  // 缺相, 某相均值低于三相平均的比例
+  FP32 loss_vel;    // 缺相, 电角速度高于该值时检查
+  FP32 stall_cur;   // 观测器失速, q 轴电流给定高于该值
+  FP32 stall_vel;   // 观测器失速, 观测速度低于该值
+  FP32 track_err;   // 电流跟踪误差幅值上限
+  FP32 time_s;      // 合理性检查需持续的时间
+} fault_param_t;
+
+/*
+ * Optional work shed on overruns, each level includes the ones above it.
+ */
+typedef enum {
+  FOC_DEGRADE_NULL,
+  FOC_DEGRADE_TELEMETRY, // 暂停 FRA 和标定学习, 快照降频发布
+  FOC_DEGRADE_HARMONIC,  // 停谐振器和陷波器
+  FOC_DEGRADE_OBSERVER,  // 角度不依赖观测器时停 SMO
+} foc_degrade_e;
+
+typedef struct {
+  FP32          ratio;         // 预算占控制周期的比例, 0 为不计时
+  FP32          restore_ratio; // 耗时低于该比例的预算视为有余量
+  U32           restore_cnt;   // 连续多少个有余量的周期后恢复一级
+  foc_degrade_e e_degrade_max; // 最多降到的级别
+} budget_param_t;
+
+typedef struct {
+  FP32           freq_hz; // 控制频率, 双更新时为 PWM 频率的两倍
   FP32           theta_offset;
   BOOL           is_adc_cail;
+  BOOL           is_decouple; // 电流环解耦及反电动势前馈
   motor_param_t  motor;
   periph_param_t periph;
+  theta_param_t  theta;
+  loop_param_t   loop;
+  fault_param_t  fault;
+  budget_param_t budget;
 } foc_cfg_t;
 
 typedef struct {
-  adc_raw_t  adc_raw;
-  theta_t    theta;
-  fp32_uvw_t fp32_i_uvw, fp32_v_uvw;
-  fp32_ab_t  i_ab, v_ab;
-  fp32_dq_t  i_dq, v_dq;
+  adc_raw_t      adc_raw;
+  foc_pwm_edge_e pwm_edge; // 本次采样所在边沿
+  FP32           v_bus;
+  theta_t        theta;
+  fp32_uvw_t     fp32_i_uvw, fp32_v_uvw;
+  fp32_ab_t      i_ab, v_ab;
+  fp32_dq_t      i_dq, v_dq;
 } foc_in_t;
 
 typedef struct {
   fp32_uvw_t fp32_i_uvw, fp32_v_uvw;
   fp32_ab_t  i_ab, v_ab;
   fp32_ab_t  v_ab_sv;
+  FP32       torque_ref;
+  FP32       pos_ref, vel_ref, acc_ref; // 外环给定, 机械角
+  FP32       torque_ff;                 // 外环转矩前馈, 如重力和摩擦
   fp32_dq_t  i_dq, v_dq;
+  fp32_dq_t  v_dq_ff;
   svpwm_t    svpwm;
+  BOOL       is_cur_fallback; // 单电阻下开关状态 MPC 无法采样, 电流环由 PI 代替
 } foc_out_t;
 
 typedef enum {
@@ -87,32 +240,193 @@ typedef enum {
   FOC_THETA_SENSORFUSION,
 } foc_theta_e;
 
+typedef enum {
+  FOC_VEL_PLL,
+  FOC_VEL_KF,
+} foc_vel_e;
+
+typedef enum {
+  FOC_CUR_PI,       // 两个电流环 PI + SVPWM
+  FOC_CUR_MPC,      // 模型预测, 默认调制型经 SVPWM; 直接输出开关状态时单电阻退回 PI
+  FOC_CUR_DEADBEAT, // 无差拍预测 + 扰动观测器, 替代两个 PI
+} foc_cur_e;
+
+typedef enum {
+  FOC_LOOP_CUR, // 只有电流环, 给定 i_dq 或 torque_ref
+  FOC_LOOP_VEL, // 速度环, 给定 vel_ref 和 acc_ref
+  FOC_LOOP_POS, // 位置环, 由 foc_move() 的轨迹给定
+} foc_loop_e;
+
+typedef enum {
+  FOC_FRA_NULL,
+  FOC_FRA_ID_REF, // 闭环, 注入 d 轴电流给定
+  FOC_FRA_IQ_REF, // 闭环, 注入 q 轴电流给定
+  FOC_FRA_VD,     // 开环, 注入 d 轴电流环输出
+  FOC_FRA_VQ,     // 开环, 注入 q 轴电流环输出
+  FOC_FRA_VEL,    // 闭环, 注入速度给定, 需速度或位置环
+  FOC_FRA_TORQUE, // 开环, 注入速度环输出转矩, 需速度或位置环
+} foc_fra_e;
+
+typedef enum {
+  FOC_CALI_NULL,
+  FOC_CALI_ENC,     // 编码器误差, 需匀速旋转
+  FOC_CALI_COGGING, // 齿槽转矩, 需低速旋转且使用 FOC_VEL_KF
+} foc_cali_e;
+
 typedef struct {
-  U32 NULL_FUNC_PTR : 1;
+  foc_cali_e e_cali;
+  U32        rev_num;   // 学习圈数
+  FP32       gain;      // 齿槽迭代学习增益
+  U32        rev_cnt;   // 已过零次数
+  FP32       prev_rad;  // 上次机械角度
+  FP32       theta_rad; // 本圈展开角度
+  FP32       tick;      // 本圈已过周期数
+  FP32       period;    // 上圈周期数
+} foc_cali_t;
+
+typedef union {
+  struct {
+    U32 NULL_FUNC_PTR : 1;
+    U32 OVER_CUR      : 1; // 相电流瞬时值超限
+    U32 OVER_VOLT     : 1; // 母线过压
+    U32 UNDER_VOLT    : 1; // 母线欠压
+    U32 I2T           : 1; // 电流热积分超限
+    U32 CUR_SUM       : 1; // 三相电流和不为零, 采样或接线异常
+    U32 PHASE_LOSS    : 1; // 某相电流均值远低于另外两相
+    U32 OBS_STALL     : 1; // 有转矩电流给定但观测速度长期为零
+    U32 CUR_TRACK     : 1; // 电流跟踪误差长期超限
+  };
+  U32 word;
 } foc_stat_t;
 
+#define FOC_FAULT_LANE_NUM (10U)
+
+typedef struct {
+  FP32 val[FOC_FAULT_LANE_NUM]; // 各检查项本周期的值
+  FP32 max[FOC_FAULT_LANE_NUM]; // 各检查项门限
+  U32  bit[FOC_FAULT_LANE_NUM]; // 各检查项对应的故障位
+  FP32 i2t;
+  FP32 i_abs[3]; // 三相电流绝对值的均值
+  U32  loss_cnt, stall_cnt, track_cnt;
+  U64  trip_cnt; // 锁存时的 exec_cnt
+} foc_fault_t;
+
+#define FOC_BUDGET_HIST_NUM (16U) // 每格 1/8 预算, 最后一格包含 2 倍以上
+
+typedef struct {
+  U32           budget;       // 计时器计数
+  U32           elapsed_max;
+  U32           overrun_cnt;  // 超时次数
+  U32           headroom_cnt; // 连续有余量的周期数
+  U32           shed_cnt;     // 降级次数
+  foc_degrade_e e_degrade;
+  U32           hist[FOC_BUDGET_HIST_NUM];
+} foc_budget_t;
+
+#define FOC_SNAP_SHED_DIV (16U) // 遥测降级时快照的发布间隔, 控制周期
+
+/* 每周期发布一次, 供遥测读取 */
+typedef struct {
+  U64           exec_cnt;
+  foc_state_e   e_state;
+  foc_degrade_e e_degrade;
+  U32           stat;    // foc_stat_t.word
+  U32           elapsed; // 上一周期耗时
+  FP32          theta_rad, vel_rads;
+  FP32          pos_rad;
+  FP32          v_bus;
+  fp32_dq_t     i_dq, v_dq; // 反馈电流和输出电压
+  fp32_dq_t     i_dq_ref;
+  FP32          torque_ref;
+} foc_snap_t;
+
+/* 一组可在运行中切换的配置, 派生量已算好 */
+typedef struct {
+  foc_cfg_t    cfg;
+  pid_cfg_t    id_pid, iq_pid, vel_pid, pos_pid;
+  scurve_cfg_t traj;
+  FP32         fault_max[FOC_FAULT_LANE_NUM];
+  U32          budget; // 计时器计数
+} foc_tune_set_t;
+
+typedef enum {
+  FOC_TUNE_PID_ID,
+  FOC_TUNE_PID_IQ,
+  FOC_TUNE_PID_VEL,
+  FOC_TUNE_PID_POS,
+  FOC_TUNE_PID_NUM,
+} foc_tune_pid_e;
+
+typedef struct {
+  foc_tune_set_t set[2];
+  volatile U32   pending;    // 待生效的 set 下标 + 1, 0 为无
+  U32            last;       // 最近一次写入的 set
+  volatile U8    busy;       // 正在暂存
+  U32            apply_idx;  // 最近一次换入的 set
+  U32            apply_cnt;
+  U32            reject_cnt; // 校验不通过或并发暂存
+  pid_cfg_t      pid_next[FOC_TUNE_PID_NUM]; // 换入的 PID 参数, 各环下次运行时生效
+  U32            pid_swap;                   // pid_next 中尚未生效的位
+  scurve_cfg_t   traj_next;                  // 轨迹运行中换入的限值, 停下后生效
+  BOOL           is_traj_next;
+} foc_tune_t;
+
 typedef struct {
   U64              exec_cnt;
-  U32              elapsed;
+  U32              elapsed; // 上次 foc_run() 耗时, 计时器计数
+  foc_budget_t     budget;
+  seqlock_t        snap_lock;
+  foc_snap_t       snap; // 只经 foc_snap_get() 读取
+  foc_tune_t       tune;
   foc_stat_t       stat;
+  foc_fault_t      fault;
   U32              adc_cail_cnt;
+  FP32             adc_val[FOC_ADC_CH_NUM]; // 本周期采样, 含零偏, 过采样时带小数
+  decim_t          adc_decim;
+  fp32_uvw_t       adc_drift; // 零漂估计, 叠加在 adc_offset 上
   foc_state_e      e_state;
   foc_theta_e      e_theta;
+  foc_vel_e        e_vel;
+  foc_cur_e        e_cur;
+  foc_loop_e       e_loop;
+  foc_fra_e        e_fra;
   pid_ctrl_t       id_pid, iq_pid;
+  mpc_t            mpc;
+  deadbeat_t       deadbeat;
+  res_ctrl_t       cur_res; // 电流谐波谐振器, 与 PI 并联
+  U32              loop_cnt;
+  pid_ctrl_t       vel_pid, pos_pid;
+  scurve_t         traj;
   vel_pll_filter_t vel_pll;
+  vel_kf_filter_t  vel_kf;
   smo_obs_t        smo;
+  anf_filter_t     iq_anf;
+  mtpa_t           mtpa;
+  angle_tbl_t      enc_tbl;     // 编码器误差, 机械角度
+  angle_tbl_t      cogging_tbl; // 齿槽前馈, q 轴电流
+  foc_cali_t       cali;
+  fra_t            fra;
+  U32              fra_start_cnt; // foc_fra_start() 成功次数
 } foc_lo_t;
 
 typedef adc_raw_t (*foc_adc_get_f)(void);
+typedef U32 (*foc_adc_block_get_f)(const adc_raw_t **adc_raw);
 typedef FP32 (*foc_theta_get_f)(void);
-typedef void (*foc_pwm_set_f)(U32 pwm_full_val, u32_uvw_t u32_pwm_duty);
+typedef void (*foc_pwm_set_f)(U32 pwm_full_val, u32_uvw_t u32_pwm_duty, foc_pwm_edge_e edge);
 typedef void (*foc_drv_set_f)(U8 enable);
+typedef foc_pwm_edge_e (*foc_pwm_edge_get_f)(void);
+typedef void (*foc_adc_trig_set_f)(const U32 *u32_adc_trig, U32 num);
+typedef U32 (*foc_ts_get_f)(void);
 
 typedef struct {
-  foc_adc_get_f   f_adc_get;
-  foc_theta_get_f f_theta_get;
-  foc_pwm_set_f   f_pwm_set;
-  foc_drv_set_f   f_drv_set;
+  foc_adc_get_f       f_adc_get;       // 本次触发的采样结果
+  foc_adc_block_get_f f_adc_block_get; // DMA 过采样块, 返回个数, 非空时替代 f_adc_get
+  foc_theta_get_f     f_theta_get;
+  foc_pwm_set_f       f_pwm_set;       // 占空比在 edge 处装载生效
+  foc_drv_set_f       f_drv_set;
+  foc_pwm_edge_get_f  f_pwm_edge_get;  // 本次触发所在边沿, 双更新用, 为空则交替
+  foc_adc_trig_set_f  f_adc_trig_set;  // 下一周期的采样触发计数值, 单电阻用
+  foc_ts_get_f        f_ts_get;        // 自由运行计数器, 频率 timer_freq_hz, 为空不计时
 } foc_ops_t;
 
 typedef struct {
@@ -139,11 +453,73 @@ typedef struct {
   foc_lo_t  *prefix##_lo  = &prefix##_p->lo;                                                       \
   foc_ops_t *prefix##_ops = &prefix##_p->ops;
 
+/*
+ * Voltage limiting, v_ab_sv is normalised to the bus and the six-step fundamental is mi = 1.
+ * Without overmodulation the vector is scaled back onto the inscribed circle, mi <= 0.907.
+ * Region I (mi < SVPWM_MI_II) asks for a larger circle, svpwm() clips it onto the hexagon keeping
+ * the angle, and the radius is picked from SVPWM_OVM1_TBL so that the fundamental of the clipped
+ * path is the one asked for. At SVPWM_MI_II the circle reaches the vertices.
+ * Region II holds the vector on the nearest vertex for a hold angle that grows linearly with mi
+ * and compresses the rest of the sector in between, reaching six-step at mi = 1.
+ */
+static inline void
+svpwm_limit(foc_t *foc) {
+  DECL_FOC_PTRS(foc);
+
+  fp32_ab_t *v   = &out->v_ab_sv;
+  FP32       mag = FP32_SQRT(v->a * v->a + v->b * v->b);
+  out->svpwm.mi  = mag * FP32_PI_DIV_2;
+
+  if (!cfg->periph.is_overmod) {
+    if (mag > FP32_1_DIV_SQRT_3) {
+      FP32 scale = FP32_1_DIV_SQRT_3 / mag;
+      v->a *= scale;
+      v->b *= scale;
+    }
+    return;
+  }
+
+  if (mag <= FP32_1_DIV_SQRT_3)
+    return;
+
+  if (out->svpwm.mi <= SVPWM_MI_II) {
+    FP32 x = (mag - FP32_1_DIV_SQRT_3) * (FP32)SVPWM_OVM1_NUM
+           / (SVPWM_MI_II / FP32_PI_DIV_2 - FP32_1_DIV_SQRT_3);
+    U32  i = MIN((U32)x, SVPWM_OVM1_NUM - 1U);
+    FP32 r = SVPWM_OVM1_TBL[i] + (x - (FP32)i) * (SVPWM_OVM1_TBL[i + 1] - SVPWM_OVM1_TBL[i]);
+    v->a *= r / mag;
+    v->b *= r / mag;
+    return;
+  }
+
+  FP32 sector = FP32_PI / 3.0f;
+  FP32 hold   = (out->svpwm.mi - SVPWM_MI_II) / (FP32_1 - SVPWM_MI_II) * sector * FP32_1_DIV_2;
+  CLAMP(hold, FP32_0, sector * FP32_1_DIV_2);
+
+  FP32 theta = FP32_ATAN2(v->b, v->a);
+  WARP_2PI(theta);
+  FP32 gamma = FP32_MOD(theta, sector);
+
+  FP32 gamma_hold;
+  if (gamma <= hold)
+    gamma_hold = FP32_0;
+  else if (gamma >= sector - hold)
+    gamma_hold = sector;
+  else
+    gamma_hold = (gamma - hold) * sector / (sector - FP32_2 * hold);
+
+  // aim past the hexagon, svpwm() pulls it back onto the edge
+  theta += gamma_hold - gamma;
+  v->a = FP32_COS(theta);
+  v->b = FP32_SIN(theta);
+}
+
 static inline void
 svpwm(foc_t *foc) {
   DECL_FOC_PTRS(foc);
 
-  out->fp32_v_uvw = inv_clarke(out->v_ab);
+  svpwm_limit(foc);
+  out->fp32_v_uvw = inv_clarke(out->v_ab_sv);
 
   if (out->fp32_v_uvw.u > out->fp32_v_uvw.v) {
     out->svpwm.v_max = out->fp32_v_uvw.u;
@@ -154,6 +530,16 @@ svpwm(foc_t *foc) {
   }
 
   UPDATE_MIN_MAX(out->fp32_v_uvw.w, out->svpwm.v_min, out->svpwm.v_max);
+
+  // outside the hexagon, shrink radially onto its edge so the angle is kept
+  FP32 span = out->svpwm.v_max - out->svpwm.v_min;
+  if (span > FP32_1) {
+    FP32 scale = FP32_1 / span;
+    UVW_MUL_2ARG(out->fp32_v_uvw, scale);
+    out->svpwm.v_max *= scale;
+    out->svpwm.v_min *= scale;
+  }
+
   out->svpwm.v_avg = (out->svpwm.v_max + out->svpwm.v_min) * FP32_1_DIV_2;
   UVW_SUB_3ARG(out->svpwm.fp32_pwm_duty, out->fp32_v_uvw, out->svpwm.v_avg);
 
@@ -162,22 +548,440 @@ svpwm(foc_t *foc) {
   UVW_MUL_3ARG(out->svpwm.u32_pwm_duty, out->svpwm.fp32_pwm_duty, cfg->periph.pwm_full_val);
 }
 
+/*
+ * Dead time steals (dead_time * pwm_freq + v_drop / v_bus) of duty from a leg whose current flows
+ * out of it, and gives the same back when it flows in. The correction follows the commanded
+ * phase current through a linear band around zero instead of a hard sign, so current ripple near
+ * the crossing does not chatter the duty. The clamp is spelled with FP32_ABS so the lane loop has
+ * no control flow and vectorizes.
+ */
+static inline void
+dead_time_comp(FP32 *duty, const FP32 *cur, U32 num, FP32 gain, FP32 band_inv) {
+  for (U32 i = 0; i < num; i++) {
+    // clamp(x, -1, 1) = (|x + 1| - |x - 1|) / 2
+    FP32 x = cur[i] * band_inv;
+    duty[i] += gain * FP32_1_DIV_2 * (FP32_ABS(x + FP32_1) - FP32_ABS(x - FP32_1));
+  }
+}
+
 static inline void
+foc_dead_time_comp(foc_t *foc) {
+  DECL_FOC_PTRS(foc);
+
+  FP32 gain = cfg->periph.dead_time_s * (FP32)cfg->periph.pwm_freq_hz;
+  if (in->v_bus > FP32_1)
+    gain += cfg->periph.v_drop / in->v_bus;
+  if (gain <= FP32_0)
+    return;
+
+  FP32 band_inv = (cfg->periph.dt_cur_band > FP32_0) ? FP32_1 / cfg->periph.dt_cur_band : FP32_M;
+  dead_time_comp(&out->svpwm.fp32_pwm_duty.u, &out->fp32_i_uvw.u, 3U, gain, band_inv);
+
+  UVW_CLAMP(out->svpwm.fp32_pwm_duty, cfg->periph.fp32_pwm_min, cfg->periph.fp32_pwm_max);
+  UVW_MUL_3ARG(out->svpwm.u32_pwm_duty, out->svpwm.fp32_pwm_duty, cfg->periph.pwm_full_val);
+}
+
+/*
+ * Phase currents from fewer than three shunts.
+ * Two shunts: w = -(u + v).
+ * One shunt in the dc link: in the rising half of a center aligned period the legs switch high in
+ * order of duty, max first. With only the max leg high the link carries i_max, with max and mid
+ * high it carries -i_min. The two samples are taken in those windows, mapped back with the order
+ * of the duty that was in force, which is the one from the previous call.
+ */
+static inline void
+foc_shunt_rebuild(foc_t *foc) {
+  DECL_FOC_PTRS(foc);
+
+  FP32 *i = &in->fp32_i_uvw.u;
+  switch (cfg->periph.e_shunt) {
+  case FOC_SHUNT_2:
+    in->fp32_i_uvw.w = -(in->fp32_i_uvw.u + in->fp32_i_uvw.v);
+    break;
+  case FOC_SHUNT_1: {
+    FP32 i_a = in->fp32_i_uvw.u, i_b = in->fp32_i_uvw.v;
+    U32  max = out->svpwm.idx_max, min = out->svpwm.idx_min;
+    i[max]            = i_a;
+    i[min]            = -i_b;
+    i[3U - max - min] = i_b - i_a;
+  } break;
+  default:
+    break;
+  }
+}
+
+/*
+ * Single shunt windows. Where a window in the rising half is shorter than shunt_win_s the max leg
+ * is switched on earlier or the min leg later, and the falling half gives the same duty back so
+ * the period average and the voltage are unchanged. The triggers sit shunt_settle_s after the
+ * start of each window.
+ */
+static inline void
+foc_shunt_shift(foc_t *foc) {
+  DECL_FOC_PTRS(foc);
+
+  const FP32 *d    = &out->svpwm.fp32_pwm_duty.u;
+  U32         max  = 0, min = 0;
+  for (U32 k = 1; k < 3U; k++) {
+    if (d[k] > d[max])
+      max = k;
+    if (d[k] < d[min])
+      min = k;
+  }
+  if (max == min)
+    min = (max + 1U) % 3U;
+  U32 mid = 3U - max - min;
+
+  FP32 half_cnt = (FP32)cfg->periph.pwm_freq_hz * FP32_2;
+  FP32 win      = cfg->periph.shunt_win_s * half_cnt;
+  FP32 up[3]    = {d[0], d[1], d[2]};
+  if (up[max] < d[mid] + win)
+    up[max] = d[mid] + win;
+  if (up[min] > d[mid] - win)
+    up[min] = d[mid] - win;
+
+  // the shift is limited by whichever half reaches a pwm limit first, so up + down stays 2 * d
+  const U32 *u32_d    = &out->svpwm.u32_pwm_duty.u;
+  U32       *u32_up   = &out->svpwm.u32_pwm_duty_up.u;
+  U32       *u32_down = &out->svpwm.u32_pwm_duty_down.u;
+  for (U32 k = 0; k < 3U; k++) {
+    FP32 room  = MIN(cfg->periph.fp32_pwm_max - d[k], d[k] - cfg->periph.fp32_pwm_min);
+    FP32 shift = up[k] - d[k];
+    if (room < FP32_0)
+      room = FP32_0;
+    CLAMP(shift, -room, room);
+    up[k] = d[k] + shift;
+
+    I32 cnt     = (I32)(shift * (FP32)cfg->periph.pwm_full_val);
+    u32_up[k]   = (U32)((I32)u32_d[k] + cnt);
+    u32_down[k] = (U32)((I32)u32_d[k] - cnt);
+  }
+
+  // a leg turns on at full * (1 - duty) in the rising half
+  FP32 full   = (FP32)cfg->periph.pwm_full_val;
+  FP32 settle = cfg->periph.shunt_settle_s * half_cnt * full;
+  out->svpwm.u32_adc_trig[0] = (U32)(full * (FP32_1 - up[max]) + settle);
+  out->svpwm.u32_adc_trig[1] = (U32)(full * (FP32_1 - up[mid]) + settle);
+  out->svpwm.idx_max         = max;
+  out->svpwm.idx_min         = min;
+}
+
+static inline void
+foc_pwm_out(foc_t *foc, foc_pwm_edge_e edge) {
+  DECL_FOC_PTRS(foc);
+
+  if (cfg->periph.e_shunt != FOC_SHUNT_1) {
+    ops->f_pwm_set(cfg->periph.pwm_full_val, out->svpwm.u32_pwm_duty, edge);
+    return;
+  }
+
+  foc_shunt_shift(foc);
+  ops->f_pwm_set(cfg->periph.pwm_full_val, out->svpwm.u32_pwm_duty_up, FOC_PWM_EDGE_VALLEY);
+  ops->f_pwm_set(cfg->periph.pwm_full_val, out->svpwm.u32_pwm_duty_down, FOC_PWM_EDGE_PEAK);
+  if (ops->f_adc_trig_set)
+    ops->f_adc_trig_set(out->svpwm.u32_adc_trig, 2U);
+}
+
+/*
+ * This period's conversions into lo->adc_val. With f_adc_block_get the block the dma filled over
+ * the period is decimated to one value per channel and the bits gained by averaging are kept as
+ * a fraction. in->adc_raw is the offset free integer view of it.
+ */
+static inline void
+foc_adc_read(foc_t *foc) {
+  DECL_FOC_PTRS(foc);
+
+  adc_raw_t adc_raw;
+  if (ops->f_adc_block_get) {
+    const adc_raw_t *buf = NULL;
+    U32              num = ops->f_adc_block_get(&buf);
+    DECL_DECIM_PTRS_PREFIX(&foc->lo.adc_decim, decim);
+    decim_run_in(decim_p, (const I32 *)buf, num, FOC_ADC_CH_NUM);
+    memcpy(lo->adc_val, decim_out->val, sizeof(lo->adc_val));
+  } else {
+    adc_raw       = ops->f_adc_get();
+    const I32 *ch = (const I32 *)&adc_raw;
+    for (U32 i = 0; i < FOC_ADC_CH_NUM; i++)
+      lo->adc_val[i] = (FP32)ch[i];
+  }
+
+  I32 *ch = (I32 *)&adc_raw;
+  for (U32 i = 0; i < FOC_ADC_CH_NUM; i++)
+    ch[i] = (I32)(lo->adc_val[i] + FP32_1_DIV_2);
+  UVW_SUB_UVW(adc_raw.i32_i_uvw, cfg->periph.adc_offset.i32_i_uvw);
+  in->adc_raw = adc_raw;
+}
+
+/*
+ * Offset drift, tracked at adc_drift_hz once the offsets are calibrated.
+ * With the bridge off every current channel reads its own offset. While running only three phase
+ * shunts have a reference, the sum of the phase currents is zero so what is left of it is the
+ * common drift, the part that differs between phases waits for the next time the bridge is off.
+ */
+static inline void
+foc_adc_drift(foc_t *foc) {
+  DECL_FOC_PTRS(foc);
+
+  if (!cfg->is_adc_cail || cfg->periph.adc_drift_hz <= FP32_0)
+    return;
+
+  const adc_raw_t *offset = &cfg->periph.adc_offset;
+  FP32             k      = FP32_2PI * cfg->periph.adc_drift_hz * FP32_HZ_TO_S(cfg->freq_hz);
+  FP32             eu     = lo->adc_val[0] - (FP32)offset->i32_i_uvw.u - lo->adc_drift.u;
+  FP32             ev     = lo->adc_val[1] - (FP32)offset->i32_i_uvw.v - lo->adc_drift.v;
+  FP32             ew     = lo->adc_val[2] - (FP32)offset->i32_i_uvw.w - lo->adc_drift.w;
+
+  if (lo->e_state != FOC_STATE_ENABLE) {
+    lo->adc_drift.u += k * eu;
+    lo->adc_drift.v += k * ev;
+    lo->adc_drift.w += k * ew;
+  } else if (cfg->periph.e_shunt == FOC_SHUNT_3) {
+    FP32 e = (eu + ev + ew) / 3.0f;
+    lo->adc_drift.u += k * e;
+    lo->adc_drift.v += k * e;
+    lo->adc_drift.w += k * e;
+  }
+}
+
+/*
+ * Every check is a lane, value against threshold, and a lane over its threshold sets its fault
+ * bit. No lane branches, so the cost is the same whether or not anything trips.
+ */
+static inline U32
+fault_check(const FP32 *val, const FP32 *max, const U32 *bit, U32 num) {
+  U32 word = 0;
+  for (U32 i = 0; i < num; i++)
+    word |= (0U - (U32)(val[i] > max[i])) & bit[i];
+  return word;
+}
+
+static inline void
+foc_fault_max(const foc_cfg_t *cfg, FP32 *max) {
+  const fault_param_t *f     = &cfg->fault;
+  FP32                 ticks = f->time_s * cfg->freq_hz;
+
+  const FP32 lane[FOC_FAULT_LANE_NUM] = {
+      f->cur_max, f->cur_max, f->cur_max, f->v_bus_max, -f->v_bus_min,
+      f->i2t_max, f->cur_sum_max, ticks, ticks, ticks,
+  };
+  memcpy(max, lane, sizeof(lane));
+}
+
+static inline void
+foc_fault_init(foc_t *foc) {
+  DECL_FOC_PTRS(foc);
+
+  foc_fault_t *fault = &lo->fault;
+  const U32 bit[FOC_FAULT_LANE_NUM] = {
+      FOC_FAULT_OVER_CUR, FOC_FAULT_OVER_CUR, FOC_FAULT_OVER_CUR, FOC_FAULT_OVER_VOLT,
+      FOC_FAULT_UNDER_VOLT, FOC_FAULT_I2T, FOC_FAULT_CUR_SUM, FOC_FAULT_PHASE_LOSS,
+      FOC_FAULT_OBS_STALL, FOC_FAULT_CUR_TRACK,
+  };
+
+  memset(fault, 0, sizeof(*fault));
+  foc_fault_max(cfg, fault->max);
+  memcpy(fault->bit, bit, sizeof(fault->bit));
+}
+
+/*
+ * Runs right after the currents are read, so a trip turns the driver off in the same cycle before
+ * anything else is computed. Thresholds are instantaneous, the plausibility checks count ticks
+ * their condition has held and use the dq values of the last tick. Faults stay latched and keep
+ * the bridge off until foc_fault_clear().
+ */
+static inline void
+foc_fault_run(foc_t *foc) {
+  DECL_FOC_PTRS(foc);
+
+  const fault_param_t *f     = &cfg->fault;
+  foc_fault_t         *fault = &lo->fault;
+  FP32                 ts    = FP32_HZ_TO_S(cfg->freq_hz);
+
+  if (!f->mask || !cfg->is_adc_cail)
+    return;
+
+  FP32 iu = in->fp32_i_uvw.u, iv = in->fp32_i_uvw.v, iw = in->fp32_i_uvw.w;
+  BOOL is_run = (lo->e_state == FOC_STATE_ENABLE);
+
+  // heating above the continuous current, cooling below it
+  FP32 i2 = (iu * iu + iv * iv + iw * iw) * FP32_2_DIV_3;
+  fault->i2t += (i2 - f->i2t_cur * f->i2t_cur) * ts;
+  if (fault->i2t < FP32_0)
+    fault->i2t = FP32_0;
+
+  // rectified means over about four electrical periods at loss_vel
+  FP32 k = f->loss_vel * ts / (4.0f * FP32_2PI);
+  fault->i_abs[0] += k * (FP32_ABS(iu) - fault->i_abs[0]);
+  fault->i_abs[1] += k * (FP32_ABS(iv) - fault->i_abs[1]);
+  fault->i_abs[2] += k * (FP32_ABS(iw) - fault->i_abs[2]);
+  FP32 i_mean = (fault->i_abs[0] + fault->i_abs[1] + fault->i_abs[2]) / 3.0f;
+  FP32 i_min  = fminf(fault->i_abs[0], fminf(fault->i_abs[1], fault->i_abs[2]));
+
+  BOOL is_loss = is_run && FP32_ABS(in->theta.vel_rads) > f->loss_vel && i_mean > f->loss_cur
+                 && i_min < f->loss_ratio * i_mean;
+  BOOL is_stall = is_run
+                  && (lo->e_theta == FOC_THETA_SENSORLESS || lo->e_theta == FOC_THETA_SENSORFUSION)
+                  && FP32_ABS(out->i_dq.q) > f->stall_cur
+                  && FP32_ABS(in->theta.obs_vel_rads) < f->stall_vel;
+  FP32 ed = out->i_dq.d - in->i_dq.d, eq = out->i_dq.q - in->i_dq.q;
+  BOOL is_track = is_run && ed * ed + eq * eq > f->track_err * f->track_err;
+  fault->loss_cnt  = (fault->loss_cnt + 1U) * (U32)is_loss;
+  fault->stall_cnt = (fault->stall_cnt + 1U) * (U32)is_stall;
+  fault->track_cnt = (fault->track_cnt + 1U) * (U32)is_track;
+
+  fault->val[0] = FP32_ABS(iu);
+  fault->val[1] = FP32_ABS(iv);
+  fault->val[2] = FP32_ABS(iw);
+  fault->val[3] = in->v_bus;
+  fault->val[4] = -in->v_bus;
+  fault->val[5] = fault->i2t;
+  fault->val[6] = (cfg->periph.e_shunt == FOC_SHUNT_3) ? FP32_ABS(iu + iv + iw) : FP32_0;
+  fault->val[7] = (FP32)fault->loss_cnt;
+  fault->val[8] = (FP32)fault->stall_cnt;
+  fault->val[9] = (FP32)fault->track_cnt;
+
+  U32 word = fault_check(fault->val, fault->max, fault->bit, FOC_FAULT_LANE_NUM) & f->mask;
+  if (word && !(lo->stat.word & f->mask))
+    fault->trip_cnt = lo->exec_cnt;
+  lo->stat.word |= word;
+
+  if ((lo->stat.word & f->mask) && lo->e_state == FOC_STATE_ENABLE) {
+    ops->f_drv_set(FALSE);
+    lo->e_state = FOC_STATE_DISABLE;
+  }
+}
+
+/*
+ * Drop the latched faults and the history of the slow checks, the state is left to the caller.
+ */
+static inline void
+foc_fault_clear(foc_t *foc) {
+  DECL_FOC_PTRS(foc);
+
+  foc_fault_t *fault = &lo->fault;
+  lo->stat.word &= ~FOC_FAULT_ALL;
+  fault->i2t       = FP32_0;
+  fault->loss_cnt  = 0;
+  fault->stall_cnt = 0;
+  fault->track_cnt = 0;
+  fault->trip_cnt  = 0;
+  memset(fault->i_abs, 0, sizeof(fault->i_abs));
+}
+
+/*
+ * Everything foc_init() and a hot swap compute from the config. Without cur_pid the current loops
+ * get the default gains from the motor.
+ */
+static inline void
+foc_tune_derive(const foc_cfg_t *cfg, const pid_cfg_t *cur_pid, foc_tune_set_t *set) {
+  set->cfg = *cfg;
+
+  if (cur_pid) {
+    set->id_pid = *cur_pid;
+  } else {
+    set->id_pid.kp           = 1500.0f * cfg->motor.ld;
+    set->id_pid.ki           = 1500.0f * cfg->motor.rs;
+    set->id_pid.kd           = FP32_0;
+    set->id_pid.out_max      = 48.0f / FP32_1_DIV_SQRT_3 * cfg->periph.fp32_pwm_max;
+    set->id_pid.integral_max = set->id_pid.out_max;
+  }
+  set->id_pid.freq_hz = cfg->freq_hz;
+  set->iq_pid         = set->id_pid;
+
+  // outer loops run every div ticks
+  FP32 loop_freq_hz = cfg->freq_hz / (FP32)(cfg->loop.div ? cfg->loop.div : 1U);
+
+  set->vel_pid.freq_hz      = loop_freq_hz;
+  set->vel_pid.kp           = cfg->loop.vel_kp;
+  set->vel_pid.ki           = cfg->loop.vel_ki;
+  set->vel_pid.kd           = FP32_0;
+  set->vel_pid.out_max      = cfg->loop.torque_max;
+  set->vel_pid.integral_max = cfg->loop.torque_max;
+
+  set->pos_pid              = set->vel_pid;
+  set->pos_pid.kp           = cfg->loop.pos_kp;
+  set->pos_pid.ki           = FP32_0;
+  set->pos_pid.out_max      = cfg->loop.vel_max;
+  set->pos_pid.integral_max = FP32_0;
+
+  set->traj.freq_hz  = loop_freq_hz;
+  set->traj.vel_max  = cfg->loop.vel_max;
+  set->traj.acc_max  = cfg->loop.acc_max;
+  set->traj.jerk_max = cfg->loop.jerk_max;
+
+  foc_fault_max(cfg, set->fault_max);
+  set->budget
+      = (U32)(cfg->budget.ratio * (FP32)cfg->periph.timer_freq_hz * FP32_HZ_TO_S(cfg->freq_hz));
+}
+
+/*
+ * FAIL leaves foc untouched: double update with a single shunt, which already loads both halves
+ * of every period with its own duties, or with a freq_hz other than twice pwm_freq_hz. Every edge
+ * is a control tick, the delays in cfg->theta stay in ticks and scale with it.
+ */
+static inline ret_e
 foc_init(foc_t *foc, foc_cfg_t foc_cfg) {
   DECL_FOC_PTRS(foc);
+
+  const periph_param_t *periph = &foc_cfg.periph;
+  if (periph->is_double_update
+      && (periph->e_shunt == FOC_SHUNT_1
+          || foc_cfg.freq_hz != (FP32)periph->pwm_freq_hz * FP32_2))
+    return FAIL;
+
   *cfg = foc_cfg;
 
+  // no table until foc_mtpa_init(), which is called after foc_init()
+  memset(&lo->mtpa, 0, sizeof(lo->mtpa));
+
+  // the outer loops need a torque constant, see foc_loop_set()
+  if (!(cfg->motor.flux > FP32_0))
+    lo->e_loop = FOC_LOOP_CUR;
+
   cfg->periph.adc2cur  = cfg->periph.cur_range / (FP32)cfg->periph.adc_full_val;
   cfg->periph.adc2vbus = cfg->periph.vbus_range / (FP32)cfg->periph.adc_full_val;
 
-  pid_cfg_t pid_cfg;
-  pid_cfg.freq_hz      = cfg->freq_hz;
-  pid_cfg.kp           = 1500.0f * cfg->motor.ld;
-  pid_cfg.ki           = 1500.0f * cfg->motor.rs;
-  pid_cfg.out_max      = 48.0f / FP32_1_DIV_SQRT_3 * cfg->periph.fp32_pwm_max;
-  pid_cfg.integral_max = pid_cfg.out_max;
-  pid_init(&foc->lo.id_pid, pid_cfg);
-  pid_init(&foc->lo.iq_pid, pid_cfg);
+  // any valid order until the first period has been shifted
+  out->svpwm.idx_max = 0;
+  out->svpwm.idx_min = 1;
+
+  decim_cfg_t decim_cfg;
+  decim_cfg.num    = cfg->periph.adc_os_num;
+  decim_cfg.ch_num = FOC_ADC_CH_NUM;
+  decim_cfg.order  = cfg->periph.adc_os_order;
+  decim_cfg.tap    = cfg->periph.adc_os_tap;
+  decim_init(&lo->adc_decim, decim_cfg);
+
+  foc_fault_init(foc);
+
+  foc_tune_set_t set;
+  foc_tune_derive(cfg, NULL, &set);
+  memset(&lo->tune, 0, sizeof(lo->tune));
+
+  memset(&lo->budget, 0, sizeof(lo->budget));
+  lo->budget.budget = set.budget;
+
+  pid_init(&foc->lo.id_pid, set.id_pid);
+  pid_init(&foc->lo.iq_pid, set.iq_pid);
+
+  mpc_cfg_t mpc_cfg;
+  mpc_cfg.freq_hz       = cfg->freq_hz;
+  mpc_cfg.motor         = cfg->motor;
+  mpc_cfg.is_delay_comp = TRUE;
+  mpc_cfg.is_modulated  = TRUE;
+  mpc_init(&foc->lo.mpc, mpc_cfg);
+
+  deadbeat_cfg_t deadbeat_cfg;
+  deadbeat_cfg.freq_hz       = cfg->freq_hz;
+  deadbeat_cfg.motor         = cfg->motor;
+  deadbeat_cfg.is_delay_comp = TRUE;
+  deadbeat_cfg.obs_gain      = 0.2f;
+  deadbeat_cfg.v_ratio       = FP32_1_DIV_SQRT_3 * cfg->periph.fp32_pwm_max;
+  deadbeat_init(&foc->lo.deadbeat, deadbeat_cfg);
+
+  pid_init(&foc->lo.vel_pid, set.vel_pid);
+  pid_init(&foc->lo.pos_pid, set.pos_pid);
+  scurve_init(&foc->lo.traj, set.traj);
 
   pll_cfg_t pll_cfg;
   pll_cfg.freq_hz = cfg->freq_hz;
@@ -186,12 +990,286 @@ foc_init(foc_t *foc, foc_cfg_t foc_cfg) {
   pll_cfg.damp    = 0.707f;
   vel_pll_init(&foc->lo.vel_pll, pll_cfg);
 
+  kf_cfg_t kf_cfg;
+  kf_cfg.freq_hz   = cfg->freq_hz;
+  kf_cfg.q         = (cfg->theta.kf_q > FP32_0) ? cfg->theta.kf_q : 1e9f;
+  kf_cfg.r         = (cfg->theta.kf_r > FP32_0) ? cfg->theta.kf_r : 1e-6f;
+  kf_cfg.is_steady = TRUE;
+  vel_kf_init(&foc->lo.vel_kf, kf_cfg);
+
   smo_cfg_t smo_cfg;
   smo_cfg.freq_hz = cfg->freq_hz;
   smo_cfg.motor   = cfg->motor;
   smo_cfg.kp      = 10.0f;
   smo_cfg.es0     = 500.0f;
   smo_init(&foc->lo.smo, smo_cfg);
+
+  return OK;
+}
+
+static inline void
+foc_theta_fusion(foc_t *foc) {
+  DECL_FOC_PTRS(foc);
+
+  FP32 ts = FP32_HZ_TO_S(cfg->freq_hz);
+
+  // bring both angles to the same instant before blending
+  FP32 sensor_theta_rad
+      = in->theta.sensor_theta_rad + in->theta.sensor_vel_rads * cfg->theta.sensor_delay * ts;
+  FP32 obs_theta_rad = in->theta.obs_theta_rad + in->theta.obs_vel_rads * cfg->theta.obs_delay * ts;
+
+  FP32 weight = FP32_0;
+  FP32 band   = cfg->theta.fusion_vel_max - cfg->theta.fusion_vel_min;
+  FP32 vel    = FP32_ABS(in->theta.sensor_vel_rads);
+  if (band > FP32_0)
+    weight = (vel - cfg->theta.fusion_vel_min) / band;
+  else if (vel >= cfg->theta.fusion_vel_max)
+    weight = FP32_1;
+  CLAMP(weight, FP32_0, FP32_1);
+
+  FP32 diff = obs_theta_rad - sensor_theta_rad;
+  WARP_PI(diff);
+
+  in->theta.theta_rad = sensor_theta_rad + weight * diff;
+  in->theta.vel_rads
+      = in->theta.sensor_vel_rads + weight * (in->theta.obs_vel_rads - in->theta.sensor_vel_rads);
+  WARP_2PI(in->theta.theta_rad);
+}
+
+/*
+ * Attaches the torque to dq current table, after foc_init(). FAIL leaves foc without a table.
+ */
+static inline ret_e
+foc_mtpa_init(foc_t *foc, const mtpa_tbl_t *tbl) {
+  DECL_FOC_PTRS(foc);
+
+  mtpa_cfg_t mtpa_cfg;
+  mtpa_cfg.tbl = tbl;
+  return mtpa_init(&lo->mtpa, mtpa_cfg);
+}
+
+static inline void
+foc_cali_start(foc_t *foc, foc_cali_e e_cali, U32 rev_num, FP32 gain) {
+  DECL_FOC_PTRS(foc);
+
+  angle_tbl_t *tbl = (e_cali == FOC_CALI_ENC) ? &lo->enc_tbl : &lo->cogging_tbl;
+  if (tbl->cfg.num == 0) {
+    angle_tbl_cfg_t tbl_cfg;
+    tbl_cfg.num = ANGLE_TBL_MAX;
+    angle_tbl_init(tbl, tbl_cfg);
+  }
+
+  // encoder error is measured from scratch, cogging is refined on top of what is there
+  if (e_cali == FOC_CALI_ENC)
+    angle_tbl_reset(tbl);
+
+  memset(&lo->cali, 0, sizeof(lo->cali));
+  lo->cali.rev_num  = rev_num;
+  lo->cali.gain     = gain;
+  lo->cali.prev_rad = in->theta.mech_theta_rad;
+  lo->cali.e_cali   = e_cali;
+}
+
+/*
+ * Revolutions are timed by interpolating the zero crossing of the unwrapped angle. Once a full
+ * revolution has been timed, the encoder error is the angle against a constant speed ramp over
+ * the last period. The cogging sample is what the current must have been to see no
+ * acceleration, iq - j * acc / kt, minus the feedforward already applied, and is folded into the
+ * table once per revolution. Both assume positive rotation.
+ */
+static inline void
+foc_cali_run(foc_t *foc) {
+  DECL_FOC_PTRS(foc);
+
+  foc_cali_t *cali = &lo->cali;
+  if (cali->e_cali == FOC_CALI_NULL)
+    return;
+
+  FP32 d = in->theta.mech_theta_rad - cali->prev_rad;
+  WARP_PI(d);
+  cali->prev_rad = in->theta.mech_theta_rad;
+  cali->theta_rad += d;
+  cali->tick += FP32_1;
+
+  if (cali->theta_rad >= FP32_2PI) {
+    FP32 frac = (d > FP32_0) ? (cali->theta_rad - FP32_2PI) / d : FP32_0;
+    cali->theta_rad -= FP32_2PI;
+
+    if (cali->rev_cnt >= 1)
+      cali->period = cali->tick - frac;
+    cali->tick = frac;
+
+    if (cali->rev_cnt >= 2 && cali->e_cali == FOC_CALI_COGGING)
+      angle_tbl_update(&lo->cogging_tbl, cali->gain);
+
+    if (++cali->rev_cnt >= cali->rev_num + 2U) {
+      if (cali->e_cali == FOC_CALI_ENC)
+        angle_tbl_update(&lo->enc_tbl, FP32_1);
+      cali->e_cali = FOC_CALI_NULL;
+      return;
+    }
+  }
+
+  if (cali->rev_cnt < 2)
+    return;
+
+  if (cali->e_cali == FOC_CALI_ENC) {
+    FP32 err = cali->theta_rad - FP32_2PI * cali->tick / cali->period;
+    WARP_PI(err);
+    angle_tbl_acc(&lo->enc_tbl, in->theta.mech_theta_rad, err);
+  } else {
+    FP32 kt  = 1.5f * (FP32)cfg->motor.npp * cfg->motor.flux;
+    FP32 acc = ELEC_TO_MECH(lo->vel_kf.out.acc_rads2, (FP32)cfg->motor.npp);
+    FP32 ff  = angle_tbl_run_in(&lo->cogging_tbl, in->theta.mech_theta_rad);
+    FP32 i_j = (kt > FP32_0) ? cfg->motor.j * acc / kt : FP32_0;
+    angle_tbl_acc(&lo->cogging_tbl, in->theta.mech_theta_rad, in->i_dq.q - i_j - ff);
+  }
+}
+
+/*
+ * Switch the outer loop, taking over the present position, velocity and torque so the change is
+ * bumpless. The outer loops command torque, without an mtpa table that needs flux > 0 to turn it
+ * into iq, FAIL and the loop is left as it was otherwise.
+ */
+static inline ret_e
+foc_loop_set(foc_t *foc, foc_loop_e e_loop) {
+  DECL_FOC_PTRS(foc);
+
+  FP32 kt = 1.5f * (FP32)cfg->motor.npp * cfg->motor.flux;
+  if (e_loop != FOC_LOOP_CUR && !lo->mtpa.cfg.tbl && !(kt > FP32_0))
+    return FAIL;
+
+  out->pos_ref = in->theta.pos_rad;
+  out->vel_ref = ELEC_TO_MECH(in->theta.vel_rads, (FP32)cfg->motor.npp);
+  out->acc_ref = FP32_0;
+
+  lo->vel_pid.lo.ki_out = lo->mtpa.cfg.tbl ? out->torque_ref : out->i_dq.q * kt;
+  lo->vel_pid.lo.ki_out -= out->torque_ff;
+  lo->pos_pid.lo.ki_out = FP32_0;
+
+  lo->traj.out.pos     = out->pos_ref;
+  lo->traj.out.vel     = FP32_0;
+  lo->traj.out.acc     = FP32_0;
+  lo->traj.out.is_done = TRUE;
+
+  lo->loop_cnt = 0;
+  lo->e_loop   = e_loop;
+  return OK;
+}
+
+/*
+ * Trajectory limits swapped in during a move wait for it to end, a move is never replanned.
+ */
+static inline void
+foc_tune_traj_take(foc_t *foc) {
+  foc_tune_t *t = &foc->lo.tune;
+  if (t->is_traj_next && foc->lo.traj.out.is_done) {
+    foc->lo.traj.cfg = t->traj_next;
+    t->is_traj_next  = FALSE;
+  }
+}
+
+/*
+ * Start a point to point move from where the last one ended, FAIL while one is still running.
+ */
+static inline ret_e
+foc_move(foc_t *foc, FP32 pos_rad) {
+  DECL_FOC_PTRS(foc);
+
+  if (lo->e_loop != FOC_LOOP_POS || !lo->traj.out.is_done)
+    return FAIL;
+
+  foc_tune_traj_take(foc);
+  return scurve_plan(&lo->traj, lo->traj.out.pos, pos_rad);
+}
+
+static inline BOOL
+foc_is_shed(const foc_t *foc, foc_degrade_e e_degrade) {
+  return foc->lo.budget.e_degrade >= e_degrade;
+}
+
+/*
+ * A loop with new gains swapped in runs its first step through pid_swap_run_in(), so the gains
+ * change at an error the loop has actually seen.
+ */
+static inline void
+foc_tune_pid_run(foc_t *foc, foc_tune_pid_e e_pid, pid_ctrl_t *pid, FP32 ref, FP32 fdb) {
+  foc_tune_t *t = &foc->lo.tune;
+  if (t->pid_swap & LF(e_pid)) {
+    pid_swap_run_in(pid, &t->pid_next[e_pid], ref, fdb);
+    t->pid_swap &= ~LF(e_pid);
+  } else {
+    pid_run_in(pid, ref, fdb);
+  }
+}
+
+static inline void
+foc_loop_run(foc_t *foc) {
+  DECL_FOC_PTRS(foc);
+
+  FP32 kt      = 1.5f * (FP32)cfg->motor.npp * cfg->motor.flux;
+  FP32 vel     = ELEC_TO_MECH(in->theta.vel_rads, (FP32)cfg->motor.npp);
+  FP32 vel_ref = out->vel_ref;
+
+  if (lo->e_loop == FOC_LOOP_POS) {
+    DECL_SCURVE_PTRS_PREFIX(&foc->lo.traj, traj);
+    scurve_run(traj_p);
+    foc_tune_traj_take(foc);
+    out->pos_ref = traj_out->pos;
+    out->vel_ref = traj_out->vel;
+    out->acc_ref = traj_out->acc;
+
+    DECL_PID_PTRS_PREFIX(&foc->lo.pos_pid, pos_pid);
+    foc_tune_pid_run(foc, FOC_TUNE_PID_POS, pos_pid, out->pos_ref, in->theta.pos_rad);
+    vel_ref = out->vel_ref + pos_pid_out->val;
+  }
+
+  // the velocity loop is swept at the loop rate, the same way as the current loop
+  DECL_FRA_PTRS_PREFIX(&foc->lo.fra, fra);
+  foc_fra_e e_fra = foc_is_shed(foc, FOC_DEGRADE_TELEMETRY) ? FOC_FRA_NULL : lo->e_fra;
+  if (e_fra == FOC_FRA_VEL)
+    vel_ref += fra_out->stim;
+
+  // the trajectory acceleration and any known load go straight to torque
+  DECL_PID_PTRS_PREFIX(&foc->lo.vel_pid, vel_pid);
+  foc_tune_pid_run(foc, FOC_TUNE_PID_VEL, vel_pid, vel_ref, vel);
+  FP32 torque = vel_pid_out->val + cfg->motor.j * out->acc_ref + out->torque_ff;
+
+  if (e_fra == FOC_FRA_VEL) {
+    fra_run_in(fra_p, vel_ref, vel);
+  } else if (e_fra == FOC_FRA_TORQUE) {
+    torque += fra_out->stim;
+    fra_run_in(fra_p, torque, -vel_pid_out->val);
+  }
+  CLAMP(torque, -cfg->loop.torque_max, cfg->loop.torque_max);
+
+  if (lo->mtpa.cfg.tbl)
+    out->torque_ref = torque;
+  else
+    out->i_dq.q = (kt > FP32_0) ? torque / kt : FP32_0;
+}
+
+/*
+ * FAIL when the sweep is rejected or a velocity loop sweep is asked for without one running.
+ */
+static inline ret_e
+foc_fra_start(foc_t *foc, foc_fra_e e_fra, fra_cfg_t fra_cfg) {
+  DECL_FOC_PTRS(foc);
+
+  BOOL is_outer = (e_fra == FOC_FRA_VEL || e_fra == FOC_FRA_TORQUE);
+  if (is_outer && lo->e_loop == FOC_LOOP_CUR)
+    return FAIL;
+
+  fra_cfg.freq_hz      = is_outer ? cfg->freq_hz / (FP32)(cfg->loop.div ? cfg->loop.div : 1U)
+                                  : cfg->freq_hz;
+  fra_cfg.is_open_loop = (e_fra == FOC_FRA_VD || e_fra == FOC_FRA_VQ || e_fra == FOC_FRA_TORQUE);
+  if (fra_init(&lo->fra, fra_cfg) != OK)
+    return FAIL;
+
+  fra_start(&lo->fra);
+  lo->e_fra = e_fra;
+  lo->fra_start_cnt++;
+  return OK;
 }
 
 static inline void
@@ -201,8 +1279,10 @@ foc_ready(foc_t *foc) {
   if (cfg->is_adc_cail)
     return;
 
-  in->adc_raw = ops->f_adc_get();
-  UVW_ADD_UVW(cfg->periph.adc_offset.i32_i_uvw, in->adc_raw.i32_i_uvw);
+  // foc_run has read this period already
+  cfg->periph.adc_offset.i32_i_uvw.u += (I32)(lo->adc_val[0] + FP32_1_DIV_2);
+  cfg->periph.adc_offset.i32_i_uvw.v += (I32)(lo->adc_val[1] + FP32_1_DIV_2);
+  cfg->periph.adc_offset.i32_i_uvw.w += (I32)(lo->adc_val[2] + FP32_1_DIV_2);
   if (++lo->adc_cail_cnt >= LF(cfg->periph.adc_cail_cnt_max)) {
     SELF_RF(cfg->periph.adc_offset.i32_i_uvw.u, cfg->periph.adc_cail_cnt_max);
     SELF_RF(cfg->periph.adc_offset.i32_i_uvw.v, cfg->periph.adc_cail_cnt_max);
@@ -223,30 +1303,76 @@ foc_disable(foc_t *foc) {
   DECL_FOC_PTRS(foc);
 
   ops->f_drv_set(FALSE);
+  deadbeat_reset(&lo->deadbeat);
+}
+
+static inline foc_pwm_edge_e
+foc_pwm_load_edge(foc_t *foc) {
+  DECL_FOC_PTRS(foc);
+
+  if (!cfg->periph.is_double_update)
+    return FOC_PWM_EDGE_VALLEY;
+  return (in->pwm_edge == FOC_PWM_EDGE_VALLEY) ? FOC_PWM_EDGE_PEAK : FOC_PWM_EDGE_VALLEY;
 }
 
 static inline void
-foc_run(foc_t *foc) {
+foc_ctrl_run(foc_t *foc) {
   DECL_FOC_PTRS(foc);
 
   lo->exec_cnt++;
 
-  in->adc_raw = ops->f_adc_get();
-  UVW_SUB_UVW(in->adc_raw.i32_i_uvw, cfg->periph.adc_offset.i32_i_uvw);
-  UVW_MUL_3ARG(in->fp32_i_uvw, in->adc_raw.i32_i_uvw, cfg->periph.adc2cur);
+  if (!cfg->periph.is_double_update)
+    in->pwm_edge = FOC_PWM_EDGE_VALLEY;
+  else if (ops->f_pwm_edge_get)
+    in->pwm_edge = ops->f_pwm_edge_get();
+  else
+    in->pwm_edge = (lo->exec_cnt & 1U) ? FOC_PWM_EDGE_VALLEY : FOC_PWM_EDGE_PEAK;
+
+  foc_adc_read(foc);
+  foc_adc_drift(foc);
+
+  const adc_raw_t *offset = &cfg->periph.adc_offset;
+  FP32            *val    = lo->adc_val;
+  in->fp32_i_uvw.u = (val[0] - (FP32)offset->i32_i_uvw.u - lo->adc_drift.u) * cfg->periph.adc2cur;
+  in->fp32_i_uvw.v = (val[1] - (FP32)offset->i32_i_uvw.v - lo->adc_drift.v) * cfg->periph.adc2cur;
+  in->fp32_i_uvw.w = (val[2] - (FP32)offset->i32_i_uvw.w - lo->adc_drift.w) * cfg->periph.adc2cur;
+  foc_shunt_rebuild(foc);
+  in->v_bus = val[FOC_ADC_CH_NUM - 1U] * cfg->periph.adc2vbus;
+  foc_fault_run(foc);
+
+  FP32 mech_prev_rad       = in->theta.mech_theta_rad;
+  in->theta.mech_theta_rad = ops->f_theta_get();
+  if (lo->enc_tbl.cfg.num) {
+    in->theta.mech_theta_rad -= angle_tbl_run_in(&lo->enc_tbl, in->theta.mech_theta_rad);
+    WARP_2PI(in->theta.mech_theta_rad);
+  }
+
+  FP32 mech_step = in->theta.mech_theta_rad - mech_prev_rad;
+  WARP_PI(mech_step);
+  in->theta.pos_rad += mech_step;
+  if (!foc_is_shed(foc, FOC_DEGRADE_TELEMETRY))
+    foc_cali_run(foc);
 
-  in->theta.mech_theta_rad   = ops->f_theta_get();
   in->theta.sensor_theta_rad = MECH_TO_ELEC(in->theta.mech_theta_rad, cfg->motor.npp);
   WARP_2PI(in->theta.sensor_theta_rad);
 
-  DECL_VEL_PLL_PTRS_PREFIX(&foc->lo.vel_pll, vel_pll)
-  vel_pll_run_in(vel_pll_p, in->theta.sensor_theta_rad);
-  in->theta.sensor_vel_rads = vel_pll_out->vel_rads_filter;
+  if (lo->e_vel == FOC_VEL_KF) {
+    DECL_VEL_KF_PTRS_PREFIX(&foc->lo.vel_kf, vel_kf);
+    vel_kf_run_in(vel_kf_p, in->theta.sensor_theta_rad);
+    in->theta.sensor_vel_rads = vel_kf_out->vel_rads;
+  } else {
+    DECL_VEL_PLL_PTRS_PREFIX(&foc->lo.vel_pll, vel_pll)
+    vel_pll_run_in(vel_pll_p, in->theta.sensor_theta_rad);
+    in->theta.sensor_vel_rads = vel_pll_out->vel_rads_filter;
+  }
 
-  DECL_SMO_PTRS_PREFIX(&foc->lo.smo, smo);
-  smo_run_in(smo_p, in->i_ab, out->v_ab);
-  in->theta.obs_theta_rad = smo_out->theta_rad;
-  in->theta.obs_vel_rads  = smo_out->vel_rads;
+  BOOL is_obs = (lo->e_theta == FOC_THETA_SENSORLESS || lo->e_theta == FOC_THETA_SENSORFUSION);
+  if (is_obs || !foc_is_shed(foc, FOC_DEGRADE_OBSERVER)) {
+    DECL_SMO_PTRS_PREFIX(&foc->lo.smo, smo);
+    smo_run_in(smo_p, in->i_ab, out->v_ab);
+    in->theta.obs_theta_rad = smo_out->theta_rad;
+    in->theta.obs_vel_rads  = smo_out->vel_rads;
+  }
 
   switch (lo->e_theta) {
   case FOC_THETA_FORCE:
@@ -262,11 +1388,19 @@ foc_run(foc_t *foc) {
     in->theta.vel_rads  = in->theta.obs_vel_rads;
     break;
   case FOC_THETA_SENSORFUSION:
+    foc_theta_fusion(foc);
     break;
   default:
     break;
   }
 
+  // the current was sampled and the voltage will be applied at other instants than theta was read
+  FP32 theta_step              = in->theta.vel_rads * FP32_HZ_TO_S(cfg->freq_hz);
+  in->theta.park_theta_rad     = in->theta.theta_rad + theta_step * cfg->theta.park_delay;
+  in->theta.inv_park_theta_rad = in->theta.theta_rad + theta_step * cfg->theta.inv_park_delay;
+  WARP_2PI(in->theta.park_theta_rad);
+  WARP_2PI(in->theta.inv_park_theta_rad);
+
   switch (lo->e_state) {
   case FOC_STATE_READY:
     foc_ready(foc);
@@ -283,21 +1417,369 @@ foc_run(foc_t *foc) {
 
   // only FOC_STATE_ENABLE can run below code!!!
   in->i_ab = clarke(in->fp32_i_uvw, cfg->periph.modulation_ratio);
-  in->i_dq = park(in->i_ab, in->theta.theta_rad);
+  in->i_dq = park(in->i_ab, in->theta.park_theta_rad);
+
+  if (lo->e_loop != FOC_LOOP_CUR && ++lo->loop_cnt >= cfg->loop.div) {
+    lo->loop_cnt = 0;
+    foc_loop_run(foc);
+  }
+
+  // with a table loaded the current references follow torque_ref
+  if (lo->mtpa.cfg.tbl) {
+    DECL_MTPA_PTRS_PREFIX(&foc->lo.mtpa, mtpa);
+    mtpa_run_in(mtpa_p, out->torque_ref, in->theta.vel_rads, in->v_bus);
+    out->i_dq = mtpa_out->i_dq;
+  }
+
+  // a shed sweep is paused, the points measured across the pause are off
+  DECL_FRA_PTRS_PREFIX(&foc->lo.fra, fra);
+  foc_fra_e e_fra    = foc_is_shed(foc, FOC_DEGRADE_TELEMETRY) ? FOC_FRA_NULL : lo->e_fra;
+  BOOL      is_harm  = !foc_is_shed(foc, FOC_DEGRADE_HARMONIC);
+  fp32_dq_t i_dq_ref = out->i_dq;
+
+  // one vector for a whole period leaves nothing for a single shunt to sample, the pi loops run
+  // and out says so
+  BOOL      is_mpc_state = (lo->e_cur == FOC_CUR_MPC) && !lo->mpc.cfg.is_modulated;
+  foc_cur_e e_cur        = lo->e_cur;
+  out->is_cur_fallback   = is_mpc_state && cfg->periph.e_shunt == FOC_SHUNT_1;
+  if (out->is_cur_fallback) {
+    e_cur        = FOC_CUR_PI;
+    is_mpc_state = FALSE;
+  }
+
+  if (lo->iq_anf.cfg.notch_num && is_harm)
+    i_dq_ref.q = anf_run_in(&lo->iq_anf, i_dq_ref.q);
+  if (lo->cogging_tbl.cfg.num)
+    i_dq_ref.q += angle_tbl_run_in(&lo->cogging_tbl, in->theta.mech_theta_rad);
+
+  if (e_fra == FOC_FRA_ID_REF)
+    i_dq_ref.d += fra_out->stim;
+  else if (e_fra == FOC_FRA_IQ_REF)
+    i_dq_ref.q += fra_out->stim;
+
+  // the deadbeat history only holds while it owns the bridge
+  if (e_cur != FOC_CUR_DEADBEAT)
+    deadbeat_reset(&lo->deadbeat);
+
+  // the predictive controller picks the bridge state itself, svpwm has nothing to do
+  if (is_mpc_state) {
+    DECL_MPC_PTRS_PREFIX(&foc->lo.mpc, mpc);
+    mpc_run_in(
+        mpc_p, in->i_dq, i_dq_ref, in->theta.park_theta_rad, in->theta.vel_rads, in->v_bus);
+    out->v_dq = mpc_out->v_dq;
+    out->v_ab = mpc_out->v_ab;
+    UVW_MUL_3ARG(out->svpwm.u32_pwm_duty, mpc_out->state, cfg->periph.pwm_full_val);
 
-  DECL_PID_PTRS_PREFIX(&foc->lo.id_pid, id_pid);
-  pid_run_in(id_pid, out->i_dq.d, in->i_dq.d);
-  out->v_dq.d = id_pid_out->val;
+    if (e_fra == FOC_FRA_ID_REF)
+      fra_run_in(fra_p, i_dq_ref.d, in->i_dq.d);
+    else if (e_fra == FOC_FRA_IQ_REF)
+      fra_run_in(fra_p, i_dq_ref.q, in->i_dq.q);
 
-  DECL_PID_PTRS_PREFIX(&foc->lo.iq_pid, iq_pid);
-  pid_run_in(&foc->lo.iq_pid, out->i_dq.q, in->i_dq.q);
-  out->v_dq.q = iq_pid_out->val;
+    ops->f_pwm_set(cfg->periph.pwm_full_val, out->svpwm.u32_pwm_duty, foc_pwm_load_edge(foc));
+    return;
+  }
+
+  // v_fb is the feedback part of the output, what the open loop fra injection measures
+  fp32_dq_t v_fb;
+  if (e_cur == FOC_CUR_DEADBEAT) {
+    DECL_DEADBEAT_PTRS_PREFIX(&foc->lo.deadbeat, deadbeat);
+    deadbeat_run_in(deadbeat_p, in->i_dq, i_dq_ref, in->theta.vel_rads, in->v_bus);
+    v_fb = out->v_dq = deadbeat_out->v_dq;
+  } else if (e_cur == FOC_CUR_MPC) {
+    DECL_MPC_PTRS_PREFIX(&foc->lo.mpc, mpc);
+    mpc_run_in(
+        mpc_p, in->i_dq, i_dq_ref, in->theta.park_theta_rad, in->theta.vel_rads, in->v_bus);
+    v_fb = out->v_dq = mpc_out->v_dq;
+  } else {
+    DECL_PID_PTRS_PREFIX(&foc->lo.id_pid, id_pid);
+    foc_tune_pid_run(foc, FOC_TUNE_PID_ID, id_pid, i_dq_ref.d, in->i_dq.d);
+    v_fb.d = out->v_dq.d = id_pid_out->val;
+
+    DECL_PID_PTRS_PREFIX(&foc->lo.iq_pid, iq_pid);
+    foc_tune_pid_run(foc, FOC_TUNE_PID_IQ, iq_pid, i_dq_ref.q, in->i_dq.q);
+    v_fb.q = out->v_dq.q = iq_pid_out->val;
+
+    // a shed bank keeps its integrators for when it comes back
+    if (lo->cur_res.cfg.harm_num && is_harm) {
+      DECL_RES_PTRS_PREFIX(&foc->lo.cur_res, res);
+      fp32_dq_t err;
+      err.d = i_dq_ref.d - in->i_dq.d;
+      err.q = i_dq_ref.q - in->i_dq.q;
+      res_run_in(res_p, err, in->theta.park_theta_rad, in->theta.vel_rads);
+      v_fb.d = out->v_dq.d += res_out->val.d;
+      v_fb.q = out->v_dq.q += res_out->val.q;
+    }
+  }
+
+  // the pi loops are left with only the r-l dynamics, speed terms are fed forward
+  if (cfg->is_decouple && e_cur == FOC_CUR_PI) {
+    FP32 we        = in->theta.vel_rads;
+    out->v_dq_ff.d = -we * cfg->motor.lq * in->i_dq.q;
+    out->v_dq_ff.q = we * (cfg->motor.ld * in->i_dq.d + cfg->motor.flux);
+    out->v_dq.d += out->v_dq_ff.d;
+    out->v_dq.q += out->v_dq_ff.q;
+  }
 
-  out->v_ab      = inv_park(out->v_dq, in->theta.theta_rad);
-  out->v_ab_sv.a = out->v_ab.a / 48.0f;
-  out->v_ab_sv.b = out->v_ab.b / 48.0f;
+  switch (e_fra) {
+  case FOC_FRA_ID_REF:
+    fra_run_in(fra_p, i_dq_ref.d, in->i_dq.d);
+    break;
+  case FOC_FRA_IQ_REF:
+    fra_run_in(fra_p, i_dq_ref.q, in->i_dq.q);
+    break;
+  case FOC_FRA_VD:
+    out->v_dq.d += fra_out->stim;
+    fra_run_in(fra_p, out->v_dq.d, -v_fb.d);
+    break;
+  case FOC_FRA_VQ:
+    out->v_dq.q += fra_out->stim;
+    fra_run_in(fra_p, out->v_dq.q, -v_fb.q);
+    break;
+  default:
+    break;
+  }
+
+  FP32 v_bus_inv = (in->v_bus > FP32_1) ? FP32_1 / in->v_bus : FP32_0;
+  out->v_ab      = inv_park(out->v_dq, in->theta.inv_park_theta_rad);
+  out->v_ab_sv.a = out->v_ab.a * v_bus_inv;
+  out->v_ab_sv.b = out->v_ab.b * v_bus_inv;
   svpwm(foc);
-  ops->f_pwm_set(cfg->periph.pwm_full_val, out->svpwm.u32_pwm_duty);
+
+  out->i_ab       = inv_park(i_dq_ref, in->theta.inv_park_theta_rad);
+  out->fp32_i_uvw = inv_clarke(out->i_ab);
+  foc_dead_time_comp(foc);
+  foc_pwm_out(foc, foc_pwm_load_edge(foc));
+}
+
+/*
+ * An overrun sheds one more level at once, restore_cnt periods in a row under restore_ratio of the
+ * budget bring one back. Shedding is quick and restoring slow so a burst of load does not make the
+ * level oscillate.
+ */
+static inline void
+foc_budget_run(foc_t *foc, U32 elapsed) {
+  DECL_FOC_PTRS(foc);
+
+  foc_budget_t *b = &lo->budget;
+  lo->elapsed     = elapsed;
+  if (elapsed > b->elapsed_max)
+    b->elapsed_max = elapsed;
+
+  U32 bin = (U32)((U64)elapsed * 8U / b->budget);
+  if (bin >= FOC_BUDGET_HIST_NUM)
+    bin = FOC_BUDGET_HIST_NUM - 1U;
+  b->hist[bin]++;
+
+  if (elapsed > b->budget) {
+    b->overrun_cnt++;
+    b->headroom_cnt = 0;
+    if (b->e_degrade < cfg->budget.e_degrade_max) {
+      b->e_degrade = (foc_degrade_e)(b->e_degrade + 1);
+      b->shed_cnt++;
+    }
+    return;
+  }
+
+  if ((FP32)elapsed > cfg->budget.restore_ratio * (FP32)b->budget) {
+    b->headroom_cnt = 0;
+    return;
+  }
+
+  if (++b->headroom_cnt >= cfg->budget.restore_cnt && b->e_degrade > FOC_DEGRADE_NULL) {
+    b->e_degrade    = (foc_degrade_e)(b->e_degrade - 1);
+    b->headroom_cnt = 0;
+  }
+}
+
+static inline BOOL
+foc_tune_is_gain(FP32 x) {
+  return isfinite(x) && x >= FP32_0;
+}
+
+static inline BOOL
+foc_tune_is_limit(FP32 x) {
+  return isfinite(x) && x > FP32_0;
+}
+
+/*
+ * What a swap may change: gains, limits, delays, fault and budget settings. The motor, the outer
+ * loop divider and the kalman noise settings must be the ones running, freq_hz and periph are
+ * hardware and always taken from the running config. The park delays may be negative to trim a
+ * lead, the current loops run without kd, pid_swap_run_in() only keeps the kp and ki terms
+ * bumpless.
+ */
+static inline ret_e
+foc_tune_check(const foc_cfg_t *run, const foc_cfg_t *c, const pid_cfg_t *cur_pid) {
+  if (memcmp(&run->motor, &c->motor, sizeof(c->motor)))
+    return FAIL;
+
+  // the trajectory and the outer loop states count in loop ticks
+  const loop_param_t *l = &c->loop;
+  if (l->div != run->loop.div || !foc_tune_is_gain(l->vel_kp) || !foc_tune_is_gain(l->vel_ki)
+      || !foc_tune_is_gain(l->pos_kp) || !foc_tune_is_limit(l->torque_max)
+      || !foc_tune_is_limit(l->vel_max) || !foc_tune_is_limit(l->acc_max)
+      || !foc_tune_is_limit(l->jerk_max))
+    return FAIL;
+
+  const theta_param_t *t = &c->theta;
+  if (!isfinite(t->park_delay) || !isfinite(t->inv_park_delay)
+      || !foc_tune_is_gain(t->sensor_delay) || !foc_tune_is_gain(t->obs_delay)
+      || !(t->fusion_vel_min <= t->fusion_vel_max))
+    return FAIL;
+
+  // the steady kalman gain is solved in foc_init(), far too slow for a tick
+  if (t->kf_q != run->theta.kf_q || t->kf_r != run->theta.kf_r)
+    return FAIL;
+
+  const fault_param_t *f       = &c->fault;
+  const FP32           fault[] = {
+      f->cur_max, f->v_bus_max, f->v_bus_min, f->i2t_cur, f->i2t_max, f->cur_sum_max, f->loss_cur,
+      f->loss_ratio, f->loss_vel, f->stall_cur, f->stall_vel, f->track_err, f->time_s,
+  };
+  for (U32 i = 0; i < sizeof(fault) / sizeof(fault[0]); i++) {
+    if (!foc_tune_is_gain(fault[i]))
+      return FAIL;
+  }
+
+  const budget_param_t *b = &c->budget;
+  if (!(b->ratio >= FP32_0 && b->ratio <= FP32_1) || !(b->restore_ratio >= FP32_0)
+      || !(b->restore_ratio <= FP32_1) || b->e_degrade_max > FOC_DEGRADE_OBSERVER)
+    return FAIL;
+
+  if (cur_pid
+      && (!foc_tune_is_gain(cur_pid->kp) || !foc_tune_is_gain(cur_pid->ki)
+          || cur_pid->kd != FP32_0 || !foc_tune_is_limit(cur_pid->out_max)
+          || !foc_tune_is_gain(cur_pid->integral_max)))
+    return FAIL;
+
+  return OK;
+}
+
+/*
+ * Stage a config from any thread, it takes effect at the start of the next foc_run(). The set is
+ * checked and derived here, the loop only copies it. Two slots: a set the loop has not taken yet is
+ * taken back and overwritten, otherwise the other slot is used, so the one the loop may be copying
+ * is never touched. FAIL when the config is rejected or another thread is staging, nothing waits.
+ */
+static inline ret_e
+foc_tune_stage(foc_t *foc, const foc_cfg_t *tune_cfg, const pid_cfg_t *cur_pid) {
+  DECL_FOC_PTRS(foc);
+
+  foc_tune_t *t = &lo->tune;
+  if (__atomic_exchange_n(&t->busy, 1U, __ATOMIC_ACQUIRE)) {
+    __atomic_add_fetch(&t->reject_cnt, 1U, __ATOMIC_RELAXED);
+    return FAIL;
+  }
+
+  ret_e ret = foc_tune_check(cfg, tune_cfg, cur_pid);
+  if (ret == OK) {
+    foc_cfg_t c = *tune_cfg;
+    c.freq_hz   = cfg->freq_hz;
+    c.periph    = cfg->periph;
+
+    U32 idx = __atomic_exchange_n(&t->pending, 0U, __ATOMIC_ACQUIRE);
+    U32 s   = idx ? idx - 1U : t->last ^ 1U;
+    foc_tune_derive(&c, cur_pid, &t->set[s]);
+    t->last = s;
+    __atomic_store_n(&t->pending, s + 1U, __ATOMIC_RELEASE);
+  } else {
+    __atomic_add_fetch(&t->reject_cnt, 1U, __ATOMIC_RELAXED);
+  }
+
+  __atomic_store_n(&t->busy, 0U, __ATOMIC_RELEASE);
+  return ret;
+}
+
+/*
+ * Tick boundary side, a relaxed load when nothing is staged.
+ */
+static inline void
+foc_tune_apply(foc_t *foc) {
+  DECL_FOC_PTRS(foc);
+
+  foc_tune_t *t = &lo->tune;
+  if (!__atomic_load_n(&t->pending, __ATOMIC_RELAXED))
+    return;
+  U32 idx = __atomic_exchange_n(&t->pending, 0U, __ATOMIC_ACQUIRE);
+  if (!idx)
+    return;
+
+  // the offsets and the calibration flag are the loop's own
+  const foc_tune_set_t *set         = &t->set[idx - 1U];
+  periph_param_t        periph      = cfg->periph;
+  BOOL                  is_adc_cail = cfg->is_adc_cail;
+  *cfg                              = set->cfg;
+  cfg->periph                       = periph;
+  cfg->is_adc_cail                  = is_adc_cail;
+
+  // a loop that is not running takes its gains whenever it runs next
+  t->pid_next[FOC_TUNE_PID_ID]  = set->id_pid;
+  t->pid_next[FOC_TUNE_PID_IQ]  = set->iq_pid;
+  t->pid_next[FOC_TUNE_PID_VEL] = set->vel_pid;
+  t->pid_next[FOC_TUNE_PID_POS] = set->pos_pid;
+  t->pid_swap                   = LF(FOC_TUNE_PID_NUM) - 1U;
+  t->traj_next                  = set->traj;
+  t->is_traj_next               = TRUE;
+  foc_tune_traj_take(foc);
+
+  memcpy(lo->fault.max, set->fault_max, sizeof(lo->fault.max));
+  lo->budget.budget = set->budget;
+  t->apply_idx      = idx - 1U;
+  t->apply_cnt++;
+}
+
+/*
+ * The record is filled on the stack and copied under the lock, the lock is odd for the copy only.
+ */
+static inline void
+foc_snap_publish(foc_t *foc) {
+  DECL_FOC_PTRS(foc);
+
+  foc_snap_t snap;
+  snap.exec_cnt   = lo->exec_cnt;
+  snap.e_state    = lo->e_state;
+  snap.e_degrade  = lo->budget.e_degrade;
+  snap.stat       = lo->stat.word;
+  snap.elapsed    = lo->elapsed;
+  snap.theta_rad  = in->theta.theta_rad;
+  snap.vel_rads   = in->theta.vel_rads;
+  snap.pos_rad    = in->theta.pos_rad;
+  snap.v_bus      = in->v_bus;
+  snap.i_dq       = in->i_dq;
+  snap.v_dq       = out->v_dq;
+  snap.i_dq_ref   = out->i_dq;
+  snap.torque_ref = out->torque_ref;
+  seqlock_write(&lo->snap_lock, &lo->snap, &snap, sizeof(snap));
+}
+
+/*
+ * One control period, timed against the budget when f_ts_get is given.
+ */
+static inline void
+foc_run(foc_t *foc) {
+  DECL_FOC_PTRS(foc);
+
+  foc_tune_apply(foc);
+  if (!ops->f_ts_get || !lo->budget.budget) {
+    foc_ctrl_run(foc);
+  } else {
+    U32 begin = ops->f_ts_get();
+    foc_ctrl_run(foc);
+    foc_budget_run(foc, ops->f_ts_get() - begin);
+  }
+
+  // shed with the rest of the telemetry, still often enough for a reader to see the level
+  if (!foc_is_shed(foc, FOC_DEGRADE_TELEMETRY) || !(lo->exec_cnt % FOC_SNAP_SHED_DIV))
+    foc_snap_publish(foc);
+}
+
+/*
+ * Consistent copy of the last published period, from any thread or core that does not preempt
+ * foc_run(). Returns the number of retries, the writer is never held up.
+ */
+static inline U32
+foc_snap_get(const foc_t *foc, foc_snap_t *snap) {
+  return seqlock_read(&foc->lo.snap_lock, snap, &foc->lo.snap, sizeof(*snap));
 }
 
 #ifdef __cplusplus
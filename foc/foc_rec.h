@@ -0,0 +1,627 @@
+#ifndef FOC_REC_H
+#define FOC_REC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+
+#include "fifo/spsc.h"
+#include "foc/foc.h"
+#include "util/errdef.h"
+#include "util/util.h"
+
+/*
+ * Record and replay of foc_run() inputs.
+ * foc_rec_start() writes the whole foc_t as the file header and puts shims in front of foc_ops_t.
+ * The input shims keep what the real ops returned this tick (adc sample or block, angle, pwm edge,
+ * timer reads), the output shims fold every pwm / driver / trigger call into a hash and pass it on.
+ * foc_rec_tick() runs one period and pushes the frame into a ring without waiting, a full ring
+ * drops the frame and counts it, foc_rec_flush() drains the ring to f_write from the background.
+ * The ring is a fifo/spsc.h one, so the flush may run on another core or thread than the tick.
+ * Setpoints and modes written between ticks are found by comparing against what foc_run() left
+ * behind, so only external changes are stored. A fra sweep started and a tune set swapped in are
+ * stored with the tick they take effect on.
+ *
+ * Frames are byte packed: adc channels as zigzag varints, each block sample as the difference to
+ * the one before, timer reads as the first value and the elapsed count. The seq in a frame is its
+ * low 8 bits, enough to count up to 255 frames lost in a row.
+ *
+ * foc_replay_open() loads the header into a foc_t, foc_replay_step() serves one frame back through
+ * the same ops and compares the output hash. Pointers in the header (mtpa table, fir taps) are not
+ * valid in another process and must be attached again before stepping. Calls that rebuild internal
+ * state between ticks other than the ones above (calibration, fault clear) are not captured and
+ * show up as a mismatch.
+ * The shims have no context argument like the ops themselves, so one recorder or replayer is
+ * active at a time through foc_rec_cur. Exactly one translation unit defines FOC_REC_IMPL before
+ * including this header and holds it.
+ */
+
+#define FOC_REC_MAGIC     (0x43455246U) // "FREC"
+#define FOC_REC_VERSION   (1U)
+#define FOC_REC_BLOCK_MAX (32U)
+
+#define FOC_REC_VAR_MAX   (5U) // 32 位变长编码最多字节数
+
+#define FOC_REC_ADC   (1U << 0)
+#define FOC_REC_BLOCK (1U << 1)
+#define FOC_REC_EDGE  (1U << 2)
+#define FOC_REC_TS    (1U << 3)
+#define FOC_REC_CTRL  (1U << 4)
+#define FOC_REC_FRA   (1U << 5)
+#define FOC_REC_TUNE  (1U << 6)
+
+typedef struct {
+  U32 magic;
+  U32 version;
+  U32 foc_size; // 其后紧跟 foc_t
+  U32 rsvd;
+} foc_rec_hdr_t;
+
+/* 帧内依次为 frame 头, flags 对应的字段, 输出哈希, 按字节紧排 */
+typedef struct {
+  U16 len; // 整帧字节数
+  U8  flags;
+  U8  seq; // 帧序号低 8 位
+} foc_rec_frame_t;
+
+/* 节拍之间可由外部修改的给定和模式 */
+typedef struct {
+  U32       e_state, e_theta, e_vel, e_cur, e_loop, e_fra;
+  fp32_dq_t i_dq;
+  FP32      torque_ref, torque_ff, vel_ref;
+  FP32      pos_end; // foc_move() 目标
+  FP32      force_theta_rad, force_vel_rads;
+} foc_rec_ctrl_t;
+
+/* foc_fra_start() 的参数 */
+typedef struct {
+  U32       e_fra;
+  fra_cfg_t cfg;
+} foc_rec_fra_t;
+
+#define FOC_REC_FRAME_MAX                                                                          \
+  (sizeof(foc_rec_frame_t) + FOC_REC_VAR_MAX * (FOC_ADC_CH_NUM * (FOC_REC_BLOCK_MAX + 1U) + 4U)    \
+   + 2U * sizeof(U32) + sizeof(foc_rec_ctrl_t) + sizeof(foc_rec_fra_t) + sizeof(foc_tune_set_t))
+
+typedef void (*foc_rec_write_f)(const void *buf, U32 len);
+typedef U32 (*foc_rec_read_f)(void *buf, U32 len);
+
+typedef struct {
+  foc_rec_write_f f_write; // 录制, 后台写文件
+  foc_rec_read_f  f_read;  // 回放, 读文件, 返回字节数
+} foc_rec_ops_t;
+
+typedef struct {
+  U8 *ring_buf; // 录制环形缓冲, 2 的幂
+  U32 ring_size;
+} foc_rec_cfg_t;
+
+typedef struct {
+  foc_t *foc;
+} foc_rec_in_t;
+
+typedef struct {
+  U32 seq;           // 已录制或回放的帧数
+  U32 drop_cnt;      // 缓冲满丢弃的帧数
+  U32 ctrl_cnt;      // 含给定变化的帧数
+  U64 bytes;         // 录制或回放的字节数
+  U32 mismatch_cnt;  // 回放输出不一致的帧数
+  U32 mismatch_seq;  // 第一次不一致的帧
+  U32 gap_cnt;       // 回放发现的丢帧
+} foc_rec_out_t;
+
+typedef struct {
+  foc_ops_t      ops;  // 被替换的原 ops, 录制时转发
+  spsc_t         ring;
+  foc_rec_ctrl_t ctrl;          // 上次 foc_run() 之后的给定
+  U32            fra_start_cnt; // 已录制的 foc_fra_start() 次数
+
+  /* 本节拍的输入 */
+  U32       flags;
+  adc_raw_t adc_raw;
+  adc_raw_t block[FOC_REC_BLOCK_MAX];
+  U32       block_num;
+  FP32      theta;
+  U32       edge;
+  U32       ts[2];
+  U32       ts_num;
+  U32       hash;
+
+  U8 frame[FOC_REC_FRAME_MAX];
+} foc_rec_lo_t;
+
+typedef struct {
+  foc_rec_cfg_t cfg;
+  foc_rec_in_t  in;
+  foc_rec_out_t out;
+  foc_rec_lo_t  lo;
+  foc_rec_ops_t ops;
+} foc_rec_t;
+
+#define DECL_FOC_REC_PTRS(rec)                                                                     \
+  foc_rec_t     *p   = (rec);                                                                      \
+  foc_rec_cfg_t *cfg = &p->cfg;                                                                    \
+  foc_rec_in_t  *in  = &p->in;                                                                     \
+  foc_rec_out_t *out = &p->out;                                                                    \
+  foc_rec_lo_t  *lo  = &p->lo;                                                                     \
+  foc_rec_ops_t *ops = &p->ops;
+
+#define DECL_FOC_REC_PTRS_PREFIX(rec, prefix)                                                      \
+  foc_rec_t     *prefix##_p   = (rec);                                                             \
+  foc_rec_cfg_t *prefix##_cfg = &prefix##_p->cfg;                                                  \
+  foc_rec_in_t  *prefix##_in  = &prefix##_p->in;                                                   \
+  foc_rec_out_t *prefix##_out = &prefix##_p->out;                                                  \
+  foc_rec_lo_t  *prefix##_lo  = &prefix##_p->lo;                                                   \
+  foc_rec_ops_t *prefix##_ops = &prefix##_p->ops;
+
+extern foc_rec_t *foc_rec_cur;
+
+#ifdef FOC_REC_IMPL
+foc_rec_t *foc_rec_cur;
+#endif
+
+/*
+ * FNV-1a over 32 bit words.
+ */
+static inline U32
+foc_rec_hash(U32 hash, const U32 *word, U32 num) {
+  for (U32 i = 0; i < num; i++) {
+    hash ^= word[i];
+    hash *= 16777619U;
+  }
+  return hash;
+}
+
+static inline U8 *
+foc_rec_var_put(U8 *w, U32 val) {
+  while (val >= 0x80U) {
+    *w++ = (U8)(val | 0x80U);
+    val >>= 7;
+  }
+  *w++ = (U8)val;
+  return w;
+}
+
+static inline const U8 *
+foc_rec_var_get(const U8 *r, U32 *val) {
+  U32 v = 0;
+  for (U32 sh = 0; sh < 7U * FOC_REC_VAR_MAX; sh += 7U) {
+    U8 b = *r++;
+    v |= (U32)(b & 0x7FU) << sh;
+    if (!(b & 0x80U))
+      break;
+  }
+  *val = v;
+  return r;
+}
+
+/*
+ * Small differences of either sign to small codes, 0, -1, 1, -2 ... to 0, 1, 2, 3 ...
+ */
+static inline U32
+foc_rec_zz(U32 diff) {
+  return (diff << 1) ^ (0U - (diff >> 31));
+}
+
+static inline U32
+foc_rec_unzz(U32 code) {
+  return (code >> 1) ^ (0U - (code & 1U));
+}
+
+/* 每个通道相对 ref 的差值 */
+
+static inline U8 *
+foc_rec_adc_put(U8 *w, const adc_raw_t *adc_raw, const adc_raw_t *ref) {
+  const I32 *ch = (const I32 *)adc_raw, *ref_ch = (const I32 *)ref;
+  for (U32 i = 0; i < FOC_ADC_CH_NUM; i++)
+    w = foc_rec_var_put(w, foc_rec_zz((U32)ch[i] - (U32)ref_ch[i]));
+  return w;
+}
+
+static inline const U8 *
+foc_rec_adc_read(const U8 *r, adc_raw_t *adc_raw, const adc_raw_t *ref) {
+  I32       *ch     = (I32 *)adc_raw;
+  const I32 *ref_ch = (const I32 *)ref;
+  for (U32 i = 0; i < FOC_ADC_CH_NUM; i++) {
+    U32 code;
+    r     = foc_rec_var_get(r, &code);
+    ch[i] = (I32)((U32)ref_ch[i] + foc_rec_unzz(code));
+  }
+  return r;
+}
+
+static inline void
+foc_rec_ctrl_get(const foc_t *foc, foc_rec_ctrl_t *ctrl) {
+  memset(ctrl, 0, sizeof(*ctrl));
+  ctrl->e_state         = (U32)foc->lo.e_state;
+  ctrl->e_theta         = (U32)foc->lo.e_theta;
+  ctrl->e_vel           = (U32)foc->lo.e_vel;
+  ctrl->e_cur           = (U32)foc->lo.e_cur;
+  ctrl->e_loop          = (U32)foc->lo.e_loop;
+  ctrl->e_fra           = (U32)foc->lo.e_fra;
+  ctrl->i_dq            = foc->out.i_dq;
+  ctrl->torque_ref      = foc->out.torque_ref;
+  ctrl->torque_ff       = foc->out.torque_ff;
+  ctrl->vel_ref         = foc->out.vel_ref;
+  ctrl->pos_end         = foc->lo.traj.in.pos_end;
+  ctrl->force_theta_rad = foc->in.theta.force_theta_rad;
+  ctrl->force_vel_rads  = foc->in.theta.force_vel_rads;
+}
+
+/*
+ * The mode calls first, they move setpoints, then the plain fields so the stored values win.
+ */
+static inline void
+foc_rec_ctrl_set(foc_t *foc, const foc_rec_ctrl_t *ctrl) {
+  if (ctrl->e_loop != (U32)foc->lo.e_loop)
+    foc_loop_set(foc, (foc_loop_e)ctrl->e_loop);
+  if (ctrl->pos_end != foc->lo.traj.in.pos_end)
+    foc_move(foc, ctrl->pos_end);
+
+  foc->lo.e_state               = (foc_state_e)ctrl->e_state;
+  foc->lo.e_theta               = (foc_theta_e)ctrl->e_theta;
+  foc->lo.e_vel                 = (foc_vel_e)ctrl->e_vel;
+  foc->lo.e_cur                 = (foc_cur_e)ctrl->e_cur;
+  foc->lo.e_fra                 = (foc_fra_e)ctrl->e_fra;
+  foc->out.i_dq                 = ctrl->i_dq;
+  foc->out.torque_ref           = ctrl->torque_ref;
+  foc->out.torque_ff            = ctrl->torque_ff;
+  foc->out.vel_ref              = ctrl->vel_ref;
+  foc->in.theta.force_theta_rad = ctrl->force_theta_rad;
+  foc->in.theta.force_vel_rads  = ctrl->force_vel_rads;
+}
+
+/* 录制时调用原 ops, 回放时返回帧内数据 */
+
+static inline adc_raw_t
+foc_rec_adc_get(void) {
+  foc_rec_lo_t *lo = &foc_rec_cur->lo;
+  if (lo->ops.f_adc_get)
+    lo->adc_raw = lo->ops.f_adc_get();
+  lo->flags |= FOC_REC_ADC;
+  return lo->adc_raw;
+}
+
+static inline U32
+foc_rec_adc_block_get(const adc_raw_t **adc_raw) {
+  foc_rec_lo_t *lo = &foc_rec_cur->lo;
+  if (lo->ops.f_adc_block_get) {
+    const adc_raw_t *buf = NULL;
+    U32              num = lo->ops.f_adc_block_get(&buf);
+    lo->block_num        = MIN(num, FOC_REC_BLOCK_MAX);
+    memcpy(lo->block, buf, lo->block_num * sizeof(adc_raw_t));
+  }
+  lo->flags |= FOC_REC_BLOCK;
+  *adc_raw = lo->block;
+  return lo->block_num;
+}
+
+static inline FP32
+foc_rec_theta_get(void) {
+  foc_rec_lo_t *lo = &foc_rec_cur->lo;
+  if (lo->ops.f_theta_get)
+    lo->theta = lo->ops.f_theta_get();
+  return lo->theta;
+}
+
+static inline foc_pwm_edge_e
+foc_rec_pwm_edge_get(void) {
+  foc_rec_lo_t *lo = &foc_rec_cur->lo;
+  if (lo->ops.f_pwm_edge_get)
+    lo->edge = (U32)lo->ops.f_pwm_edge_get();
+  lo->flags |= FOC_REC_EDGE;
+  return (foc_pwm_edge_e)lo->edge;
+}
+
+static inline U32
+foc_rec_ts_get(void) {
+  foc_rec_lo_t *lo = &foc_rec_cur->lo;
+  U32           i  = MIN(lo->ts_num, 1U);
+  if (lo->ops.f_ts_get)
+    lo->ts[i] = lo->ops.f_ts_get();
+  lo->ts_num++;
+  lo->flags |= FOC_REC_TS;
+  return lo->ts[i];
+}
+
+static inline void
+foc_rec_pwm_set(U32 pwm_full_val, u32_uvw_t u32_pwm_duty, foc_pwm_edge_e edge) {
+  foc_rec_lo_t *lo      = &foc_rec_cur->lo;
+  U32           word[5] = {pwm_full_val, u32_pwm_duty.u, u32_pwm_duty.v, u32_pwm_duty.w, edge};
+  lo->hash              = foc_rec_hash(lo->hash, word, 5U);
+  if (lo->ops.f_pwm_set)
+    lo->ops.f_pwm_set(pwm_full_val, u32_pwm_duty, edge);
+}
+
+static inline void
+foc_rec_drv_set(U8 enable) {
+  foc_rec_lo_t *lo   = &foc_rec_cur->lo;
+  U32           word = 0x100U | enable;
+  lo->hash           = foc_rec_hash(lo->hash, &word, 1U);
+  if (lo->ops.f_drv_set)
+    lo->ops.f_drv_set(enable);
+}
+
+static inline void
+foc_rec_adc_trig_set(const U32 *u32_adc_trig, U32 num) {
+  foc_rec_lo_t *lo = &foc_rec_cur->lo;
+  lo->hash         = foc_rec_hash(lo->hash, u32_adc_trig, num);
+  if (lo->ops.f_adc_trig_set)
+    lo->ops.f_adc_trig_set(u32_adc_trig, num);
+}
+
+/*
+ * Shims in front of every op the foc had, orig is what they forward to, all NULL for replay.
+ */
+static inline void
+foc_rec_ops_hook(foc_rec_t *rec, foc_t *foc, const foc_ops_t *orig) {
+  DECL_FOC_REC_PTRS(rec);
+
+  foc_ops_t *f = &foc->ops;
+  lo->ops      = *orig;
+  in->foc      = foc;
+  foc_rec_cur  = rec;
+
+  f->f_adc_get       = foc_rec_adc_get;
+  f->f_adc_block_get = foc->ops.f_adc_block_get ? foc_rec_adc_block_get : NULL;
+  f->f_theta_get     = foc_rec_theta_get;
+  f->f_pwm_set       = foc_rec_pwm_set;
+  f->f_drv_set       = foc_rec_drv_set;
+  f->f_pwm_edge_get  = foc->ops.f_pwm_edge_get ? foc_rec_pwm_edge_get : NULL;
+  f->f_adc_trig_set  = foc_rec_adc_trig_set;
+  f->f_ts_get        = foc->ops.f_ts_get ? foc_rec_ts_get : NULL;
+}
+
+static inline void
+foc_rec_tick_begin(foc_rec_t *rec) {
+  DECL_FOC_REC_PTRS(rec);
+
+  lo->flags  = 0;
+  lo->ts_num = 0;
+  lo->hash   = 2166136261U;
+}
+
+static inline ret_e
+foc_rec_start(foc_rec_t *rec, foc_rec_cfg_t rec_cfg, foc_t *foc) {
+  DECL_FOC_REC_PTRS(rec);
+
+  *cfg = rec_cfg;
+  if (!ops->f_write || spsc_init(&lo->ring, cfg->ring_buf, cfg->ring_size) != OK)
+    return FAIL;
+
+  memset(out, 0, sizeof(*out));
+
+  foc_rec_hdr_t hdr = {FOC_REC_MAGIC, FOC_REC_VERSION, sizeof(foc_t), 0U};
+  ops->f_write(&hdr, sizeof(hdr));
+  ops->f_write(foc, sizeof(*foc));
+  out->bytes = sizeof(hdr) + sizeof(*foc);
+
+  foc_ops_t orig = foc->ops;
+  foc_rec_ops_hook(rec, foc, &orig);
+  foc_rec_ctrl_get(foc, &lo->ctrl);
+  lo->fra_start_cnt = foc->lo.fra_start_cnt;
+  return OK;
+}
+
+/*
+ * Put the original ops back, the ring still has to be flushed.
+ */
+static inline void
+foc_rec_stop(foc_rec_t *rec) {
+  DECL_FOC_REC_PTRS(rec);
+
+  in->foc->ops = lo->ops;
+  foc_rec_cur  = NULL;
+}
+
+static inline void
+foc_rec_tick(foc_rec_t *rec) {
+  DECL_FOC_REC_PTRS(rec);
+
+  foc_t *foc = in->foc;
+  foc_rec_tick_begin(rec);
+
+  foc_rec_ctrl_t ctrl;
+  foc_rec_ctrl_get(foc, &ctrl);
+  BOOL is_ctrl = (memcmp(&ctrl, &lo->ctrl, sizeof(ctrl)) != 0);
+
+  // a sweep started since the last tick, its config is what foc_fra_start() was given
+  foc_rec_fra_t fra;
+  BOOL          is_fra = (foc->lo.fra_start_cnt != lo->fra_start_cnt);
+  if (is_fra) {
+    fra.e_fra         = (U32)foc->lo.e_fra;
+    fra.cfg           = foc->lo.fra.cfg;
+    lo->fra_start_cnt = foc->lo.fra_start_cnt;
+  }
+  U32 apply_cnt = foc->lo.tune.apply_cnt;
+
+  foc_run(foc);
+
+  static const adc_raw_t zero = {0};
+
+  U8              *w     = lo->frame + sizeof(foc_rec_frame_t);
+  foc_rec_frame_t *frame = (foc_rec_frame_t *)lo->frame;
+  if (lo->flags & FOC_REC_ADC)
+    w = foc_rec_adc_put(w, &lo->adc_raw, &zero);
+  if (lo->flags & FOC_REC_BLOCK) {
+    w = foc_rec_var_put(w, lo->block_num);
+    for (U32 i = 0; i < lo->block_num; i++)
+      w = foc_rec_adc_put(w, &lo->block[i], i ? &lo->block[i - 1U] : &zero);
+  }
+  memcpy(w, &lo->theta, sizeof(FP32));
+  w += sizeof(FP32);
+  if (lo->flags & FOC_REC_EDGE)
+    w = foc_rec_var_put(w, lo->edge);
+  if (lo->flags & FOC_REC_TS) {
+    w = foc_rec_var_put(w, lo->ts[0]);
+    w = foc_rec_var_put(w, foc_rec_zz(lo->ts[1] - lo->ts[0]));
+  }
+  if (is_ctrl) {
+    lo->flags |= FOC_REC_CTRL;
+    memcpy(w, &ctrl, sizeof(ctrl));
+    w += sizeof(ctrl);
+    out->ctrl_cnt++;
+  }
+  if (is_fra) {
+    lo->flags |= FOC_REC_FRA;
+    memcpy(w, &fra, sizeof(fra));
+    w += sizeof(fra);
+  }
+  // the slot just swapped in is not written again until the loop takes the next one
+  if (foc->lo.tune.apply_cnt != apply_cnt) {
+    lo->flags |= FOC_REC_TUNE;
+    memcpy(w, &foc->lo.tune.set[foc->lo.tune.apply_idx], sizeof(foc_tune_set_t));
+    w += sizeof(foc_tune_set_t);
+  }
+  memcpy(w, &lo->hash, sizeof(U32));
+  w += sizeof(U32);
+
+  frame->len   = (U16)(w - lo->frame);
+  frame->flags = (U8)lo->flags;
+  frame->seq   = (U8)out->seq++;
+  foc_rec_ctrl_get(foc, &lo->ctrl);
+
+  // never wait in the control context, a frame that does not fit is lost
+  if (!spsc_put(&lo->ring, lo->frame, frame->len))
+    out->drop_cnt++;
+}
+
+/*
+ * Background side of the ring, returns the bytes written.
+ */
+static inline U32
+foc_rec_flush(foc_rec_t *rec) {
+  DECL_FOC_REC_PTRS(rec);
+
+  U8  buf[256];
+  U32 total = 0;
+  for (;;) {
+    U32 len = MIN(spsc_avail(&lo->ring, 1U), (U32)sizeof(buf));
+    if (!len)
+      break;
+    spsc_get(&lo->ring, buf, len);
+    ops->f_write(buf, len);
+    total += len;
+  }
+  out->bytes += total;
+  return total;
+}
+
+/*
+ * Load the recorded foc_t and hook the replay shims, the foc is ready to step once any tables it
+ * points to are attached again.
+ */
+static inline ret_e
+foc_replay_open(foc_rec_t *rec, foc_t *foc) {
+  DECL_FOC_REC_PTRS(rec);
+
+  foc_rec_hdr_t hdr;
+  if (!ops->f_read || ops->f_read(&hdr, sizeof(hdr)) != sizeof(hdr))
+    return FAIL;
+  if (hdr.magic != FOC_REC_MAGIC || hdr.version != FOC_REC_VERSION || hdr.foc_size != sizeof(foc_t))
+    return FAIL;
+  if (ops->f_read(foc, sizeof(*foc)) != sizeof(*foc))
+    return FAIL;
+
+  memset(out, 0, sizeof(*out));
+  out->bytes = sizeof(hdr) + sizeof(*foc);
+
+  foc_ops_t none;
+  memset(&none, 0, sizeof(none));
+  foc_rec_ops_hook(rec, foc, &none);
+  foc_rec_ctrl_get(foc, &lo->ctrl);
+  return OK;
+}
+
+/*
+ * One recorded period through foc_run(), FAIL at the end of the file.
+ */
+static inline ret_e
+foc_replay_step(foc_rec_t *rec) {
+  DECL_FOC_REC_PTRS(rec);
+
+  foc_rec_frame_t *frame = (foc_rec_frame_t *)lo->frame;
+  if (ops->f_read(frame, sizeof(*frame)) != sizeof(*frame))
+    return FAIL;
+  if (frame->len < sizeof(*frame) || frame->len > sizeof(lo->frame))
+    return FAIL;
+  U32 body = frame->len - sizeof(*frame);
+  if (ops->f_read(lo->frame + sizeof(*frame), body) != body)
+    return FAIL;
+
+  U8 gap = (U8)(frame->seq - (U8)out->seq);
+  out->gap_cnt += gap;
+  out->seq += gap + 1U;
+  out->bytes += frame->len;
+
+  static const adc_raw_t zero = {0};
+
+  const U8 *r   = lo->frame + sizeof(*frame);
+  const U8 *end = lo->frame + frame->len;
+  if (frame->flags & FOC_REC_ADC)
+    r = foc_rec_adc_read(r, &lo->adc_raw, &zero);
+  if (frame->flags & FOC_REC_BLOCK) {
+    r             = foc_rec_var_get(r, &lo->block_num);
+    lo->block_num = MIN(lo->block_num, FOC_REC_BLOCK_MAX);
+    for (U32 i = 0; i < lo->block_num; i++)
+      r = foc_rec_adc_read(r, &lo->block[i], i ? &lo->block[i - 1U] : &zero);
+  }
+  memcpy(&lo->theta, r, sizeof(FP32));
+  r += sizeof(FP32);
+  if (frame->flags & FOC_REC_EDGE)
+    r = foc_rec_var_get(r, &lo->edge);
+  if (frame->flags & FOC_REC_TS) {
+    U32 elapsed;
+    r         = foc_rec_var_get(r, &lo->ts[0]);
+    r         = foc_rec_var_get(r, &elapsed);
+    lo->ts[1] = lo->ts[0] + foc_rec_unzz(elapsed);
+  }
+  foc_rec_ctrl_t ctrl;
+  foc_rec_fra_t  fra;
+  if (frame->flags & FOC_REC_CTRL) {
+    memcpy(&ctrl, r, sizeof(ctrl));
+    r += sizeof(ctrl);
+  }
+  if (frame->flags & FOC_REC_FRA) {
+    memcpy(&fra, r, sizeof(fra));
+    r += sizeof(fra);
+  }
+  const U8 *tune = r;
+  if (frame->flags & FOC_REC_TUNE)
+    r += sizeof(foc_tune_set_t);
+  if (r + sizeof(U32) != end)
+    return FAIL;
+  U32 hash;
+  memcpy(&hash, r, sizeof(U32));
+
+  // the setpoints, then the sweep, the tune set is swapped in by foc_run() itself
+  foc_t *foc = in->foc;
+  if (frame->flags & FOC_REC_CTRL) {
+    foc_rec_ctrl_set(foc, &ctrl);
+    out->ctrl_cnt++;
+  }
+  if (frame->flags & FOC_REC_FRA)
+    foc_fra_start(foc, (foc_fra_e)fra.e_fra, fra.cfg);
+  if (frame->flags & FOC_REC_TUNE) {
+    memcpy(&foc->lo.tune.set[0], tune, sizeof(foc_tune_set_t));
+    __atomic_store_n(&foc->lo.tune.pending, 1U, __ATOMIC_RELEASE);
+  }
+
+  foc_rec_tick_begin(rec);
+  foc_run(foc);
+
+  if (lo->hash != hash) {
+    if (!out->mismatch_cnt)
+      out->mismatch_seq = out->seq - 1U;
+    out->mismatch_cnt++;
+  }
+  return OK;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // !FOC_REC_H
@@ -0,0 +1,148 @@
+#ifndef PMSM_H
+#define PMSM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+
+#include "transform/clarkepark.h"
+#include "util/mathdef.h"
+#include "util/typedef.h"
+
+/*
+ * Host-side PMSM plant for closing foc_t loops without hardware.
+ * dq electrical model plus a rigid rotor, forward Euler over sub_step steps per call.
+ * Input is the per-phase duty held for one PWM period, i.e. what foc_pwm_set_f delivers.
+ */
+
+typedef struct {
+  FP32          freq_hz;  // 调用频率, 一般等于 PWM 频率
+  U32           sub_step; // 每次调用的积分步数
+  motor_param_t motor;    // 转子惯量取 motor.j
+  FP32          b;        // 粘滞摩擦, N*m*s/rad
+  FP32          v_bus;       // 母线电压
+  FP32          dead_time_s; // 逆变器死区时间
+  FP32          v_drop;      // 开关管及二极管导通压降
+} pmsm_cfg_t;
+
+typedef struct {
+  fp32_uvw_t duty;
+  FP32       load_nm;
+} pmsm_in_t;
+
+typedef struct {
+  fp32_uvw_t i_uvw, v_uvw;
+  fp32_ab_t  i_ab, v_ab;
+  fp32_dq_t  i_dq, v_dq;
+  FP32       elec_theta_rad, elec_vel_rads;
+  FP32       mech_theta_rad, mech_vel_rads;
+  FP32       torque_nm;
+} pmsm_out_t;
+
+typedef struct {
+  FP32 dt;
+} pmsm_lo_t;
+
+typedef struct {
+  pmsm_cfg_t cfg;
+  pmsm_in_t  in;
+  pmsm_out_t out;
+  pmsm_lo_t  lo;
+} pmsm_t;
+
+#define DECL_PMSM_PTRS(pmsm)                                                                       \
+  pmsm_t     *p   = (pmsm);                                                                        \
+  pmsm_cfg_t *cfg = &p->cfg;                                                                       \
+  pmsm_in_t  *in  = &p->in;                                                                        \
+  pmsm_out_t *out = &p->out;                                                                       \
+  pmsm_lo_t  *lo  = &p->lo;
+
+#define DECL_PMSM_PTRS_PREFIX(pmsm, prefix)                                                        \
+  pmsm_t     *prefix##_p   = (pmsm);                                                               \
+  pmsm_cfg_t *prefix##_cfg = &prefix##_p->cfg;                                                     \
+  pmsm_in_t  *prefix##_in  = &prefix##_p->in;                                                      \
+  pmsm_out_t *prefix##_out = &prefix##_p->out;                                                     \
+  pmsm_lo_t  *prefix##_lo  = &prefix##_p->lo;
+
+static inline void
+pmsm_init(pmsm_t *pmsm, pmsm_cfg_t pmsm_cfg) {
+  DECL_PMSM_PTRS(pmsm);
+
+  *cfg = pmsm_cfg;
+  if (cfg->sub_step == 0)
+    cfg->sub_step = 1;
+
+  memset(in, 0, sizeof(*in));
+  memset(out, 0, sizeof(*out));
+
+  in->duty.u = in->duty.v = in->duty.w = FP32_1_DIV_2;
+  lo->dt                               = FP32_HZ_TO_S(cfg->freq_hz) / (FP32)cfg->sub_step;
+}
+
+static inline void
+pmsm_run(pmsm_t *pmsm) {
+  DECL_PMSM_PTRS(pmsm);
+
+  // a leg sourcing current loses its dead time and the device drop, a sinking one gains them
+  FP32       loss = cfg->dead_time_s * cfg->freq_hz + cfg->v_drop / cfg->v_bus;
+  fp32_uvw_t duty = in->duty;
+  duty.u -= (out->i_uvw.u > FP32_0) ? loss : -loss;
+  duty.v -= (out->i_uvw.v > FP32_0) ? loss : -loss;
+  duty.w -= (out->i_uvw.w > FP32_0) ? loss : -loss;
+
+  // pole voltages minus the star point
+  FP32 v_cm = (duty.u + duty.v + duty.w) / 3.0f;
+
+  out->v_uvw.u = (duty.u - v_cm) * cfg->v_bus;
+  out->v_uvw.v = (duty.v - v_cm) * cfg->v_bus;
+  out->v_uvw.w = (duty.w - v_cm) * cfg->v_bus;
+  out->v_ab    = clarke(out->v_uvw, FP32_2_DIV_3);
+
+  for (U32 i = 0; i < cfg->sub_step; i++) {
+    FP32 we = out->elec_vel_rads;
+
+    out->v_dq = park(out->v_ab, out->elec_theta_rad);
+
+    FP32 did = (out->v_dq.d - cfg->motor.rs * out->i_dq.d + we * cfg->motor.lq * out->i_dq.q)
+               / cfg->motor.ld;
+    FP32 diq = (out->v_dq.q - cfg->motor.rs * out->i_dq.q - we * cfg->motor.ld * out->i_dq.d
+                - we * cfg->motor.flux)
+               / cfg->motor.lq;
+
+    out->i_dq.d += did * lo->dt;
+    out->i_dq.q += diq * lo->dt;
+
+    out->torque_nm = 1.5f * (FP32)cfg->motor.npp
+                     * (cfg->motor.flux * out->i_dq.q
+                        + (cfg->motor.ld - cfg->motor.lq) * out->i_dq.d * out->i_dq.q);
+
+    FP32 acc = (out->torque_nm - in->load_nm - cfg->b * out->mech_vel_rads) / cfg->motor.j;
+    out->mech_vel_rads += acc * lo->dt;
+    out->mech_theta_rad += out->mech_vel_rads * lo->dt;
+    WARP_2PI(out->mech_theta_rad);
+
+    out->elec_vel_rads  = MECH_TO_ELEC(out->mech_vel_rads, cfg->motor.npp);
+    out->elec_theta_rad = MECH_TO_ELEC(out->mech_theta_rad, cfg->motor.npp);
+    WARP_2PI(out->elec_theta_rad);
+  }
+
+  out->i_ab  = inv_park(out->i_dq, out->elec_theta_rad);
+  out->i_uvw = inv_clarke(out->i_ab);
+}
+
+static inline void
+pmsm_run_in(pmsm_t *pmsm, fp32_uvw_t duty, FP32 load_nm) {
+  DECL_PMSM_PTRS(pmsm);
+
+  in->duty    = duty;
+  in->load_nm = load_nm;
+  pmsm_run(pmsm);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // !PMSM_H
@@ -12,24 +12,43 @@ extern "C" {
 #include "logger/logger.h"
 
 #include "fifo/fifo.h"
+#include "fifo/mpmc.h"
+#include "fifo/spsc.h"
 
+#include "wavegenerator/scurve.h"
 #include "wavegenerator/sine.h"
 
 #include "transform/clarkepark.h"
 #include "transform/fft.h"
+#include "transform/psd.h"
+#include "transform/sdft.h"
 
+#include "controller/deadbeat.h"
+#include "controller/mpc.h"
+#include "controller/mtpa.h"
 #include "controller/pid.h"
+#include "controller/resonant.h"
 
 #include "observer/smo.h"
 
+#include "filter/angle_tbl.h"
+#include "filter/decim.h"
+#include "filter/kalman.h"
 #include "filter/lpf.h"
+#include "filter/notch.h"
 #include "filter/pll.h"
 
+#include "analyzer/fra.h"
+
+#include "model/pmsm.h"
+
 #include "foc/foc.h"
+#include "foc/foc_rec.h"
 
 #include "util/benchmark.h"
 #include "util/errdef.h"
 #include "util/mathdef.h"
+#include "util/seqlock.h"
 #include "util/typedef.h"
 #include "util/util.h"
 
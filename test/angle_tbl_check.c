@@ -0,0 +1,60 @@
+#include <math.h>
+#include <stdio.h>
+
+#include "filter/angle_tbl.h"
+
+#define CHECK_NUM (64U)
+#define CHECK_TOL (1e-3f)
+
+static angle_tbl_t tbl;
+static U32         err_cnt;
+
+static FP32
+bin_rad(FP32 bin) {
+  return FP32_2PI * bin / (FP32)CHECK_NUM;
+}
+
+static void
+check(const char *name, FP32 val, FP32 ref) {
+  BOOL ok = fabsf(val - ref) <= CHECK_TOL;
+  printf("[ANGLE] %-30s: %9.4f (%9.4f) %s\n", name, val, ref, ok ? "ok" : "FAIL");
+  err_cnt += !ok;
+}
+
+/*
+ * The table holds its own index, so a lookup reads back the fractional bin it landed on.
+ */
+int
+main() {
+  angle_tbl_cfg_t cfg = {.num = CHECK_NUM};
+  angle_tbl_init(&tbl, cfg);
+  for (U32 i = 0; i < CHECK_NUM; i++)
+    tbl.lo.val[i] = (FP32)i;
+
+  check("in range", angle_tbl_run_in(&tbl, bin_rad(2.5f)), 2.5f);
+  check("2pi", angle_tbl_run_in(&tbl, FP32_2PI), 0.0f);
+  check("past 2pi", angle_tbl_run_in(&tbl, bin_rad(2.5f) + FP32_2PI), 2.5f);
+  check("past 4pi", angle_tbl_run_in(&tbl, bin_rad(2.5f) + 3.0f * FP32_2PI), 2.5f);
+  check("negative", angle_tbl_run_in(&tbl, bin_rad(2.5f) - FP32_2PI), 2.5f);
+  check("negative, far", angle_tbl_run_in(&tbl, bin_rad(2.5f) - 5.0f * FP32_2PI), 2.5f);
+  check("below 0, last to first bin",
+        angle_tbl_run_in(&tbl, bin_rad(-0.5f)),
+        (FP32)(CHECK_NUM - 1U) * FP32_1_DIV_2);
+  check("nan", angle_tbl_run_in(&tbl, NAN), 0.0f);
+
+  // accumulation lands in the same bin whichever turn the angle is given on
+  angle_tbl_acc(&tbl, bin_rad(5.0f) - FP32_2PI, 1.0f);
+  angle_tbl_acc(&tbl, bin_rad(5.0f) + 2.0f * FP32_2PI, 1.0f);
+  angle_tbl_acc(&tbl, bin_rad(-0.2f), 1.0f);
+  angle_tbl_acc(&tbl, -1e-7f, 1.0f);
+  check("acc bin 5, two turns apart", (FP32)tbl.lo.cnt[5], 2.0f);
+  check("acc bin 0, from below 0", (FP32)tbl.lo.cnt[0], 2.0f);
+
+  U32 cnt = 0;
+  for (U32 i = 0; i < ANGLE_TBL_MAX; i++)
+    cnt += tbl.lo.cnt[i];
+  check("acc total", (FP32)cnt, 4.0f);
+
+  printf("[ANGLE] %u errors\n", (unsigned)err_cnt);
+  return err_cnt ? 1 : 0;
+}
@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "foc/foc.h"
+
+#define BENCH_SET_NUM  (4096U)
+#define BENCH_LOOP_NUM (2000U)
+#define BENCH_TRIP_NUM (20000U)
+#define BENCH_FREQ_HZ  (20000.0f)
+
+static FP32 val[BENCH_SET_NUM][FOC_FAULT_LANE_NUM];
+static U32  word[BENCH_SET_NUM];
+static FP64 lat[BENCH_TRIP_NUM];
+
+static foc_t     foc;
+static adc_raw_t adc_raw;
+static FP64      drv_off_s;
+
+static FP64
+now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (FP64)ts.tv_sec + (FP64)ts.tv_nsec * 1e-9;
+}
+
+static int
+cmp_fp64(const void *a, const void *b) {
+  FP64 x = *(const FP64 *)a, y = *(const FP64 *)b;
+  return (x > y) - (x < y);
+}
+
+static U32
+fault_check_branch(const FP32 *val, const FP32 *max, const U32 *bit, U32 num) {
+  U32 word = 0;
+  for (U32 i = 0; i < num; i++) {
+    if (val[i] > max[i])
+      word |= bit[i];
+  }
+  return word;
+}
+
+static adc_raw_t
+bench_adc_get(void) {
+  return adc_raw;
+}
+
+static FP32
+bench_theta_get(void) {
+  return FP32_0;
+}
+
+static void
+bench_pwm_set(U32 pwm_full_val, u32_uvw_t u32_pwm_duty, foc_pwm_edge_e edge) {
+  (void)pwm_full_val;
+  (void)u32_pwm_duty;
+  (void)edge;
+}
+
+static void
+bench_drv_set(U8 enable) {
+  if (!enable)
+    drv_off_s = now_s();
+}
+
+static void
+bench_init(void) {
+  foc_cfg_t foc_cfg;
+  memset(&foc_cfg, 0, sizeof(foc_cfg));
+  foc_cfg.freq_hz                       = BENCH_FREQ_HZ;
+  foc_cfg.is_adc_cail                   = TRUE;
+  foc_cfg.motor.npp                     = 7;
+  foc_cfg.motor.ld                      = 200e-6f;
+  foc_cfg.motor.lq                      = 200e-6f;
+  foc_cfg.motor.rs                      = 0.1f;
+  foc_cfg.motor.flux                    = 0.005f;
+  foc_cfg.motor.j                       = 1e-3f;
+  foc_cfg.periph.adc_full_val           = 4096U;
+  foc_cfg.periph.cur_range              = 40.0f;
+  foc_cfg.periph.vbus_range             = 60.0f;
+  foc_cfg.periph.adc_offset.i32_i_uvw.u = 2048;
+  foc_cfg.periph.adc_offset.i32_i_uvw.v = 2048;
+  foc_cfg.periph.adc_offset.i32_i_uvw.w = 2048;
+  foc_cfg.periph.pwm_freq_hz            = (U32)BENCH_FREQ_HZ;
+  foc_cfg.periph.pwm_full_val           = 4200U;
+  foc_cfg.periph.modulation_ratio       = FP32_2_DIV_3;
+  foc_cfg.periph.fp32_pwm_min           = 0.02f;
+  foc_cfg.periph.fp32_pwm_max           = 0.98f;
+  foc_cfg.fault.mask                    = FOC_FAULT_ALL;
+  foc_cfg.fault.cur_max                 = 20.0f;
+  foc_cfg.fault.v_bus_max               = 56.0f;
+  foc_cfg.fault.v_bus_min               = 24.0f;
+  foc_cfg.fault.i2t_cur                 = 5.0f;
+  foc_cfg.fault.i2t_max                 = 0.5f;
+  foc_cfg.fault.cur_sum_max             = 2.0f;
+  foc_cfg.fault.loss_cur                = 1.0f;
+  foc_cfg.fault.loss_ratio              = 0.2f;
+  foc_cfg.fault.loss_vel                = 200.0f;
+  foc_cfg.fault.stall_cur               = 4.0f;
+  foc_cfg.fault.stall_vel               = 20.0f;
+  foc_cfg.fault.track_err               = 5.0f;
+  foc_cfg.fault.time_s                  = 0.05f;
+
+  memset(&foc, 0, sizeof(foc));
+  foc_init(&foc, foc_cfg);
+  foc.ops.f_adc_get   = bench_adc_get;
+  foc.ops.f_theta_get = bench_theta_get;
+  foc.ops.f_pwm_set   = bench_pwm_set;
+  foc.ops.f_drv_set   = bench_drv_set;
+  foc.lo.e_theta      = FOC_THETA_SENSOR;
+  foc.lo.e_state      = FOC_STATE_ENABLE;
+
+  adc_raw.i32_i_uvw.u = adc_raw.i32_i_uvw.v = adc_raw.i32_i_uvw.w = 2048;
+  adc_raw.i32_v_bus                         = (I32)(48.0f / 60.0f * 4096.0f);
+}
+
+int
+main() {
+  bench_init();
+  const foc_fault_t *fault = &foc.lo.fault;
+
+  // every lane trips about one time in eight, at random, so the branch is unpredictable
+  srand(1);
+  for (U32 k = 0; k < BENCH_SET_NUM; k++) {
+    for (U32 i = 0; i < FOC_FAULT_LANE_NUM; i++) {
+      FP32 r    = (FP32)rand() / (FP32)RAND_MAX;
+      val[k][i] = fault->max[i] + (r - 0.875f) * FP32_ABS(fault->max[i]) * 8.0f;
+    }
+  }
+
+  FP64 t0 = now_s();
+  for (U32 n = 0; n < BENCH_LOOP_NUM; n++) {
+    for (U32 k = 0; k < BENCH_SET_NUM; k++)
+      word[k] += fault_check_branch(val[k], fault->max, fault->bit, FOC_FAULT_LANE_NUM);
+  }
+  FP64 t_branch = now_s() - t0;
+
+  t0 = now_s();
+  for (U32 n = 0; n < BENCH_LOOP_NUM; n++) {
+    for (U32 k = 0; k < BENCH_SET_NUM; k++)
+      word[k] += fault_check(val[k], fault->max, fault->bit, FOC_FAULT_LANE_NUM);
+  }
+  FP64 t_lane = now_s() - t0;
+
+  // a healthy tick, the whole stage included
+  t0 = now_s();
+  for (U32 n = 0; n < BENCH_TRIP_NUM; n++)
+    foc_fault_run(&foc);
+  FP64 t_stage = now_s() - t0;
+
+  t0 = now_s();
+  for (U32 n = 0; n < BENCH_TRIP_NUM; n++)
+    foc_run(&foc);
+  FP64 t_run = now_s() - t0;
+
+  // over current on u, from entering foc_run to the driver being turned off
+  adc_raw.i32_i_uvw.u = 2048 + 3000;
+  for (U32 n = 0; n < BENCH_TRIP_NUM; n++) {
+    foc_fault_clear(&foc);
+    foc.lo.e_state = FOC_STATE_ENABLE;
+    t0             = now_s();
+    foc_run(&foc);
+    lat[n] = drv_off_s - t0;
+  }
+  qsort(lat, BENCH_TRIP_NUM, sizeof(lat[0]), cmp_fp64);
+
+  FP64 sets = (FP64)BENCH_SET_NUM * BENCH_LOOP_NUM;
+  printf("[FAULT] branchy check    : %.2f ns/tick\n", t_branch / sets * 1e9);
+  printf("[FAULT] lane kernel      : %.2f ns/tick\n", t_lane / sets * 1e9);
+  printf("[FAULT] fault stage      : %.1f ns/tick\n", t_stage / BENCH_TRIP_NUM * 1e9);
+  printf("[FAULT] foc_run, healthy : %.1f ns/tick\n", t_run / BENCH_TRIP_NUM * 1e9);
+  printf("[FAULT] trip to drv off  : %.1f ns median, %.1f ns p99, budget %.0f ns\n",
+         lat[BENCH_TRIP_NUM / 2] * 1e9,
+         lat[BENCH_TRIP_NUM * 99 / 100] * 1e9,
+         FP32_HZ_TO_S(BENCH_FREQ_HZ) * 1e9);
+  printf("checksum %u latched 0x%03x\n",
+         (unsigned)(word[0] + word[BENCH_SET_NUM - 1]),
+         (unsigned)foc.lo.stat.word);
+
+  return 0;
+}
@@ -0,0 +1,1457 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MTPA_GEN
+#define FOC_REC_IMPL
+#include "foc/foc.h"
+#include "foc/foc_rec.h"
+#include "model/pmsm.h"
+#include "transform/sdft.h"
+
+#define SIM_FREQ_HZ  (20000.0f)
+#define SIM_ADC_FULL (4096U)
+#define SIM_ADC_MID  (2048)
+#define SIM_PWM_FULL (4200U)
+#define SIM_CUR_MAX  (40.0f)
+#define SIM_VBUS     (48.0f)
+#define SIM_VBUS_MAX (60.0f)
+#define SIM_ENC_CPR  (16384U)
+
+foc_t  foc;
+pmsm_t pmsm;
+
+static FP32 sim_enc_err_rad; // 编码器偏心误差幅值
+static FP32 sim_cogging_nm;  // 齿槽转矩幅值, 每转 12 个周期
+
+static BOOL       sim_is_double; // 双更新, 每个边沿一个仿真步
+static BOOL       sim_is_shadow; // 占空比在下一边沿装载, 否则立即生效
+static fp32_uvw_t sim_duty_next;
+
+static fp32_uvw_t sim_duty_up;      // 单电阻, 上升半周期占空比
+static U32        sim_adc_trig[2];  // 单电阻, 采样触发计数值
+static FP32       sim_shunt_settle; // 单电阻, 开关后采样仍看到旧状态的时间
+
+#define SIM_ADC_OS_MAX (32U)
+
+static U32        sim_adc_os_num;   // 每周期过采样次数, 0 为单次采样
+static U32        sim_adc_os_order; // CIC 阶数
+static FP32       sim_adc_noise;    // 电流采样噪声, LSB rms
+static fp32_uvw_t sim_adc_drift;    // 电流采样零漂, LSB
+static adc_raw_t  sim_adc_buf[SIM_ADC_OS_MAX];
+static U32        sim_rand_state = 1U;
+static BOOL       sim_adc_lost;    // u 相电流读数丢失
+static U64        sim_drv_off_cnt; // 最近一次关驱动时的 exec_cnt
+static U32        sim_ts_ns;       // 虚拟计时器, 本周期起点
+static BOOL       sim_ts_is_end;   // 下一次读取为本周期终点
+static U32        sim_ts_load_ns;  // 注入的额外负载
+
+static FP64
+sim_now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (FP64)ts.tv_sec + (FP64)ts.tv_nsec * 1e-9;
+}
+
+/*
+ * Roughly unit gaussian, sum of four uniforms.
+ */
+static FP32
+sim_randn(void) {
+  FP32 sum = FP32_0;
+  for (U32 i = 0; i < 4U; i++) {
+    sim_rand_state ^= sim_rand_state << 13;
+    sim_rand_state ^= sim_rand_state >> 17;
+    sim_rand_state ^= sim_rand_state << 5;
+    sum += (FP32)sim_rand_state / 4294967296.0f - FP32_1_DIV_2;
+  }
+  return sum * FP32_SQRT_3;
+}
+
+/*
+ * Dc link current at a trigger in the rising half. The legs are read as they were sim_shunt_settle
+ * earlier, a trigger too close behind an edge sees the state before it.
+ */
+static FP32
+sim_shunt_sample(U32 trig) {
+  const FP32 *duty = &sim_duty_up.u;
+  const FP32 *cur  = &pmsm.out.i_uvw.u;
+  FP32        t    = (FP32)trig - sim_shunt_settle * SIM_FREQ_HZ * FP32_2 * (FP32)SIM_PWM_FULL;
+  FP32        i_dc = FP32_0;
+  for (U32 k = 0; k < 3U; k++) {
+    if (t >= (FP32)SIM_PWM_FULL * (FP32_1 - duty[k]))
+      i_dc += cur[k];
+  }
+  return i_dc;
+}
+
+static adc_raw_t
+sim_adc_get(void) {
+  adc_raw_t adc_raw;
+  FP32      cur2adc = (FP32)SIM_ADC_FULL / SIM_CUR_MAX;
+
+  adc_raw.i32_i_uvw.u = SIM_ADC_MID + (I32)(pmsm.out.i_uvw.u * cur2adc);
+  adc_raw.i32_i_uvw.v = SIM_ADC_MID + (I32)(pmsm.out.i_uvw.v * cur2adc);
+  adc_raw.i32_i_uvw.w = SIM_ADC_MID + (I32)(pmsm.out.i_uvw.w * cur2adc);
+  if (sim_adc_lost)
+    adc_raw.i32_i_uvw.u = SIM_ADC_MID;
+  if (sim_adc_noise > FP32_0) {
+    FP32 nu             = sim_adc_noise * sim_randn() + sim_adc_drift.u;
+    FP32 nv             = sim_adc_noise * sim_randn() + sim_adc_drift.v;
+    FP32 nw             = sim_adc_noise * sim_randn() + sim_adc_drift.w;
+    adc_raw.i32_i_uvw.u = SIM_ADC_MID + (I32)roundf(pmsm.out.i_uvw.u * cur2adc + nu);
+    adc_raw.i32_i_uvw.v = SIM_ADC_MID + (I32)roundf(pmsm.out.i_uvw.v * cur2adc + nv);
+    adc_raw.i32_i_uvw.w = SIM_ADC_MID + (I32)roundf(pmsm.out.i_uvw.w * cur2adc + nw);
+  }
+  if (foc.cfg.periph.e_shunt == FOC_SHUNT_1) {
+    adc_raw.i32_i_uvw.u = SIM_ADC_MID + (I32)(sim_shunt_sample(sim_adc_trig[0]) * cur2adc);
+    adc_raw.i32_i_uvw.v = SIM_ADC_MID + (I32)(sim_shunt_sample(sim_adc_trig[1]) * cur2adc);
+  }
+  adc_raw.i32_v_bus   = (I32)(pmsm.cfg.v_bus / SIM_VBUS_MAX * (FP32)SIM_ADC_FULL);
+
+  adc_raw.i32_v_uvw.u = adc_raw.i32_v_uvw.v = adc_raw.i32_v_uvw.w = 0;
+  return adc_raw;
+}
+
+/*
+ * The plant holds its current over a sim step, the conversions of a block only differ by noise.
+ */
+static U32
+sim_adc_block_get(const adc_raw_t **adc_raw) {
+  for (U32 i = 0; i < sim_adc_os_num; i++)
+    sim_adc_buf[i] = sim_adc_get();
+  *adc_raw = sim_adc_buf;
+  return sim_adc_os_num;
+}
+
+/*
+ * Virtual timer in ns for the budget. The first read of a period is its start, the second the
+ * start plus a cost modelled on a 168 MHz cortex-m4 build for what the level in force runs: 22 us
+ * of current loop, 4 us telemetry, 5 us harmonic bank and 6 us observer, plus injected load and
+ * jitter.
+ */
+static U32
+sim_ts_get(void) {
+  sim_ts_is_end = !sim_ts_is_end;
+  if (sim_ts_is_end) {
+    sim_ts_ns += (U32)(1e9f / SIM_FREQ_HZ);
+    return sim_ts_ns;
+  }
+
+  foc_degrade_e e_degrade = foc.lo.budget.e_degrade;
+  FP32          cost      = 22000.0f + 300.0f * sim_randn() + (FP32)sim_ts_load_ns;
+  if (e_degrade < FOC_DEGRADE_TELEMETRY)
+    cost += 4000.0f;
+  if (e_degrade < FOC_DEGRADE_HARMONIC)
+    cost += 5000.0f;
+  if (e_degrade < FOC_DEGRADE_OBSERVER)
+    cost += 6000.0f;
+  return sim_ts_ns + (U32)cost;
+}
+
+static FP32
+sim_theta_get(void) {
+  // eccentricity plus a second harmonic from a misaligned magnet
+  FP32 theta = pmsm.out.mech_theta_rad + sim_enc_err_rad * FP32_SIN(pmsm.out.mech_theta_rad + 0.3f)
+               + 0.3f * sim_enc_err_rad * FP32_SIN(FP32_2 * pmsm.out.mech_theta_rad);
+  WARP_2PI(theta);
+  U32 cnt = (U32)(theta / FP32_2PI * (FP32)SIM_ENC_CPR) % SIM_ENC_CPR;
+  return (FP32)cnt * FP32_2PI / (FP32)SIM_ENC_CPR;
+}
+
+static void
+sim_pwm_set(U32 pwm_full_val, u32_uvw_t u32_pwm_duty, foc_pwm_edge_e edge) {
+  fp32_uvw_t duty;
+  duty.u = (FP32)u32_pwm_duty.u / (FP32)pwm_full_val;
+  duty.v = (FP32)u32_pwm_duty.v / (FP32)pwm_full_val;
+  duty.w = (FP32)u32_pwm_duty.w / (FP32)pwm_full_val;
+
+  // shifted halves, the plant sees their mean
+  if (foc.cfg.periph.e_shunt == FOC_SHUNT_1) {
+    if (edge == FOC_PWM_EDGE_VALLEY) {
+      sim_duty_up = duty;
+      return;
+    }
+    pmsm.in.duty.u = (sim_duty_up.u + duty.u) * FP32_1_DIV_2;
+    pmsm.in.duty.v = (sim_duty_up.v + duty.v) * FP32_1_DIV_2;
+    pmsm.in.duty.w = (sim_duty_up.w + duty.w) * FP32_1_DIV_2;
+    return;
+  }
+
+  // otherwise every sim step ends on the edge the duty is loaded at
+  if (sim_is_shadow)
+    sim_duty_next = duty;
+  else
+    pmsm.in.duty = duty;
+}
+
+static void
+sim_adc_trig_set(const U32 *u32_adc_trig, U32 num) {
+  for (U32 i = 0; i < num && i < 2U; i++)
+    sim_adc_trig[i] = u32_adc_trig[i];
+}
+
+static void
+sim_drv_set(U8 enable) {
+  if (!enable)
+    sim_drv_off_cnt = foc.lo.exec_cnt;
+}
+
+static void
+sim_init(void) {
+  motor_param_t motor = {
+    .npp  = 7,
+    .ld   = 200e-6f,
+    .lq   = 200e-6f,
+    .ls   = 200e-6f,
+    .rs   = 0.1f,
+    .flux = 0.005f,
+    .j    = 1e-3f,
+  };
+
+  sim_enc_err_rad = FP32_0;
+  sim_cogging_nm  = FP32_0;
+
+  pmsm_cfg_t pmsm_cfg = {
+    .freq_hz  = sim_is_double ? SIM_FREQ_HZ * FP32_2 : SIM_FREQ_HZ,
+    .sub_step = 10,
+    .motor    = motor,
+    .b        = 1e-4f,
+    .v_bus    = SIM_VBUS,
+  };
+  pmsm_init(&pmsm, pmsm_cfg);
+
+  foc_cfg_t foc_cfg;
+  memset(&foc_cfg, 0, sizeof(foc_cfg));
+  foc_cfg.freq_hz                       = sim_is_double ? SIM_FREQ_HZ * FP32_2 : SIM_FREQ_HZ;
+  foc_cfg.is_adc_cail                   = TRUE;
+  foc_cfg.motor                         = motor;
+  foc_cfg.periph.adc_full_val           = SIM_ADC_FULL;
+  foc_cfg.periph.cur_range              = SIM_CUR_MAX;
+  foc_cfg.periph.vbus_range             = SIM_VBUS_MAX;
+  foc_cfg.periph.adc_offset.i32_i_uvw.u = SIM_ADC_MID;
+  foc_cfg.periph.adc_offset.i32_i_uvw.v = SIM_ADC_MID;
+  foc_cfg.periph.adc_offset.i32_i_uvw.w = SIM_ADC_MID;
+  foc_cfg.periph.adc_os_num             = sim_adc_os_num;
+  foc_cfg.periph.adc_os_order           = sim_adc_os_order;
+  foc_cfg.periph.pwm_freq_hz            = (U32)SIM_FREQ_HZ;
+  foc_cfg.periph.pwm_full_val           = SIM_PWM_FULL;
+  foc_cfg.periph.modulation_ratio       = FP32_2_DIV_3;
+  foc_cfg.periph.is_double_update       = sim_is_double;
+  foc_cfg.periph.fp32_pwm_min           = 0.02f;
+  foc_cfg.periph.fp32_pwm_max           = 0.98f;
+
+  // 50 hz velocity loop and 12.5 hz position loop at a quarter of the current loop rate
+  FP32 vel_bw_rads         = FP32_2PI * 50.0f;
+  foc_cfg.loop.div        = 4;
+  foc_cfg.loop.vel_kp     = motor.j * vel_bw_rads;
+  foc_cfg.loop.vel_ki     = foc_cfg.loop.vel_kp * vel_bw_rads / 4.0f;
+  foc_cfg.loop.pos_kp     = vel_bw_rads / 4.0f;
+  foc_cfg.loop.torque_max = 1.0f;
+  foc_cfg.loop.vel_max    = 100.0f;
+  foc_cfg.loop.acc_max    = 500.0f;
+  foc_cfg.loop.jerk_max   = 5e4f;
+
+  memset(&foc, 0, sizeof(foc));
+  foc_init(&foc, foc_cfg);
+  foc.ops.f_adc_get       = sim_adc_get;
+  foc.ops.f_adc_block_get = sim_adc_os_num ? sim_adc_block_get : NULL;
+  foc.ops.f_theta_get     = sim_theta_get;
+  foc.ops.f_pwm_set       = sim_pwm_set;
+  foc.ops.f_drv_set       = sim_drv_set;
+  foc.ops.f_adc_trig_set  = sim_adc_trig_set;
+  foc.lo.e_state          = FOC_STATE_ENABLE;
+  foc.lo.e_theta          = FOC_THETA_SENSOR;
+}
+
+static void
+sim_step(void) {
+  if (sim_is_shadow)
+    pmsm.in.duty = sim_duty_next;
+  foc_run(&foc);
+  pmsm.in.load_nm = sim_cogging_nm * FP32_SIN(12.0f * pmsm.out.mech_theta_rad);
+  pmsm_run(&pmsm);
+}
+
+static void
+sim_fra(const char *name, foc_fra_e e_fra, FP32 amp, FP32 freq_stop_hz) {
+  fra_cfg_t fra_cfg = {
+    .freq_start_hz = freq_stop_hz / 200.0f,
+    .freq_stop_hz  = freq_stop_hz,
+    .point_num     = 24,
+    .amp           = amp,
+    .settle_cycles = 4,
+    .meas_cycles   = 8,
+  };
+
+  // the velocity loop is swept around 20 rad/s so the rotor never stops
+  sim_init();
+  if (e_fra == FOC_FRA_VEL || e_fra == FOC_FRA_TORQUE) {
+    foc_loop_set(&foc, FOC_LOOP_VEL);
+    foc.out.vel_ref = 20.0f;
+  }
+  for (U32 i = 0; i < (U32)SIM_FREQ_HZ / 10; i++)
+    sim_step();
+
+  foc_fra_start(&foc, e_fra, fra_cfg);
+  while (foc.lo.fra.out.e_state != FRA_STATE_DONE)
+    sim_step();
+
+  fra_out_t *fra_out = &foc.lo.fra.out;
+  printf("[FRA] %s\n", name);
+  printf("%12s %10s %10s\n", "freq_hz", "mag_db", "phase_deg");
+  for (U32 i = 0; i < fra_out->point_cnt; i++)
+    printf("%12.1f %10.2f %10.1f\n",
+           fra_out->freq_hz[i],
+           fra_out->mag_db[i],
+           fra_out->phase_deg[i]);
+  if (foc.lo.fra.cfg.is_open_loop)
+    printf("crossover: %.1f Hz, phase margin: %.1f deg\n\n",
+           fra_out->crossover_hz,
+           fra_out->phase_margin_deg);
+  else
+    printf("bandwidth: %.1f Hz\n\n", fra_out->bandwidth_hz);
+}
+
+static void
+sim_vel(const char *name, foc_vel_e e_vel) {
+  sim_init();
+  foc.lo.e_vel   = e_vel;
+  foc.out.i_dq.q = 4.0f;
+
+  FP64 err_sum = 0.0, err_max = 0.0;
+  U32  cnt     = (U32)SIM_FREQ_HZ / 5;
+  for (U32 i = 0; i < cnt; i++) {
+    sim_step();
+    FP64 err = fabs(foc.in.theta.sensor_vel_rads - pmsm.out.elec_vel_rads);
+    err_sum += err;
+    err_max = err > err_max ? err : err_max;
+  }
+  printf("[VEL] %s: acc %.0f rad/s^2, mean err %.2f rad/s, max err %.2f rad/s\n",
+         name,
+         MECH_TO_ELEC(pmsm.out.mech_vel_rads, pmsm.cfg.motor.npp) * 5.0f,
+         err_sum / cnt,
+         err_max);
+}
+
+static void
+sim_delay(const char *name, FP32 inv_park_delay) {
+  sim_init();
+  foc.cfg.theta.inv_park_delay = inv_park_delay;
+
+  // stiff rotor held at speed so the step response is taken at a fixed angle rate
+  pmsm.cfg.motor.j           = 1e3f;
+  pmsm.out.mech_vel_rads     = 200.0f;
+  foc.lo.vel_kf.out.vel_rads = MECH_TO_ELEC(pmsm.out.mech_vel_rads, pmsm.cfg.motor.npp);
+  foc.lo.e_vel               = FOC_VEL_KF;
+
+  for (U32 i = 0; i < (U32)SIM_FREQ_HZ / 20; i++)
+    sim_step();
+
+  // with no current the applied voltage is pure back emf, on the q axis of an aligned frame
+  FP32 frame_err_deg = RAD_TO_DEG(atan2f(foc.out.v_dq.d, foc.out.v_dq.q));
+
+  FP64 id_max = 0.0, id_sum = 0.0;
+  U32  cnt       = (U32)SIM_FREQ_HZ / 100;
+  foc.out.i_dq.q = 10.0f;
+  for (U32 i = 0; i < cnt; i++) {
+    sim_step();
+    FP64 id = fabs(pmsm.out.i_dq.d);
+    id_sum += id;
+    id_max = id > id_max ? id : id_max;
+  }
+  printf("[DELAY] %s: elec vel %.0f rad/s, frame err %.2f deg, id during iq step: mean %.3f A, "
+         "max %.3f A\n",
+         name,
+         pmsm.out.elec_vel_rads,
+         frame_err_deg,
+         id_sum / cnt,
+         id_max);
+}
+
+static void
+sim_ramp(const char *name, BOOL is_decouple) {
+  sim_init();
+  foc.cfg.is_decouple = is_decouple;
+  foc.lo.e_vel        = FOC_VEL_KF;
+  foc.out.i_dq.q      = 10.0f;
+
+  FP64 d_sum = 0.0, q_sum = 0.0, d_max = 0.0;
+  U32  cnt   = (U32)(SIM_FREQ_HZ * 0.3f);
+  for (U32 i = 0; i < cnt; i++) {
+    sim_step();
+    FP64 d_err = fabs(foc.out.i_dq.d - pmsm.out.i_dq.d);
+    FP64 q_err = fabs(foc.out.i_dq.q - pmsm.out.i_dq.q);
+    d_sum += d_err;
+    q_sum += q_err;
+    d_max = d_err > d_max ? d_err : d_max;
+  }
+  printf("[RAMP] %s: 0 -> %.0f rad/s, id err mean %.3f A max %.3f A, iq err mean %.3f A\n",
+         name,
+         pmsm.out.elec_vel_rads,
+         d_sum / cnt,
+         d_max,
+         q_sum / cnt);
+}
+
+static void
+sim_dead_time(const char *name, FP32 dead_time_s, FP32 v_drop) {
+  sim_init();
+  pmsm.cfg.dead_time_s = 1e-6f;
+  pmsm.cfg.v_drop      = 1.0f;
+
+  foc.cfg.periph.dead_time_s = dead_time_s;
+  foc.cfg.periph.v_drop      = v_drop;
+  foc.cfg.periph.dt_cur_band = 0.5f;
+
+  // slow stiff rotor, the distortion is worst at low modulation
+  pmsm.cfg.motor.j           = 1e3f;
+  pmsm.out.mech_vel_rads     = 10.0f;
+  foc.lo.vel_kf.out.vel_rads = MECH_TO_ELEC(pmsm.out.mech_vel_rads, pmsm.cfg.motor.npp);
+  foc.lo.e_vel               = FOC_VEL_KF;
+  foc.out.i_dq.q             = 3.0f;
+
+  for (U32 i = 0; i < (U32)SIM_FREQ_HZ / 20; i++)
+    sim_step();
+
+  FP64 d_sq = 0.0, q_sq = 0.0;
+  U32  cnt  = (U32)(SIM_FREQ_HZ * 0.2f);
+  for (U32 i = 0; i < cnt; i++) {
+    sim_step();
+    FP64 d_err = foc.out.i_dq.d - pmsm.out.i_dq.d;
+    FP64 q_err = foc.out.i_dq.q - pmsm.out.i_dq.q;
+    d_sq += d_err * d_err;
+    q_sq += q_err * q_err;
+  }
+  printf("[DEADTIME] %s: id err rms %.3f A, iq err rms %.3f A\n",
+         name,
+         sqrt(d_sq / cnt),
+         sqrt(q_sq / cnt));
+}
+
+static void
+sim_overmod(const char *name, BOOL is_overmod) {
+  sim_init();
+  foc.cfg.periph.is_overmod = is_overmod;
+  foc.cfg.is_decouple       = TRUE;
+  foc.lo.e_vel              = FOC_VEL_KF;
+  foc.out.i_dq.q            = 10.0f;
+
+  // run into the voltage limit, the speed settles where back emf eats the bus
+  for (U32 i = 0; i < (U32)SIM_FREQ_HZ * 4; i++)
+    sim_step();
+
+  printf("[OVERMOD] %s: top speed %.0f rad/s, iq %.2f A, mi %.3f\n",
+         name,
+         pmsm.out.elec_vel_rads,
+         pmsm.out.i_dq.q,
+         foc.out.svpwm.mi);
+}
+
+static void
+sim_mtpa(const char *name, BOOL is_mtpa) {
+  sim_init();
+  foc.cfg.is_decouple = TRUE;
+  foc.lo.e_vel        = FOC_VEL_KF;
+
+  mtpa_gen_cfg_t gen = {
+    .motor      = pmsm.cfg.motor,
+    .torque_num = 16,
+    .speed_num  = 32,
+    .cur_max    = 20.0f,
+    .v_max      = FP32_1_DIV_SQRT_3 * 0.95f,
+    .speed_max  = 600.0f,
+  };
+  mtpa_tbl_t *tbl = malloc(MTPA_TBL_SIZE(gen.torque_num, gen.speed_num));
+  mtpa_tbl_gen(tbl, gen);
+
+  // same torque either way, only the table knows to weaken the field
+  FP32 torque_nm = 0.5f;
+  if (is_mtpa)
+    foc_mtpa_init(&foc, tbl);
+  else
+    foc.out.i_dq.q = torque_nm / (1.5f * (FP32)pmsm.cfg.motor.npp * pmsm.cfg.motor.flux);
+  foc.out.torque_ref = torque_nm;
+
+  for (U32 i = 0; i < (U32)SIM_FREQ_HZ * 4; i++)
+    sim_step();
+
+  printf("[MTPA] %s: speed after 4 s %.0f rad/s, id %.2f A, iq %.2f A, torque %.3f Nm\n",
+         name,
+         pmsm.out.elec_vel_rads,
+         pmsm.out.i_dq.d,
+         pmsm.out.i_dq.q,
+         pmsm.out.torque_nm);
+  free(tbl);
+}
+
+static void
+sim_res(const char *name, FP32 mech_vel_rads, BOOL is_res) {
+  sim_init();
+  pmsm.cfg.dead_time_s = 1e-6f;
+  pmsm.cfg.v_drop      = 1.0f;
+  foc.cfg.is_decouple  = TRUE;
+
+  if (is_res) {
+    res_cfg_t res_cfg = {
+      .freq_hz  = SIM_FREQ_HZ,
+      .harm_num = 2,
+      .harm     = {6, 12},
+      .bw       = 100.0f,
+      .l        = pmsm.cfg.motor.ls,
+      .r        = pmsm.cfg.motor.rs + foc.lo.iq_pid.cfg.kp,
+      .delay    = FP32_1_DIV_2,
+      .vel_min  = 20.0f,
+      .out_max  = 2.0f,
+    };
+    res_init(&foc.lo.cur_res, res_cfg);
+  }
+
+  // uncompensated dead time on a stiff rotor, the 6th and 12th in dq come from it
+  pmsm.cfg.motor.j           = 1e3f;
+  pmsm.out.mech_vel_rads     = mech_vel_rads;
+  foc.lo.vel_kf.out.vel_rads = MECH_TO_ELEC(pmsm.out.mech_vel_rads, pmsm.cfg.motor.npp);
+  foc.lo.e_vel               = FOC_VEL_KF;
+  foc.out.i_dq.q             = 3.0f;
+
+  for (U32 i = 0; i < (U32)SIM_FREQ_HZ / 2; i++)
+    sim_step();
+
+  FP64 d_sq = 0.0, q_sq = 0.0;
+  U32  cnt  = (U32)(SIM_FREQ_HZ * 0.2f);
+  for (U32 i = 0; i < cnt; i++) {
+    sim_step();
+    FP64 d_err = foc.out.i_dq.d - pmsm.out.i_dq.d;
+    FP64 q_err = foc.out.i_dq.q - pmsm.out.i_dq.q;
+    d_sq += d_err * d_err;
+    q_sq += q_err * q_err;
+  }
+  printf("[RES] %s at %.0f rad/s elec: id err rms %.3f A, iq err rms %.3f A\n",
+         name,
+         pmsm.out.elec_vel_rads,
+         sqrt(d_sq / cnt),
+         sqrt(q_sq / cnt));
+}
+
+/*
+ * A resonance riding on the q current reference, drifting from 600 to 660 hz. Every 10 ms the
+ * peak is handed to the notch bank the way a spectrum (psd_t peak list) would report it, the
+ * ripple left in the real current is read with a sliding dft bin following the tone.
+ */
+static void
+sim_anf(const char *name, BOOL is_anf, BOOL is_reset) {
+  sim_init();
+  pmsm.cfg.motor.j       = 1e3f;
+  pmsm.out.mech_vel_rads = 20.0f;
+
+  anf_cfg_t anf_cfg = {
+    .freq_hz     = SIM_FREQ_HZ,
+    .notch_num   = is_anf ? 2 : 0,
+    .q           = 2.0f,
+    .depth       = FP32_0,
+    .amp_on      = 0.1f,
+    .match_hz    = 50.0f,
+    .slew_hz     = 0.5f,
+    .freq_min_hz = 100.0f,
+    .freq_max_hz = 2000.0f,
+  };
+  anf_init(&foc.lo.iq_anf, anf_cfg);
+
+  sdft_t     sdft;
+  sdft_cfg_t sdft_cfg = {
+    .sample_rate_hz = SIM_FREQ_HZ,
+    .bin_num        = 1,
+    .bin_freq_hz    = {600.0f},
+  };
+  sdft_init(&sdft, sdft_cfg);
+
+  FP32 i_q = 2.0f, amp = 0.5f, phase = FP32_0, freq_hz = FP32_0;
+  FP64 ripple_sum = 0.0;
+  U32  cnt = (U32)SIM_FREQ_HZ / 2, meas = (U32)SIM_FREQ_HZ / 20, hop = (U32)SIM_FREQ_HZ / 100;
+  for (U32 i = 0; i < cnt; i++) {
+    freq_hz = 600.0f + 120.0f * (FP32)i / SIM_FREQ_HZ;
+    phase += FP32_2PI * freq_hz / SIM_FREQ_HZ;
+    foc.out.i_dq.q = i_q + amp * FP32_SIN(phase);
+
+    if (i % hop == 0) {
+      if (is_reset && i >= cnt - 2U * meas) {
+        if (i < cnt - 2U * meas + hop)
+          anf_reset(&foc.lo.iq_anf);
+      } else {
+        anf_peak_update(&foc.lo.iq_anf, &freq_hz, &amp, 1);
+      }
+      sdft_set_bin(&sdft, 0, freq_hz);
+    }
+
+    sim_step();
+    // without the dc taken off it leaks into the bin through the short window
+    sdft_run_in(&sdft, pmsm.out.i_dq.q - i_q);
+    if (i >= cnt - meas)
+      ripple_sum += sdft.out.amp[0];
+  }
+  printf("[ANF] %s: iq ripple at %.0f hz %.3f A (reference %.3f A), notch %s at %.1f hz\n",
+         name,
+         freq_hz,
+         ripple_sum / meas,
+         amp,
+         foc.lo.iq_anf.out.active[0] ? "on" : "off",
+         foc.lo.iq_anf.out.center_hz[0]);
+}
+
+static void
+sim_pos(const char *name, BOOL is_acc_ff) {
+  sim_init();
+  foc.cfg.is_decouple = TRUE;
+  foc.lo.e_vel        = FOC_VEL_KF;
+  if (!is_acc_ff)
+    foc.cfg.motor.j = FP32_0;
+
+  for (U32 i = 0; i < (U32)SIM_FREQ_HZ / 20; i++)
+    sim_step();
+  foc_loop_set(&foc, FOC_LOOP_POS);
+
+  // back and forth over 2 rad as fast as the limits allow, then one long move
+  FP64 err_max = 0.0, err_sq = 0.0;
+  U32  err_cnt = 0;
+  for (U32 k = 0; k <= 20U; k++) {
+    FP32 target = (k == 20U) ? 50.0f : ((k & 1U) ? FP32_0 : FP32_2);
+    foc_move(&foc, target);
+    while (!foc.lo.traj.out.is_done) {
+      sim_step();
+      FP64 err = fabs(foc.out.pos_ref - foc.in.theta.pos_rad);
+      err_max  = err > err_max ? err : err_max;
+      err_sq += err * err;
+      err_cnt++;
+    }
+  }
+  for (U32 i = 0; i < (U32)SIM_FREQ_HZ / 20; i++)
+    sim_step();
+
+  printf("[POS] %s: %.2f s of moves, following err rms %.2f mrad max %.2f mrad, "
+         "end err %.2f mrad\n",
+         name,
+         err_cnt / SIM_FREQ_HZ,
+         sqrt(err_sq / err_cnt) * 1e3,
+         err_max * 1e3,
+         fabs(50.0f - foc.in.theta.pos_rad) * 1e3);
+}
+
+static void
+sim_traj_cost(void) {
+  scurve_t     traj;
+  scurve_cfg_t traj_cfg = {
+    .freq_hz  = SIM_FREQ_HZ,
+    .vel_max  = 200.0f,
+    .acc_max  = 5000.0f,
+    .jerk_max = 5e5f,
+  };
+  scurve_init(&traj, traj_cfg);
+
+  U32  plan_num = 100000, run_num = 0;
+  FP32 sum      = FP32_0;
+  FP64 t0       = sim_now_s();
+  for (U32 i = 0; i < plan_num; i++)
+    scurve_plan(&traj, FP32_0, (FP32)(i % 100U) * 0.1f + 0.1f);
+  FP64 plan_ns = (sim_now_s() - t0) / plan_num * 1e9;
+
+  scurve_plan(&traj, FP32_0, 100.0f);
+  t0 = sim_now_s();
+  while (!traj.out.is_done) {
+    scurve_run(&traj);
+    sum += traj.out.pos;
+    run_num++;
+  }
+  FP64 run_ns = (sim_now_s() - t0) / run_num * 1e9;
+
+  printf("[POS] scurve plan %.0f ns per move, run %.1f ns per tick (checksum %.1f)\n",
+         plan_ns,
+         run_ns,
+         sum);
+}
+
+static void
+sim_update(const char *name, BOOL is_double) {
+  sim_is_double = is_double;
+  sim_is_shadow = TRUE;
+  memset(&sim_duty_next, 0, sizeof(sim_duty_next));
+  sim_init();
+  foc.cfg.is_decouple          = TRUE;
+  foc.cfg.theta.inv_park_delay = 1.5f;
+
+  // same rule for both, 30 deg of the phase margin left to the 1.5 tick delay
+  FP32 wc = (FP32_PI / 6.0f) / (1.5f * FP32_HZ_TO_S(foc.cfg.freq_hz));
+
+  foc.lo.id_pid.cfg.kp = foc.lo.iq_pid.cfg.kp = foc.cfg.motor.ld * wc;
+  foc.lo.id_pid.cfg.ki = foc.lo.iq_pid.cfg.ki = foc.cfg.motor.rs * wc;
+
+  for (U32 i = 0; i < (U32)foc.cfg.freq_hz / 10; i++)
+    sim_step();
+
+  fra_cfg_t fra_cfg = {
+    .freq_start_hz = 100.0f,
+    .freq_stop_hz  = 6000.0f,
+    .point_num     = 24,
+    .amp           = 0.5f,
+    .settle_cycles = 4,
+    .meas_cycles   = 8,
+  };
+  foc_fra_start(&foc, FOC_FRA_VQ, fra_cfg);
+  while (foc.lo.fra.out.e_state != FRA_STATE_DONE)
+    sim_step();
+  FP32 crossover_hz = foc.lo.fra.out.crossover_hz, pm_deg = foc.lo.fra.out.phase_margin_deg;
+
+  foc_fra_start(&foc, FOC_FRA_IQ_REF, fra_cfg);
+  while (foc.lo.fra.out.e_state != FRA_STATE_DONE)
+    sim_step();
+
+  printf("[UPDATE] %s: %.0f hz control, crossover %.0f hz, phase margin %.1f deg, "
+         "closed loop bandwidth %.0f hz\n",
+         name,
+         foc.cfg.freq_hz,
+         crossover_hz,
+         pm_deg,
+         foc.lo.fra.out.bandwidth_hz);
+
+  // foc_init() refuses what it cannot run instead of changing the config
+  if (is_double) {
+    foc_cfg_t c      = foc.cfg;
+    c.periph.e_shunt = FOC_SHUNT_1;
+    ret_e shunt_ret  = foc_init(&foc, c);
+    c                = foc.cfg;
+    c.freq_hz        = (FP32)c.periph.pwm_freq_hz;
+    ret_e freq_ret   = foc_init(&foc, c);
+    printf("[UPDATE] %s: single shunt %s, freq_hz at the pwm rate %s, freq_hz kept %.0f hz\n",
+           name,
+           shunt_ret == FAIL ? "refused" : "taken",
+           freq_ret == FAIL ? "refused" : "taken",
+           foc.cfg.freq_hz);
+  }
+
+  sim_is_double = FALSE;
+  sim_is_shadow = FALSE;
+}
+
+static void
+sim_shunt(const char *name, foc_shunt_e e_shunt, FP32 mech_vel_rads, FP32 win_s) {
+  sim_init();
+  foc.cfg.is_decouple           = TRUE;
+  foc.cfg.periph.e_shunt        = e_shunt;
+  foc.cfg.periph.shunt_win_s    = win_s;
+  foc.cfg.periph.shunt_settle_s = 1.5e-6f;
+  sim_shunt_settle              = 1e-6f;
+
+  pmsm.cfg.motor.j           = 1e3f;
+  pmsm.out.mech_vel_rads     = mech_vel_rads;
+  foc.lo.vel_kf.out.vel_rads = MECH_TO_ELEC(pmsm.out.mech_vel_rads, pmsm.cfg.motor.npp);
+  foc.lo.e_vel               = FOC_VEL_KF;
+  foc.out.i_dq.q             = 3.0f;
+
+  for (U32 i = 0; i < (U32)SIM_FREQ_HZ / 20; i++)
+    sim_step();
+
+  // the reconstruction is checked against the plant current it was sampled from
+  FP64 rec_sq = 0.0, q_sq = 0.0;
+  U32  cnt    = (U32)(SIM_FREQ_HZ * 0.2f);
+  for (U32 i = 0; i < cnt; i++) {
+    foc_run(&foc);
+    FP64 du = foc.in.fp32_i_uvw.u - pmsm.out.i_uvw.u;
+    FP64 dv = foc.in.fp32_i_uvw.v - pmsm.out.i_uvw.v;
+    FP64 dw = foc.in.fp32_i_uvw.w - pmsm.out.i_uvw.w;
+    rec_sq += (du * du + dv * dv + dw * dw) / 3.0;
+    pmsm_run(&pmsm);
+    FP64 q_err = foc.out.i_dq.q - pmsm.out.i_dq.q;
+    q_sq += q_err * q_err;
+  }
+  printf("[SHUNT] %s at %.0f rad/s elec: phase current err rms %.3f A, iq err rms %.3f A\n",
+         name,
+         pmsm.out.elec_vel_rads,
+         sqrt(rec_sq / cnt),
+         sqrt(q_sq / cnt));
+}
+
+/*
+ * Offsets drift after calibration, per phase while the bridge is off at standstill and then in
+ * common while running. The error is the iq ripple and id noise it leaves.
+ */
+static void
+sim_adc(const char *name, U32 os_num, U32 os_order, FP32 drift_hz) {
+  sim_adc_os_num   = os_num;
+  sim_adc_os_order = os_order;
+  sim_adc_noise    = 6.0f;
+  sim_init();
+  foc.cfg.is_decouple         = TRUE;
+  foc.cfg.periph.adc_drift_hz = drift_hz;
+
+  sim_adc_drift.u = 12.0f;
+  sim_adc_drift.v = -8.0f;
+  sim_adc_drift.w = -4.0f;
+  foc.lo.e_state  = FOC_STATE_DISABLE;
+  for (U32 i = 0; i < (U32)SIM_FREQ_HZ / 10; i++)
+    sim_step();
+
+  pmsm.cfg.motor.j           = 1e3f;
+  pmsm.out.mech_vel_rads     = 50.0f;
+  foc.lo.vel_kf.out.vel_rads = MECH_TO_ELEC(pmsm.out.mech_vel_rads, pmsm.cfg.motor.npp);
+  foc.lo.e_vel               = FOC_VEL_KF;
+  foc.lo.e_state             = FOC_STATE_ENABLE;
+  foc.out.i_dq.q             = 3.0f;
+
+  // 20 lsb of common drift over the run
+  FP64 d_sq = 0.0, q_sq = 0.0;
+  U32  cnt  = (U32)(SIM_FREQ_HZ * 0.3f);
+  for (U32 i = 0; i < cnt; i++) {
+    FP32 common     = 20.0f * (FP32)i / (FP32)cnt;
+    sim_adc_drift.u = 12.0f + common;
+    sim_adc_drift.v = -8.0f + common;
+    sim_adc_drift.w = -4.0f + common;
+
+    if (sim_is_shadow)
+      pmsm.in.duty = sim_duty_next;
+    foc_run(&foc);
+    pmsm_run(&pmsm);
+
+    if (i < cnt / 2)
+      continue;
+    FP64 d_err = pmsm.out.i_dq.d;
+    FP64 q_err = foc.out.i_dq.q - pmsm.out.i_dq.q;
+    d_sq += d_err * d_err;
+    q_sq += q_err * q_err;
+  }
+  // the decimation alone, the sim noise generator would swamp a foc_run timing
+  FP64 decim_ns = 0.0;
+  if (os_num) {
+    U32  run_num = 100000;
+    FP64 t0      = sim_now_s();
+    for (U32 i = 0; i < run_num; i++)
+      decim_run_in(&foc.lo.adc_decim, (const I32 *)sim_adc_buf, os_num, FOC_ADC_CH_NUM);
+    decim_ns = (sim_now_s() - t0) / run_num * 1e9;
+  }
+  printf("[ADC] %s: id rms %.3f A, iq err rms %.3f A, decimation %.0f ns\n",
+         name,
+         sqrt(d_sq / (cnt - cnt / 2)),
+         sqrt(q_sq / (cnt - cnt / 2)),
+         decim_ns);
+
+  sim_adc_os_num   = 0;
+  sim_adc_os_order = 0;
+  sim_adc_noise    = FP32_0;
+  memset(&sim_adc_drift, 0, sizeof(sim_adc_drift));
+}
+
+typedef enum {
+  SIM_FAULT_OVER_CUR,
+  SIM_FAULT_I2T,
+  SIM_FAULT_UNDER_VOLT,
+  SIM_FAULT_LOST_PHASE,
+  SIM_FAULT_STALL,
+} sim_fault_e;
+
+/*
+ * Healthy for 0.5 s, then one fault is injected. Reports what latched, how many ticks after the
+ * injection, and whether the driver went off in the tick that latched it.
+ */
+static void
+sim_fault(const char *name, sim_fault_e e_fault, foc_shunt_e e_shunt) {
+  sim_init();
+  foc.cfg.is_decouple    = TRUE;
+  foc.cfg.periph.e_shunt = e_shunt;
+
+  fault_param_t *f = &foc.cfg.fault;
+  f->mask          = FOC_FAULT_ALL;
+  f->cur_max       = 20.0f;
+  f->v_bus_max     = 56.0f;
+  f->v_bus_min     = 24.0f;
+  f->i2t_cur       = 5.0f;
+  f->i2t_max       = 0.5f;
+  f->cur_sum_max   = 2.0f;
+  f->loss_cur      = 1.0f;
+  f->loss_ratio    = 0.2f;
+  f->loss_vel      = 200.0f;
+  f->stall_cur     = 4.0f;
+  f->stall_vel     = 20.0f;
+  f->track_err     = 5.0f;
+  f->time_s        = 0.05f;
+  foc_fault_init(&foc);
+
+  pmsm.cfg.motor.j           = 1e3f;
+  pmsm.out.mech_vel_rads     = (e_fault == SIM_FAULT_STALL) ? FP32_0 : 50.0f;
+  foc.lo.vel_kf.out.vel_rads = MECH_TO_ELEC(pmsm.out.mech_vel_rads, pmsm.cfg.motor.npp);
+  foc.lo.e_vel               = FOC_VEL_KF;
+  foc.out.i_dq.q             = 3.0f;
+
+  // the rotor is held, the sensor runs the loop and the observer sees no speed, the injected fault
+  // is a torque request above stall_cur
+  if (e_fault == SIM_FAULT_STALL) {
+    foc.cfg.theta.fusion_vel_min = 100.0f;
+    foc.cfg.theta.fusion_vel_max = 200.0f;
+    foc.lo.e_theta               = FOC_THETA_SENSORFUSION;
+  }
+
+  sim_drv_off_cnt = 0;
+  for (U32 i = 0; i < (U32)SIM_FREQ_HZ / 2; i++)
+    sim_step();
+  U32 healthy = foc.lo.stat.word;
+
+  U64 inject_cnt = foc.lo.exec_cnt + 1U;
+  switch (e_fault) {
+  case SIM_FAULT_OVER_CUR:
+    foc.out.i_dq.q = 30.0f;
+    break;
+  case SIM_FAULT_I2T:
+    foc.out.i_dq.q = 8.0f;
+    break;
+  case SIM_FAULT_UNDER_VOLT:
+    pmsm.cfg.v_bus = 20.0f;
+    break;
+  case SIM_FAULT_LOST_PHASE:
+    sim_adc_lost = TRUE;
+    break;
+  case SIM_FAULT_STALL:
+    foc.out.i_dq.q = 5.0f;
+    break;
+  default:
+    break;
+  }
+
+  for (U32 i = 0; i < (U32)SIM_FREQ_HZ && !(foc.lo.stat.word & FOC_FAULT_ALL); i++)
+    sim_step();
+
+  if (!(foc.lo.stat.word & FOC_FAULT_ALL)) {
+    printf("[FAULT] %s: healthy 0x%03x, no trip\n", name, (unsigned)healthy);
+    sim_adc_lost = FALSE;
+    return;
+  }
+  printf("[FAULT] %s: healthy 0x%03x, latched 0x%03x after %llu ticks, driver off %s\n",
+         name,
+         (unsigned)healthy,
+         (unsigned)foc.lo.stat.word,
+         (unsigned long long)(foc.lo.fault.trip_cnt - inject_cnt + 1U),
+         (sim_drv_off_cnt && sim_drv_off_cnt == foc.lo.fault.trip_cnt) ? "same tick" : "late");
+
+  sim_adc_lost = FALSE;
+}
+
+/*
+ * 40 us of the 50 us period is the budget, a burst of 8 us extra load per period comes for 0.1 s.
+ * Without shedding every period of the burst overruns, with it the level steps down until the loop
+ * fits and comes back once the burst is over.
+ */
+static void
+sim_budget(const char *name, foc_degrade_e e_degrade_max) {
+  sim_init();
+  foc.cfg.periph.timer_freq_hz = 1000000000U;
+  foc.cfg.budget.ratio         = 0.8f;
+  foc.cfg.budget.restore_ratio = 0.85f;
+  foc.cfg.budget.restore_cnt   = 200;
+  foc.cfg.budget.e_degrade_max = e_degrade_max;
+  foc_init(&foc, foc.cfg);
+  foc.ops.f_ts_get = sim_ts_get;
+  sim_ts_is_end    = FALSE;
+
+  pmsm.cfg.motor.j           = 1e3f;
+  pmsm.out.mech_vel_rads     = 50.0f;
+  foc.lo.vel_kf.out.vel_rads = MECH_TO_ELEC(pmsm.out.mech_vel_rads, pmsm.cfg.motor.npp);
+  foc.lo.e_vel               = FOC_VEL_KF;
+  foc.out.i_dq.q             = 3.0f;
+
+  U32 burst_overrun = 0, burst_level = 0, after_level = 0, burst_snap = 0;
+  U32 cnt           = (U32)SIM_FREQ_HZ / 2;
+  for (U32 i = 0; i < cnt; i++) {
+    BOOL is_burst  = (i >= cnt / 5 && i < cnt / 5 + (U32)SIM_FREQ_HZ / 10);
+    sim_ts_load_ns = is_burst ? 8000U : 0U;
+
+    U32 overrun = foc.lo.budget.overrun_cnt, seq = foc.lo.snap_lock.seq;
+    sim_step();
+    if (is_burst) {
+      burst_overrun += foc.lo.budget.overrun_cnt - overrun;
+      burst_snap += (foc.lo.snap_lock.seq - seq) / 2U;
+      burst_level = foc.lo.budget.e_degrade;
+    }
+  }
+  after_level = foc.lo.budget.e_degrade;
+
+  const foc_budget_t *b = &foc.lo.budget;
+  printf("[BUDGET] %s: %u overruns in %u burst periods, level %u in the burst, %u after, "
+         "%u snapshots in the burst, max %.1f us\n",
+         name,
+         (unsigned)burst_overrun,
+         (unsigned)SIM_FREQ_HZ / 10,
+         (unsigned)burst_level,
+         (unsigned)after_level,
+         (unsigned)burst_snap,
+         (FP64)b->elapsed_max * 1e-3);
+  printf("[BUDGET] %s: hist", name);
+  for (U32 i = 0; i < FOC_BUDGET_HIST_NUM; i++)
+    printf(" %u", (unsigned)b->hist[i]);
+  printf("\n");
+}
+
+#define SIM_REC_PATH "/tmp/foc_sim.rec"
+#define SIM_REC_RING (64U * 1024U)
+
+static FILE     *sim_rec_file;
+static U8        sim_rec_ring[SIM_REC_RING];
+static foc_rec_t sim_rec;
+static foc_t     sim_replay_foc;
+
+static void
+sim_rec_write(const void *buf, U32 len) {
+  fwrite(buf, 1, len, sim_rec_file);
+}
+
+static U32
+sim_rec_read(void *buf, U32 len) {
+  return (U32)fread(buf, 1, len, sim_rec_file);
+}
+
+/*
+ * Replays the file into sim_replay_foc, kp_scale != 1 stands in for a changed build.
+ */
+static void
+sim_replay_run(const char *name, FP32 kp_scale) {
+  memset(&sim_rec, 0, sizeof(sim_rec));
+  sim_rec.ops.f_read = sim_rec_read;
+  sim_rec_file       = fopen(SIM_REC_PATH, "rb");
+  if (!sim_rec_file || foc_replay_open(&sim_rec, &sim_replay_foc) != OK) {
+    printf("[REPLAY] %s: open failed\n", name);
+    if (sim_rec_file)
+      fclose(sim_rec_file);
+    return;
+  }
+  sim_replay_foc.lo.iq_pid.cfg.kp *= kp_scale;
+
+  FP64 t0 = sim_now_s();
+  while (foc_replay_step(&sim_rec) == OK)
+    ;
+  FP64 t = sim_now_s() - t0;
+  fclose(sim_rec_file);
+
+  const foc_rec_out_t *out = &sim_rec.out;
+  printf("[REPLAY] %s: %u ticks, %.1f ns/tick, %u setpoint frames, %u gaps, %u mismatches",
+         name,
+         (unsigned)out->seq,
+         t / (FP64)out->seq * 1e9,
+         (unsigned)out->ctrl_cnt,
+         (unsigned)out->gap_cnt,
+         (unsigned)out->mismatch_cnt);
+  if (out->mismatch_cnt)
+    printf(", first at tick %u", (unsigned)out->mismatch_seq);
+  printf("\n");
+}
+
+static void
+sim_replay(void) {
+  sim_adc_os_num   = 16;
+  sim_adc_os_order = 1;
+  sim_adc_noise    = 2.0f;
+  sim_init();
+  foc.cfg.periph.timer_freq_hz = 1000000000U;
+  foc.cfg.budget.ratio         = 0.8f;
+  foc.cfg.budget.restore_ratio = 0.85f;
+  foc.cfg.budget.restore_cnt   = 200;
+  foc.cfg.budget.e_degrade_max = FOC_DEGRADE_OBSERVER;
+  foc_init(&foc, foc.cfg);
+  foc.ops.f_ts_get = sim_ts_get;
+  sim_ts_is_end    = FALSE;
+  foc.lo.e_vel     = FOC_VEL_KF;
+
+  sim_rec_file = fopen(SIM_REC_PATH, "wb");
+  if (!sim_rec_file) {
+    printf("[REPLAY] cannot write %s\n", SIM_REC_PATH);
+    return;
+  }
+  memset(&sim_rec, 0, sizeof(sim_rec));
+  sim_rec.ops.f_write = sim_rec_write;
+  foc_rec_cfg_t rec_cfg = {.ring_buf = sim_rec_ring, .ring_size = SIM_REC_RING};
+  foc_rec_start(&sim_rec, rec_cfg, &foc);
+
+  fra_cfg_t fra_cfg = {
+    .freq_start_hz = 200.0f,
+    .freq_stop_hz  = 2000.0f,
+    .point_num     = 4,
+    .amp           = 0.2f,
+    .settle_cycles = 2,
+    .meas_cycles   = 4,
+  };
+
+  // current step with a short sweep, velocity loop with a staged gain change, then a move, the
+  // ring is drained every 64 periods
+  U32 cnt = (U32)SIM_FREQ_HZ;
+  for (U32 i = 0; i < cnt; i++) {
+    if (i == cnt / 10)
+      foc.out.i_dq.q = 2.0f;
+    if (i == cnt * 2 / 10)
+      foc_fra_start(&foc, FOC_FRA_VQ, fra_cfg);
+    if (i == cnt * 3 / 10) {
+      foc_loop_set(&foc, FOC_LOOP_VEL);
+      foc.out.vel_ref = 20.0f;
+    }
+    if (i == cnt * 4 / 10) {
+      foc_cfg_t tune_cfg    = foc.cfg;
+      tune_cfg.loop.vel_kp *= 1.5f;
+      foc_tune_stage(&foc, &tune_cfg, NULL);
+    }
+    if (i == cnt * 6 / 10) {
+      foc_loop_set(&foc, FOC_LOOP_POS);
+      foc_move(&foc, foc.lo.traj.out.pos + 3.0f);
+    }
+
+    if (sim_is_shadow)
+      pmsm.in.duty = sim_duty_next;
+    foc_rec_tick(&sim_rec);
+    pmsm.in.load_nm = sim_cogging_nm * FP32_SIN(12.0f * pmsm.out.mech_theta_rad);
+    pmsm_run(&pmsm);
+
+    if ((i & 63U) == 63U)
+      foc_rec_flush(&sim_rec);
+  }
+  foc_rec_flush(&sim_rec);
+  foc_rec_stop(&sim_rec);
+  fclose(sim_rec_file);
+
+  const foc_rec_out_t *out = &sim_rec.out;
+  printf("[REPLAY] recorded %u ticks, %.1f bytes/tick, %u setpoint frames, %u dropped\n",
+         (unsigned)out->seq,
+         (FP64)out->bytes / (FP64)out->seq,
+         (unsigned)out->ctrl_cnt,
+         (unsigned)out->drop_cnt);
+
+  // nothing of the recording foc is reused
+  memset(&foc, 0, sizeof(foc));
+  sim_replay_run("same build", FP32_1);
+  sim_replay_run("iq kp +1%", 1.01f);
+
+  sim_adc_os_num   = 0;
+  sim_adc_os_order = 0;
+  sim_adc_noise    = FP32_0;
+  remove(SIM_REC_PATH);
+}
+
+static foc_t  sim_tune_foc;
+static pmsm_t sim_tune_pmsm;
+
+/*
+ * Velocity loop gains doubled 5 ms into a speed step, written straight into the running foc or
+ * staged for the next tick boundary. The bump is the iq reference against the same loop run on
+ * with the old gains over the outer loop period of the swap.
+ */
+static void
+sim_tune(const char *name, BOOL is_stage) {
+  sim_init();
+  foc.lo.e_vel = FOC_VEL_KF;
+  foc_loop_set(&foc, FOC_LOOP_VEL);
+  for (U32 i = 0; i < (U32)SIM_FREQ_HZ / 10; i++)
+    sim_step();
+
+  foc.out.vel_ref = 2.0f;
+  for (U32 i = 0; i < (U32)SIM_FREQ_HZ / 200; i++)
+    sim_step();
+
+  FP32 step_max = FP32_0, iq_ref = foc.out.i_dq.q;
+  for (U32 i = 0; i < (U32)SIM_FREQ_HZ / 500; i++) {
+    sim_step();
+    step_max = fmaxf(step_max, FP32_ABS(foc.out.i_dq.q - iq_ref));
+    iq_ref   = foc.out.i_dq.q;
+  }
+
+  FP32 iq_keep[16];
+  sim_tune_foc  = foc;
+  sim_tune_pmsm = pmsm;
+  for (U32 i = 0; i < foc.cfg.loop.div && i < 16U; i++) {
+    sim_step();
+    iq_keep[i] = foc.out.i_dq.q;
+  }
+  foc  = sim_tune_foc;
+  pmsm = sim_tune_pmsm;
+
+  foc_cfg_t tune_cfg   = foc.cfg;
+  tune_cfg.loop.vel_kp = foc.cfg.loop.vel_kp * FP32_2;
+  tune_cfg.loop.vel_ki = foc.cfg.loop.vel_ki * 4.0f;
+  if (is_stage) {
+    foc_tune_stage(&foc, &tune_cfg, NULL);
+  } else {
+    foc.cfg.loop          = tune_cfg.loop;
+    foc.lo.vel_pid.cfg.kp = tune_cfg.loop.vel_kp;
+    foc.lo.vel_pid.cfg.ki = tune_cfg.loop.vel_ki;
+  }
+
+  // the outer loop runs every div ticks, the next run sees the new gains
+  FP32 swap_step = FP32_0, bump = FP32_0;
+  for (U32 i = 0; i < foc.cfg.loop.div && i < 16U; i++) {
+    sim_step();
+    swap_step = fmaxf(swap_step, FP32_ABS(foc.out.i_dq.q - iq_ref));
+    bump      = fmaxf(bump, FP32_ABS(foc.out.i_dq.q - iq_keep[i]));
+    iq_ref    = foc.out.i_dq.q;
+  }
+  FP32 after_max = FP32_0;
+  for (U32 i = 0; i < (U32)SIM_FREQ_HZ / 500; i++) {
+    sim_step();
+    after_max = fmaxf(after_max, FP32_ABS(foc.out.i_dq.q - iq_ref));
+    iq_ref    = foc.out.i_dq.q;
+  }
+  for (U32 i = 0; i < (U32)SIM_FREQ_HZ / 10; i++)
+    sim_step();
+
+  FP32 vel = ELEC_TO_MECH(foc.lo.vel_kf.out.vel_rads, (FP32)foc.cfg.motor.npp);
+  printf("[TUNE] %s: bump %.3f a against the old gains, iq ref step %.3f a at the swap, largest "
+         "%.3f a in the 2 ms before and %.3f a after, vel %.3f rad/s\n",
+         name,
+         bump,
+         swap_step,
+         step_max,
+         after_max,
+         vel);
+
+  if (is_stage) {
+    tune_cfg.loop.vel_kp = NAN;
+    ret_e ret            = foc_tune_stage(&foc, &tune_cfg, NULL);
+    printf("[TUNE] %s: nan gain %s, %u applied, %u rejected\n",
+           name,
+           ret == OK ? "accepted" : "rejected",
+           (unsigned)foc.lo.tune.apply_cnt,
+           (unsigned)foc.lo.tune.reject_cnt);
+
+    tune_cfg          = foc.cfg;
+    tune_cfg.loop.div = foc.cfg.loop.div * 2U;
+    ret               = foc_tune_stage(&foc, &tune_cfg, NULL);
+    printf("[TUNE] %s: loop div change %s\n", name, ret == OK ? "accepted" : "rejected");
+
+    // new trajectory limits staged in the middle of a move
+    foc_loop_set(&foc, FOC_LOOP_POS);
+    foc_move(&foc, foc.lo.traj.out.pos + 2.0f);
+    for (U32 i = 0; i < (U32)SIM_FREQ_HZ / 20; i++)
+      sim_step();
+    FP32 vel_max          = foc.lo.traj.cfg.vel_max;
+    tune_cfg              = foc.cfg;
+    tune_cfg.loop.vel_max = vel_max * FP32_1_DIV_2;
+    foc_tune_stage(&foc, &tune_cfg, NULL);
+    BOOL is_kept = TRUE;
+    while (!foc.lo.traj.out.is_done) {
+      sim_step();
+      is_kept = is_kept && (foc.lo.traj.out.is_done || foc.lo.traj.cfg.vel_max == vel_max);
+    }
+    printf("[TUNE] %s: traj limits staged mid move %s until it ends, vel max %.1f after\n",
+           name,
+           is_kept ? "held back" : "taken",
+           foc.lo.traj.cfg.vel_max);
+  }
+}
+
+static pid_ctrl_t sim_vel_pid;
+
+static void
+sim_vel_loop_init(void) {
+  // 20 hz velocity loop on the kalman estimate, outside foc
+  FP32      kt = 1.5f * (FP32)pmsm.cfg.motor.npp * pmsm.cfg.motor.flux;
+  pid_cfg_t pid_cfg;
+  pid_cfg.freq_hz      = SIM_FREQ_HZ;
+  pid_cfg.kp           = pmsm.cfg.motor.j * FP32_2PI * 20.0f / kt;
+  pid_cfg.ki           = pid_cfg.kp * FP32_2PI * 5.0f;
+  pid_cfg.kd           = FP32_0;
+  pid_cfg.out_max      = 10.0f;
+  pid_cfg.integral_max = 10.0f;
+  memset(&sim_vel_pid, 0, sizeof(sim_vel_pid));
+  pid_init(&sim_vel_pid, pid_cfg);
+}
+
+static void
+sim_vel_loop(FP32 mech_vel_rads, U32 tick_num, FP64 *enc_err_rms, FP64 *vel_err_rms) {
+  FP64 enc_sq = 0.0, vel_sq = 0.0;
+  for (U32 i = 0; i < tick_num; i++) {
+    pid_run_in(&sim_vel_pid,
+               mech_vel_rads,
+               ELEC_TO_MECH(foc.in.theta.vel_rads, (FP32)pmsm.cfg.motor.npp));
+    foc.out.i_dq.q = sim_vel_pid.out.val;
+
+    foc_run(&foc);
+    FP32 enc_err = foc.in.theta.mech_theta_rad - pmsm.out.mech_theta_rad;
+    WARP_PI(enc_err);
+    enc_sq += enc_err * enc_err;
+    vel_sq += (pmsm.out.mech_vel_rads - mech_vel_rads) * (pmsm.out.mech_vel_rads - mech_vel_rads);
+
+    pmsm.in.load_nm = sim_cogging_nm * FP32_SIN(12.0f * pmsm.out.mech_theta_rad);
+    pmsm_run(&pmsm);
+  }
+  if (enc_err_rms)
+    *enc_err_rms = sqrt(enc_sq / tick_num);
+  if (vel_err_rms)
+    *vel_err_rms = sqrt(vel_sq / tick_num);
+}
+
+static void
+sim_cali(void) {
+  sim_init();
+  sim_vel_loop_init();
+  sim_enc_err_rad     = 0.01f;
+  sim_cogging_nm      = 0.02f;
+  foc.cfg.is_decouple = TRUE;
+  foc.lo.e_vel        = FOC_VEL_KF;
+
+  FP64 enc_before, enc_after, vel_before, vel_after;
+  U32  tick_num = (U32)SIM_FREQ_HZ;
+
+  // encoder first, at speed where inertia irons out the cogging and with the torque held, a
+  // velocity loop closed on the uncorrected angle would turn the encoder error into real ripple
+  sim_vel_loop(100.0f, tick_num / 2, NULL, NULL);
+  sim_vel_loop(100.0f, tick_num / 2, &enc_before, NULL);
+  FP32 kt        = 1.5f * (FP32)pmsm.cfg.motor.npp * pmsm.cfg.motor.flux;
+  foc.out.i_dq.q = pmsm.cfg.b * pmsm.out.mech_vel_rads / kt;
+  foc_cali_start(&foc, FOC_CALI_ENC, 16, FP32_0);
+  while (foc.lo.cali.e_cali != FOC_CALI_NULL)
+    sim_step();
+  sim_vel_loop(100.0f, tick_num / 2, &enc_after, NULL);
+  printf("[CALI] encoder err rms %.2f mrad -> %.2f mrad (quantum %.2f mrad)\n",
+         enc_before * 1e3,
+         enc_after * 1e3,
+         FP32_2PI / SIM_ENC_CPR * 1e3);
+
+  sim_vel_loop(10.0f, tick_num / 2, NULL, NULL);
+  sim_vel_loop(10.0f, tick_num, NULL, &vel_before);
+  foc_cali_start(&foc, FOC_CALI_COGGING, 8, 0.5f);
+  while (foc.lo.cali.e_cali != FOC_CALI_NULL)
+    sim_vel_loop(10.0f, 1, NULL, NULL);
+  sim_vel_loop(10.0f, tick_num, NULL, &vel_after);
+  printf("[CALI] velocity ripple rms at 10 rad/s %.3f rad/s -> %.3f rad/s\n",
+         vel_before,
+         vel_after);
+}
+
+static void
+sim_cur(const char *name, foc_cur_e e_cur, BOOL is_mismatch, FP32 obs_gain) {
+  sim_init();
+  foc.cfg.is_decouple          = TRUE;
+  foc.lo.e_cur                 = e_cur;
+  foc.lo.deadbeat.cfg.obs_gain = obs_gain;
+  foc.lo.mpc.cfg.is_modulated  = !strstr(name, "switching states");
+
+  // the sim plant applies the output right away, nothing to compensate
+  foc.lo.mpc.cfg.is_delay_comp      = FALSE;
+  foc.lo.deadbeat.cfg.is_delay_comp = FALSE;
+
+  // controller model off from the plant, as from a datasheet and a warm motor
+  if (is_mismatch) {
+    foc.lo.deadbeat.cfg.motor.rs *= 2.0f;
+    foc.lo.deadbeat.cfg.motor.flux *= 1.3f;
+    foc.lo.deadbeat.cfg.motor.ld *= 1.2f;
+    foc.lo.deadbeat.cfg.motor.lq *= 1.2f;
+  }
+
+  pmsm.cfg.motor.j           = 1e3f;
+  pmsm.out.mech_vel_rads     = 100.0f;
+  foc.lo.vel_kf.out.vel_rads = MECH_TO_ELEC(pmsm.out.mech_vel_rads, pmsm.cfg.motor.npp);
+  foc.lo.e_vel               = FOC_VEL_KF;
+
+  for (U32 i = 0; i < (U32)SIM_FREQ_HZ / 20; i++)
+    sim_step();
+
+  U32  rise_tick = 0;
+  FP64 d_sq = 0.0, q_sq = 0.0;
+  U32  cnt       = (U32)SIM_FREQ_HZ / 20;
+  foc.out.i_dq.q = 10.0f;
+  for (U32 i = 0; i < cnt; i++) {
+    sim_step();
+    if (!rise_tick && pmsm.out.i_dq.q >= 9.0f)
+      rise_tick = i + 1U;
+    if (i < cnt / 2)
+      continue;
+    d_sq += pmsm.out.i_dq.d * pmsm.out.i_dq.d;
+    q_sq += (pmsm.out.i_dq.q - 10.0f) * (pmsm.out.i_dq.q - 10.0f);
+  }
+
+  // controller cost alone, plant frozen
+  U32  run_num = 100000;
+  FP64 t0      = sim_now_s();
+  for (U32 i = 0; i < run_num; i++)
+    foc_run(&foc);
+  FP64 run_ns = (sim_now_s() - t0) / run_num * 1e9;
+
+  printf("[CUR] %s: iq 90%% rise %u ticks, ripple rms id %.3f A iq %.3f A, foc_run %.0f ns\n",
+         name,
+         rise_tick,
+         sqrt(d_sq / (cnt / 2)),
+         sqrt(q_sq / (cnt / 2)),
+         run_ns);
+}
+
+int
+main() {
+  sim_fra("iq closed loop", FOC_FRA_IQ_REF, 0.5f, 4000.0f);
+  sim_fra("iq open loop", FOC_FRA_VQ, 0.5f, 4000.0f);
+  sim_fra("velocity closed loop", FOC_FRA_VEL, 5.0f, 500.0f);
+  sim_fra("velocity open loop", FOC_FRA_TORQUE, 0.05f, 500.0f);
+
+  sim_vel("pll", FOC_VEL_PLL);
+  sim_vel("kalman", FOC_VEL_KF);
+
+  // the sim plant applies the duty right after foc_run, half a period to its centre
+  sim_delay("no compensation", FP32_0);
+  sim_delay("inv park compensation", FP32_1_DIV_2);
+
+  sim_ramp("pi only", FALSE);
+  sim_ramp("decoupled", TRUE);
+
+  sim_dead_time("uncompensated", FP32_0, FP32_0);
+  sim_dead_time("compensated", 1e-6f, 1.0f);
+
+  sim_overmod("linear", FALSE);
+  sim_overmod("overmodulation", TRUE);
+
+  sim_mtpa("iq only", FALSE);
+  sim_mtpa("mtpa table", TRUE);
+
+  sim_res("pi only", 20.0f, FALSE);
+  sim_res("pi + resonant 6/12", 20.0f, TRUE);
+  sim_res("pi only", 80.0f, FALSE);
+  sim_res("pi + resonant 6/12", 80.0f, TRUE);
+
+  sim_anf("no notch", FALSE, FALSE);
+  sim_anf("tracking notch", TRUE, FALSE);
+  sim_anf("tracking notch, reset", TRUE, TRUE);
+
+  sim_cali();
+
+  sim_pos("feedback + velocity ff", FALSE);
+  sim_pos("feedback + velocity and acc ff", TRUE);
+  sim_traj_cost();
+
+  sim_update("single update", FALSE);
+  sim_update("double update", TRUE);
+
+  sim_shunt("three shunts", FOC_SHUNT_3, 10.0f, FP32_0);
+  sim_shunt("two shunts", FOC_SHUNT_2, 10.0f, FP32_0);
+  sim_shunt("single shunt, no shift", FOC_SHUNT_1, 10.0f, FP32_0);
+  sim_shunt("single shunt, 2.5 us window", FOC_SHUNT_1, 10.0f, 2.5e-6f);
+  sim_shunt("single shunt, no shift", FOC_SHUNT_1, 200.0f, FP32_0);
+  sim_shunt("single shunt, 2.5 us window", FOC_SHUNT_1, 200.0f, 2.5e-6f);
+
+  sim_adc("single sample, no drift tracking", 0, 0, FP32_0);
+  sim_adc("single sample, 5 hz drift tracking", 0, 0, 5.0f);
+  sim_adc("8x cic1, 5 hz drift tracking", 8, 1, 5.0f);
+  sim_adc("16x cic1, 5 hz drift tracking", 16, 1, 5.0f);
+  sim_adc("16x cic2, 5 hz drift tracking", 16, 2, 5.0f);
+
+  sim_fault("over current", SIM_FAULT_OVER_CUR, FOC_SHUNT_3);
+  sim_fault("i2t", SIM_FAULT_I2T, FOC_SHUNT_3);
+  sim_fault("under voltage", SIM_FAULT_UNDER_VOLT, FOC_SHUNT_3);
+  sim_fault("lost u reading, three shunts", SIM_FAULT_LOST_PHASE, FOC_SHUNT_3);
+  sim_fault("lost u reading, two shunts", SIM_FAULT_LOST_PHASE, FOC_SHUNT_2);
+  sim_fault("held rotor, observer stall", SIM_FAULT_STALL, FOC_SHUNT_3);
+
+  sim_budget("no shedding", FOC_DEGRADE_NULL);
+  sim_budget("shedding", FOC_DEGRADE_OBSERVER);
+
+  sim_replay();
+
+  sim_tune("direct write", FALSE);
+  sim_tune("staged swap", TRUE);
+
+  sim_cur("pi", FOC_CUR_PI, FALSE, FP32_0);
+  sim_cur("mpc, switching states", FOC_CUR_MPC, FALSE, FP32_0);
+  sim_cur("mpc, modulated", FOC_CUR_MPC, FALSE, FP32_0);
+  sim_cur("deadbeat", FOC_CUR_DEADBEAT, FALSE, 0.2f);
+  sim_cur("deadbeat, model off, no observer", FOC_CUR_DEADBEAT, TRUE, FP32_0);
+  sim_cur("deadbeat, model off, observer", FOC_CUR_DEADBEAT, TRUE, 0.2f);
+
+  return 0;
+}
@@ -0,0 +1,182 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "util/util.h"
+
+#include "fifo/fifo.h"
+#include "fifo/mpmc.h"
+
+#define BENCH_REC_NUM  (4000000U) // 所有生产者合计
+#define BENCH_PROD_MAX (8U)
+#define BENCH_CELL_NUM (4096U)
+#define BENCH_BATCH    (16U)
+
+typedef struct {
+  U32 prod;
+  U32 seq;
+  U64 payload;
+} rec_t;
+
+typedef enum {
+  BENCH_SPINLOCK,
+  BENCH_MPMC,
+  BENCH_MPMC_BATCH,
+} bench_e;
+
+static fifo_t  fifo;
+static U8      fifo_buf[BENCH_CELL_NUM * sizeof(rec_t)];
+static mpmc_t  mpmc;
+static U8      mpmc_buf[MPMC_BUF_SIZE(BENCH_CELL_NUM, sizeof(rec_t))] MPMC_ALIGNED;
+static bench_e e_bench;
+static U32     prod_num;
+static U32     cpu_num;
+static U64     err_cnt;
+
+static FP64
+now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (FP64)ts.tv_sec + (FP64)ts.tv_nsec * 1e-9;
+}
+
+static void
+pin(U32 cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu % cpu_num, &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+/*
+ * Every producer checks for space and puts under the one lock, the way FIFO_PUT_SPINLOCK has to
+ * be used with more than one producer.
+ */
+static U32
+fifo_put_rec(const rec_t *rec, U32 num) {
+  pthread_spin_lock(&fifo.lock);
+  U32 n = MIN(num, (fifo.size - (fifo.w - fifo.r)) / (U32)sizeof(rec_t));
+  FIFO_PUT(&fifo, rec, n * sizeof(rec_t));
+  pthread_spin_unlock(&fifo.lock);
+  return n;
+}
+
+static U32
+fifo_get_rec(rec_t *rec, U32 num) {
+  pthread_spin_lock(&fifo.lock);
+  U32 n = MIN(num, (fifo.w - fifo.r) / (U32)sizeof(rec_t));
+  FIFO_GET(&fifo, rec, n * sizeof(rec_t));
+  pthread_spin_unlock(&fifo.lock);
+  return n;
+}
+
+static void *
+producer(void *arg) {
+  U32 id  = (U32)(uintptr_t)arg;
+  U32 num = BENCH_REC_NUM / prod_num;
+  U32 bat = (e_bench == BENCH_MPMC_BATCH) ? BENCH_BATCH : 1U;
+  pin(1U + id);
+
+  rec_t rec[BENCH_BATCH];
+  for (U32 i = 0; i < num;) {
+    U32 n = MIN(bat, num - i);
+    for (U32 k = 0; k < n; k++) {
+      rec[k].prod    = id;
+      rec[k].seq     = i + k;
+      rec[k].payload = ((U64)id << 32) | (i + k);
+    }
+
+    U32 done = 0;
+    while (done < n) {
+      U32 put = (e_bench == BENCH_SPINLOCK) ? fifo_put_rec(rec + done, n - done)
+                                            : mpmc_put_batch(&mpmc, rec + done, n - done);
+      if (!put)
+        sched_yield();
+      done += put;
+    }
+    i += n;
+  }
+  return NULL;
+}
+
+/*
+ * Single consumer, checks that every producer's records arrive whole and in order.
+ */
+static void *
+consumer(void *arg) {
+  (void)arg;
+  pin(0);
+
+  U32   next[BENCH_PROD_MAX] = {0};
+  U32   total                = (BENCH_REC_NUM / prod_num) * prod_num;
+  rec_t rec[BENCH_BATCH];
+  for (U32 got = 0; got < total;) {
+    U32 n = (e_bench == BENCH_SPINLOCK) ? fifo_get_rec(rec, BENCH_BATCH)
+                                        : mpmc_get_batch(&mpmc, rec, BENCH_BATCH);
+    if (!n) {
+      sched_yield();
+      continue;
+    }
+    for (U32 k = 0; k < n; k++) {
+      U32 id = rec[k].prod;
+      if (id >= prod_num || rec[k].seq != next[id]
+          || rec[k].payload != (((U64)id << 32) | rec[k].seq)) {
+        err_cnt++;
+        continue;
+      }
+      next[id]++;
+    }
+    got += n;
+  }
+  return NULL;
+}
+
+static FP64
+run(bench_e e, U32 num) {
+  e_bench  = e;
+  prod_num = num;
+  err_cnt  = 0;
+  U32 size = sizeof(fifo_buf);
+  FIFO_INIT(&fifo, fifo_buf, size);
+  mpmc_init(&mpmc, mpmc_buf, BENCH_CELL_NUM, sizeof(rec_t));
+
+  pthread_t ct, pt[BENCH_PROD_MAX];
+  FP64      t0 = now_s();
+  pthread_create(&ct, NULL, consumer, NULL);
+  for (U32 i = 0; i < num; i++)
+    pthread_create(&pt[i], NULL, producer, (void *)(uintptr_t)i);
+  for (U32 i = 0; i < num; i++)
+    pthread_join(pt[i], NULL);
+  pthread_join(ct, NULL);
+  FP64 t = now_s() - t0;
+
+  return (FP64)((BENCH_REC_NUM / num) * num) / t * 1e-6;
+}
+
+int
+main() {
+  cpu_num = (U32)sysconf(_SC_NPROCESSORS_ONLN);
+  printf("[MPMC] %u byte records, %u cells, %u cpus online, consumer on cpu 0\n",
+         (unsigned)sizeof(rec_t),
+         BENCH_CELL_NUM,
+         (unsigned)cpu_num);
+  printf("%10s %16s %16s %16s\n", "producers", "spinlock M/s", "mpmc M/s", "mpmc x16 M/s");
+
+  U64 err = 0;
+  for (U32 num = 1; num <= BENCH_PROD_MAX; num *= 2) {
+    FP64 spin = run(BENCH_SPINLOCK, num);
+    err += err_cnt;
+    FP64 one = run(BENCH_MPMC, num);
+    err += err_cnt;
+    FP64 batch = run(BENCH_MPMC_BATCH, num);
+    err += err_cnt;
+    printf("%10u %16.1f %16.1f %16.1f\n", (unsigned)num, spin, one, batch);
+  }
+  printf("[MPMC] %llu errors\n", (unsigned long long)err);
+
+  return 0;
+}
@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define MTPA_GEN
+#include "controller/mtpa.h"
+
+#define GEN_TORQUE_NUM (32U)
+#define GEN_SPEED_NUM  (32U)
+#define GEN_TEST_NUM   (2000U)
+
+static FP64
+now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (FP64)ts.tv_sec + (FP64)ts.tv_nsec * 1e-9;
+}
+
+int
+main(int argc, char **argv) {
+  const char *path = (argc > 1) ? argv[1] : "build/mtpa.bin";
+
+  // interior pm example, ld < lq so mtpa needs negative id already at standstill
+  mtpa_gen_cfg_t gen = {
+    .motor      = {.npp = 4, .ld = 0.2e-3f, .lq = 0.5e-3f, .ls = 0.35e-3f, .rs = 0.05f, .flux = 0.01f},
+    .torque_num = GEN_TORQUE_NUM,
+    .speed_num  = GEN_SPEED_NUM,
+    .cur_max    = 50.0f,
+    .v_max      = FP32_1_DIV_SQRT_3,
+    .speed_max  = 250.0f,
+  };
+
+  size_t      size = MTPA_TBL_SIZE(GEN_TORQUE_NUM, GEN_SPEED_NUM);
+  mtpa_tbl_t *tbl  = malloc(size);
+  mtpa_tbl_gen(tbl, gen);
+
+  FILE *file = fopen(path, "wb");
+  if (!file || fwrite(tbl, 1, size, file) != size) {
+    printf("write %s failed\n", path);
+    return 1;
+  }
+  fclose(file);
+
+  // run from what was written, not from the generator's buffer
+  mtpa_tbl_t *blob = malloc(size);
+  file             = fopen(path, "rb");
+  if (!file || fread(blob, 1, size, file) != size) {
+    printf("read %s failed\n", path);
+    return 1;
+  }
+  fclose(file);
+
+  mtpa_t     mtpa;
+  mtpa_cfg_t mtpa_cfg = {.tbl = blob};
+  if (mtpa_init(&mtpa, mtpa_cfg) != OK) {
+    printf("bad table\n");
+    return 1;
+  }
+  printf("[MTPA] %s: %zu bytes, torque 0..%.2f Nm, speed 0..%.0f rad/s/V\n",
+         path,
+         size,
+         blob->torque_max,
+         blob->speed_max);
+
+  FP32 torque[GEN_TEST_NUM], speed[GEN_TEST_NUM];
+  srand(1);
+  for (U32 i = 0; i < GEN_TEST_NUM; i++) {
+    torque[i] = (FP32)rand() / (FP32)RAND_MAX * blob->torque_max;
+    speed[i]  = (FP32)rand() / (FP32)RAND_MAX * blob->speed_max;
+  }
+
+  // accuracy against the exact solve, away from the torque limit where both clip
+  FP64 err_max = 0.0, err_sum = 0.0;
+  U32  err_cnt = 0;
+  for (U32 i = 0; i < GEN_TEST_NUM; i++) {
+    FP64 id = 0.0, iq = 0.0;
+    if (!mtpa_solve(&gen, torque[i], speed[i], &id, &iq))
+      continue;
+    mtpa_run_in(&mtpa, torque[i], speed[i] * 48.0f, 48.0f);
+    FP64 err = hypot(mtpa.out.i_dq.d - id, mtpa.out.i_dq.q - iq);
+    err_sum += err;
+    err_max = err > err_max ? err : err_max;
+    err_cnt++;
+  }
+  printf("[MTPA] %u points, current err mean %.3f A, max %.3f A\n",
+         err_cnt,
+         err_sum / err_cnt,
+         err_max);
+
+  FP64 t0  = now_s();
+  FP32 sum = FP32_0;
+  for (U32 k = 0; k < 500U; k++) {
+    for (U32 i = 0; i < GEN_TEST_NUM; i++) {
+      mtpa_run_in(&mtpa, torque[i], speed[i] * 48.0f, 48.0f);
+      sum += mtpa.out.i_dq.d;
+    }
+  }
+  FP64 t_lut = (now_s() - t0) / (500.0 * GEN_TEST_NUM);
+
+  t0 = now_s();
+  for (U32 i = 0; i < 200U; i++) {
+    FP64 id = 0.0, iq = 0.0;
+    mtpa_solve(&gen, torque[i], speed[i], &id, &iq);
+    sum += (FP32)id;
+  }
+  FP64 t_solve = (now_s() - t0) / 200.0;
+
+  printf("[MTPA] lookup %.1f ns, direct solve %.1f us (checksum %.1f)\n",
+         t_lut * 1e9,
+         t_solve * 1e6,
+         sum);
+
+  free(tbl);
+  free(blob);
+  return 0;
+}
@@ -0,0 +1,131 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "util/mathdef.h"
+#include "util/typedef.h"
+
+/*
+ * Host stand-ins for the CMSIS calls transform/fft.h makes, a plain DFT packed the way
+ * arm_rfft_fast_f32() packs it: re of DC and nyquist first, then re, im of bins 1 .. N/2 - 1.
+ */
+typedef struct {
+  U32 fft_len;
+} arm_rfft_fast_instance_f32;
+
+#define CHECK_RFFT_INIT(n)                                                                         \
+  static inline void arm_rfft_fast_init_##n##_f32(arm_rfft_fast_instance_f32 *S) {                 \
+    S->fft_len = n;                                                                                \
+  }
+CHECK_RFFT_INIT(32)
+CHECK_RFFT_INIT(64)
+CHECK_RFFT_INIT(128)
+CHECK_RFFT_INIT(256)
+CHECK_RFFT_INIT(512)
+CHECK_RFFT_INIT(1024)
+CHECK_RFFT_INIT(2048)
+CHECK_RFFT_INIT(4096)
+
+static inline void
+arm_rfft_fast_f32(const arm_rfft_fast_instance_f32 *S, FP32 *p, FP32 *out, U8 flag) {
+  U32 n = S->fft_len;
+  (void)flag;
+  for (U32 k = 0; k <= n / 2; k++) {
+    FP64 re = 0.0, im = 0.0;
+    for (U32 i = 0; i < n; i++) {
+      FP64 x = 2.0 * M_PI * (FP64)((k * i) % n) / (FP64)n;
+      re += p[i] * cos(x);
+      im -= p[i] * sin(x);
+    }
+    if (k == 0) {
+      out[0] = (FP32)re;
+    } else if (k == n / 2) {
+      out[1] = (FP32)re;
+    } else {
+      out[2 * k]     = (FP32)re;
+      out[2 * k + 1] = (FP32)im;
+    }
+  }
+}
+
+static inline void
+arm_cmplx_mag_squared_f32(const FP32 *src, FP32 *dst, U32 num) {
+  for (U32 i = 0; i < num; i++)
+    dst[i] = src[2 * i] * src[2 * i] + src[2 * i + 1] * src[2 * i + 1];
+}
+
+static inline void
+arm_cmplx_mag_f32(const FP32 *src, FP32 *dst, U32 num) {
+  arm_cmplx_mag_squared_f32(src, dst, num);
+  for (U32 i = 0; i < num; i++)
+    dst[i] = sqrtf(dst[i]);
+}
+
+static inline void
+arm_max_f32(const FP32 *src, U32 num, FP32 *val, U32 *idx) {
+  *val = src[0];
+  *idx = 0;
+  for (U32 i = 1; i < num; i++) {
+    if (src[i] > *val) {
+      *val = src[i];
+      *idx = i;
+    }
+  }
+}
+
+#include "transform/psd.h"
+
+#define CHECK_FS_HZ   (6400.0f)
+#define CHECK_BIN_HZ  (CHECK_FS_HZ / (FP32)FFT_POINT_SIZE)
+#define CHECK_TONE_HZ (8.0f * CHECK_BIN_HZ)
+#define CHECK_AMP     (1.5f)
+#define CHECK_DC      (0.4f)
+#define CHECK_POW_TOL (0.02f)
+#define CHECK_HZ_TOL  (0.01f * CHECK_BIN_HZ)
+
+static U32 err_cnt;
+
+static void
+check(const char *name, FP32 val, FP32 ref, FP32 tol) {
+  BOOL ok = fabsf(val - ref) <= tol;
+  printf("[PSD] %-26s: %10.4f (%10.4f) %s\n", name, val, ref, ok ? "ok" : "FAIL");
+  err_cnt += !ok;
+}
+
+/*
+ * A DC offset plus a tone on a bin, Hann window and half overlap. Summed over the bins the
+ * density gives the signal power, DC^2 + A^2 / 2, the tone is the one peak.
+ */
+int
+main() {
+  psd_t     psd;
+  psd_cfg_t cfg = {
+      .sample_rate_hz = CHECK_FS_HZ,
+      .e_window       = PSD_WINDOW_HANN,
+      .hop_size       = FFT_POINT_SIZE / 2,
+      .avg_alpha      = 0.5f,
+      .peak_num       = 1,
+  };
+  psd_init(&psd, cfg);
+
+  U32 n = 0;
+  for (; n < 16U * FFT_POINT_SIZE; n++) {
+    FP32 x = FP32_2PI * CHECK_TONE_HZ * (FP32)n / CHECK_FS_HZ + 0.7f;
+    psd_run_in(&psd, CHECK_DC + CHECK_AMP * cosf(x));
+  }
+
+  FP32 pow = FP32_0;
+  for (U32 k = 0; k < PSD_BIN_NUM; k++)
+    pow += psd.out.psd[k] * CHECK_BIN_HZ;
+
+  FP32 pow_ref = CHECK_DC * CHECK_DC + CHECK_AMP * CHECK_AMP / FP32_2;
+  check("total power", pow, pow_ref, CHECK_POW_TOL * pow_ref);
+  check("peak freq hz", psd.out.peak_freq_hz[0], CHECK_TONE_HZ, CHECK_HZ_TOL);
+  check("peak num", (FP32)psd.out.peak_num, 1.0f, 0.0f);
+  U32 frame_ref = (n - FFT_POINT_SIZE) / cfg.hop_size + 1U;
+  check("frames", (FP32)psd.out.frame_cnt, (FP32)frame_ref, 0.0f);
+  check("frames dropped or torn", (FP32)(psd.out.frame_drop + psd.out.frame_torn), 0.0f, 0.0f);
+
+  printf("[PSD] %u errors\n", (unsigned)err_cnt);
+  return err_cnt ? 1 : 0;
+}
@@ -0,0 +1,90 @@
+#include <math.h>
+#include <stdio.h>
+
+#include "transform/sdft.h"
+
+#define CHECK_FS_HZ   (10000.0f)
+#define CHECK_BIN_HZ  (CHECK_FS_HZ / (FP32)SDFT_POINT_SIZE)
+#define CHECK_AMP_TOL (0.01f)
+#define CHECK_PHI_TOL (0.01f)
+
+typedef struct {
+  FP32 freq_hz;
+  FP32 amp;
+  FP32 phi_rad;
+} tone_t;
+
+/* 两个整数周期的正弦, 窗内无泄漏 */
+static const tone_t tone[] = {
+    {5.0f * CHECK_BIN_HZ, 1.5f, 0.3f},
+    {9.0f * CHECK_BIN_HZ, 0.4f, -1.1f},
+};
+
+static U32 err_cnt;
+
+static FP32
+sample(U32 n) {
+  FP32 val = 0.0f;
+  for (U32 i = 0; i < sizeof(tone) / sizeof(tone[0]); i++)
+    val += tone[i].amp * cosf(FP32_2PI * tone[i].freq_hz * (FP32)n / CHECK_FS_HZ + tone[i].phi_rad);
+  return val;
+}
+
+static FP32
+wrap(FP32 rad) {
+  return atan2f(sinf(rad), cosf(rad));
+}
+
+/*
+ * After sample n the bin phase is minus that of the newest sample, see transform/sdft.h.
+ */
+static void
+check(const char *name, sdft_t *sdft, U32 bin, const tone_t *t, U32 n) {
+  FP32 phi = atan2f(sdft->out.im[bin], sdft->out.re[bin]);
+  FP32 ref = -wrap(FP32_2PI * t->freq_hz * (FP32)n / CHECK_FS_HZ + t->phi_rad);
+  FP32 e_a = sdft->out.amp[bin] - t->amp;
+  FP32 e_p = wrap(phi - ref);
+  BOOL ok  = fabsf(e_a) < CHECK_AMP_TOL && fabsf(e_p) < CHECK_PHI_TOL;
+
+  printf("[SDFT] %-24s: %7.1f Hz, amp %.4f (%.4f), phase %+.4f (%+.4f) %s\n",
+         name,
+         t->freq_hz,
+         sdft->out.amp[bin],
+         t->amp,
+         phi,
+         ref,
+         ok ? "ok" : "FAIL");
+  err_cnt += !ok;
+}
+
+int
+main() {
+  sdft_t     sdft;
+  sdft_cfg_t cfg = {
+      .sample_rate_hz = CHECK_FS_HZ,
+      .bin_num        = 2,
+      .bin_freq_hz    = {tone[0].freq_hz, tone[1].freq_hz},
+  };
+  sdft_init(&sdft, cfg);
+
+  U32 n = 0;
+  for (; n < 4U * SDFT_POINT_SIZE; n++)
+    sdft_run_in(&sdft, sample(n));
+  check("bin 0", &sdft, 0, &tone[0], n - 1U);
+  check("bin 1", &sdft, 1, &tone[1], n - 1U);
+
+  // swap the bins, each has to read the other tone right away
+  sdft_set_bin(&sdft, 0, tone[1].freq_hz);
+  sdft_set_bin(&sdft, 1, tone[0].freq_hz);
+  sdft_run_in(&sdft, sample(n++));
+  check("bin 0 retuned, 1 sample", &sdft, 0, &tone[1], n - 1U);
+  check("bin 1 retuned, 1 sample", &sdft, 1, &tone[0], n - 1U);
+
+  for (U32 end = n + 10000U; n < end; n++)
+    sdft_run_in(&sdft, sample(n));
+  check("bin 0 retuned, long run", &sdft, 0, &tone[1], n - 1U);
+  check("bin 1 retuned, long run", &sdft, 1, &tone[0], n - 1U);
+
+  printf("[SDFT] %u errors\n", (unsigned)err_cnt);
+  return err_cnt ? 1 : 0;
+}
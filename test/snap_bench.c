@@ -0,0 +1,174 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "foc/foc.h"
+
+#define BENCH_TICK_NUM (20000000U)
+#define BENCH_SOLO_NUM (2000000U)
+
+static foc_t        foc;
+static volatile U32 is_done;
+
+typedef struct {
+  U64  read_cnt;
+  U64  torn_cnt;
+  U64  retry_cnt;
+  FP64 s;
+} reader_t;
+
+static FP64
+now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (FP64)ts.tv_sec + (FP64)ts.tv_nsec * 1e-9;
+}
+
+static void
+pin(U32 cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu % (U32)sysconf(_SC_NPROCESSORS_ONLN), &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+/*
+ * Every published value is the tick number, a copy is torn when they disagree.
+ */
+static void
+tick(U32 k) {
+  FP32 v                 = (FP32)(k & 0xFFFFFU);
+  foc.lo.exec_cnt        = k;
+  foc.in.theta.theta_rad = v;
+  foc.in.theta.vel_rads  = v;
+  foc.in.theta.pos_rad   = v;
+  foc.in.v_bus           = v;
+  foc.in.i_dq.d          = v;
+  foc.in.i_dq.q          = v;
+  foc.out.v_dq.d         = v;
+  foc.out.v_dq.q         = v;
+  foc.out.i_dq.d         = v;
+  foc.out.i_dq.q         = v;
+  foc.out.torque_ref     = v;
+}
+
+static BOOL
+is_torn(const foc_snap_t *s) {
+  FP32 v = (FP32)(s->exec_cnt & 0xFFFFFU);
+  return s->theta_rad != v || s->vel_rads != v || s->pos_rad != v || s->v_bus != v
+         || s->i_dq.d != v || s->i_dq.q != v || s->v_dq.d != v || s->v_dq.q != v
+         || s->i_dq_ref.d != v || s->i_dq_ref.q != v || s->torque_ref != v;
+}
+
+static void *
+writer(void *arg) {
+  FP64 *s = (FP64 *)arg;
+  pin(0);
+  FP64 t0 = now_s();
+  for (U32 k = 1; k <= BENCH_TICK_NUM; k++) {
+    tick(k);
+    foc_snap_publish(&foc);
+  }
+  *s      = now_s() - t0;
+  is_done = TRUE;
+  return NULL;
+}
+
+/*
+ * Today's telemetry, the fields read straight out of the running foc_t.
+ */
+static void *
+reader_direct(void *arg) {
+  reader_t *r = (reader_t *)arg;
+  pin(1);
+  FP64 t0 = now_s();
+  while (!is_done) {
+    const volatile foc_t *f = &foc;
+    foc_snap_t            s;
+    s.exec_cnt   = f->lo.exec_cnt;
+    s.theta_rad  = f->in.theta.theta_rad;
+    s.vel_rads   = f->in.theta.vel_rads;
+    s.pos_rad    = f->in.theta.pos_rad;
+    s.v_bus      = f->in.v_bus;
+    s.i_dq.d     = f->in.i_dq.d;
+    s.i_dq.q     = f->in.i_dq.q;
+    s.v_dq.d     = f->out.v_dq.d;
+    s.v_dq.q     = f->out.v_dq.q;
+    s.i_dq_ref.d = f->out.i_dq.d;
+    s.i_dq_ref.q = f->out.i_dq.q;
+    s.torque_ref = f->out.torque_ref;
+    r->torn_cnt += is_torn(&s);
+    r->read_cnt++;
+  }
+  r->s = now_s() - t0;
+  return NULL;
+}
+
+static void *
+reader_snap(void *arg) {
+  reader_t *r = (reader_t *)arg;
+  pin(1);
+  FP64 t0 = now_s();
+  while (!is_done) {
+    foc_snap_t s;
+    r->retry_cnt += foc_snap_get(&foc, &s);
+    r->torn_cnt += is_torn(&s);
+    r->read_cnt++;
+  }
+  r->s = now_s() - t0;
+  return NULL;
+}
+
+static void
+run(const char *name, void *(*f_reader)(void *)) {
+  memset(&foc, 0, sizeof(foc));
+  is_done = FALSE;
+
+  reader_t  r;
+  FP64      w_s = 0;
+  pthread_t wt, rt;
+  memset(&r, 0, sizeof(r));
+  pthread_create(&rt, NULL, f_reader, &r);
+  pthread_create(&wt, NULL, writer, &w_s);
+  pthread_join(wt, NULL);
+  pthread_join(rt, NULL);
+
+  printf("[SNAP] %-16s: writer %.1f ns/tick, reader %.1f ns/read, %llu reads, %llu torn, "
+         "%.3f retries/read\n",
+         name,
+         w_s / BENCH_TICK_NUM * 1e9,
+         r.s / (FP64)r.read_cnt * 1e9,
+         (unsigned long long)r.read_cnt,
+         (unsigned long long)r.torn_cnt,
+         (FP64)r.retry_cnt / (FP64)r.read_cnt);
+}
+
+int
+main() {
+  // writer alone, the publish cost with and without the lock around the copy
+  memset(&foc, 0, sizeof(foc));
+  FP64 t0 = now_s();
+  for (U32 k = 1; k <= BENCH_SOLO_NUM; k++) {
+    tick(k);
+    foc_snap_publish(&foc);
+  }
+  FP64 t_pub = now_s() - t0;
+
+  t0 = now_s();
+  for (U32 k = 1; k <= BENCH_SOLO_NUM; k++)
+    tick(k);
+  FP64 t_tick = now_s() - t0;
+
+  printf("[SNAP] publish, no reader : %.2f ns/tick over the field writes, %u bytes\n",
+         (t_pub - t_tick) / BENCH_SOLO_NUM * 1e9,
+         (unsigned)sizeof(foc_snap_t));
+  printf("[SNAP] %ld cpus online\n", sysconf(_SC_NPROCESSORS_ONLN));
+
+  run("direct fields", reader_direct);
+  run("snapshot", reader_snap);
+
+  return 0;
+}
@@ -0,0 +1,220 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "util/util.h"
+
+#include "fifo/fifo.h"
+#include "fifo/spsc.h"
+
+#define BENCH_MSG_NUM  (4000000U)
+#define BENCH_PING_NUM (100000U)
+#define BENCH_BATCH    (32U)
+#define BENCH_RING     (64U * 1024U)
+
+typedef struct {
+  U64 seq;
+  U64 payload;
+} msg_t;
+
+typedef enum {
+  BENCH_SPINLOCK,
+  BENCH_SPSC,
+  BENCH_SPSC_BATCH,
+} bench_e;
+
+typedef struct {
+  fifo_t fifo;
+  spsc_t spsc;
+  U8     fifo_buf[BENCH_RING];
+  U8     spsc_buf[BENCH_RING];
+} ring_t;
+
+static ring_t  ring[2];
+static bench_e e_bench;
+static U64     err_cnt;
+static FP64    lat[BENCH_PING_NUM];
+
+static FP64
+now_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (FP64)ts.tv_sec + (FP64)ts.tv_nsec * 1e-9;
+}
+
+static int
+cmp_fp64(const void *a, const void *b) {
+  FP64 x = *(const FP64 *)a, y = *(const FP64 *)b;
+  return (x > y) - (x < y);
+}
+
+static void
+pin(U32 cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu % (U32)sysconf(_SC_NPROCESSORS_ONLN), &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+static void
+ring_init(ring_t *q) {
+  U32 size = BENCH_RING;
+  FIFO_INIT(&q->fifo, q->fifo_buf, size);
+  spsc_init(&q->spsc, q->spsc_buf, BENCH_RING);
+}
+
+/*
+ * One message, waits by yielding so the bench also makes progress with both threads on one cpu.
+ */
+static void
+put(ring_t *q, const msg_t *msg, BOOL is_flush) {
+  for (;;) {
+    if (e_bench == BENCH_SPINLOCK) {
+      fifo_t *f = &q->fifo;
+      if (f->size - (f->w - f->r) >= sizeof(*msg)) {
+        FIFO_PUT_SPINLOCK(f, msg, sizeof(*msg));
+        return;
+      }
+    } else if (e_bench == BENCH_SPSC) {
+      if (spsc_put(&q->spsc, msg, sizeof(*msg)))
+        return;
+    } else {
+      if (spsc_put_defer(&q->spsc, msg, sizeof(*msg))) {
+        if (is_flush)
+          spsc_publish(&q->spsc);
+        return;
+      }
+      spsc_publish(&q->spsc);
+    }
+    sched_yield();
+  }
+}
+
+static void
+get(ring_t *q, msg_t *msg, BOOL is_flush) {
+  for (;;) {
+    if (e_bench == BENCH_SPINLOCK) {
+      fifo_t *f = &q->fifo;
+      pthread_spin_lock(&f->lock);
+      BOOL is_ok = (f->w - f->r >= sizeof(*msg));
+      if (is_ok)
+        FIFO_GET(f, msg, sizeof(*msg));
+      pthread_spin_unlock(&f->lock);
+      if (is_ok)
+        return;
+    } else if (e_bench == BENCH_SPSC) {
+      if (spsc_get(&q->spsc, msg, sizeof(*msg)))
+        return;
+    } else {
+      if (spsc_get_defer(&q->spsc, msg, sizeof(*msg))) {
+        if (is_flush)
+          spsc_release(&q->spsc);
+        return;
+      }
+      spsc_release(&q->spsc);
+    }
+    sched_yield();
+  }
+}
+
+static void *
+producer(void *arg) {
+  (void)arg;
+  pin(0);
+  for (U32 i = 0; i < BENCH_MSG_NUM; i++) {
+    msg_t msg = {i, ~(U64)i};
+    put(&ring[0], &msg, (i % BENCH_BATCH) == BENCH_BATCH - 1U || i == BENCH_MSG_NUM - 1U);
+  }
+  return NULL;
+}
+
+static void *
+consumer(void *arg) {
+  (void)arg;
+  pin(1);
+  for (U32 i = 0; i < BENCH_MSG_NUM; i++) {
+    msg_t msg;
+    get(&ring[0], &msg, (i % BENCH_BATCH) == BENCH_BATCH - 1U);
+    err_cnt += (msg.seq != i || msg.payload != ~(U64)i);
+  }
+  return NULL;
+}
+
+static void *
+echo(void *arg) {
+  (void)arg;
+  pin(1);
+  for (U32 i = 0; i < BENCH_PING_NUM; i++) {
+    msg_t msg;
+    get(&ring[0], &msg, TRUE);
+    put(&ring[1], &msg, TRUE);
+  }
+  return NULL;
+}
+
+static void
+run(const char *name, bench_e e) {
+  e_bench = e;
+  err_cnt = 0;
+  ring_init(&ring[0]);
+  ring_init(&ring[1]);
+
+  pthread_t pt, ct;
+  FP64      t0 = now_s();
+  pthread_create(&ct, NULL, consumer, NULL);
+  pthread_create(&pt, NULL, producer, NULL);
+  pthread_join(pt, NULL);
+  pthread_join(ct, NULL);
+  FP64 t = now_s() - t0;
+
+  printf("[SPSC] %-16s: %.1f M msg/s, %.1f ns/msg, %llu errors\n",
+         name,
+         BENCH_MSG_NUM / t * 1e-6,
+         t / BENCH_MSG_NUM * 1e9,
+         (unsigned long long)err_cnt);
+}
+
+/*
+ * One message there and back at a time, nothing to batch.
+ */
+static void
+ping(const char *name, bench_e e) {
+  e_bench = e;
+  ring_init(&ring[0]);
+  ring_init(&ring[1]);
+  pin(0);
+
+  pthread_t et;
+  pthread_create(&et, NULL, echo, NULL);
+  for (U32 i = 0; i < BENCH_PING_NUM; i++) {
+    msg_t msg = {i, 0};
+    FP64  t0  = now_s();
+    put(&ring[0], &msg, TRUE);
+    get(&ring[1], &msg, TRUE);
+    lat[i] = now_s() - t0;
+  }
+  pthread_join(et, NULL);
+  qsort(lat, BENCH_PING_NUM, sizeof(lat[0]), cmp_fp64);
+
+  printf("[SPSC] %-16s: round trip %.0f ns median, %.0f ns p99\n",
+         name,
+         lat[BENCH_PING_NUM / 2] * 1e9,
+         lat[BENCH_PING_NUM * 99 / 100] * 1e9);
+}
+
+int
+main() {
+  printf("[SPSC] %u byte messages, %ld cpus online\n",
+         (unsigned)sizeof(msg_t),
+         sysconf(_SC_NPROCESSORS_ONLN));
+  run("spinlock fifo", BENCH_SPINLOCK);
+  run("spsc", BENCH_SPSC);
+  run("spsc, batch 32", BENCH_SPSC_BATCH);
+  ping("spinlock fifo", BENCH_SPINLOCK);
+  ping("spsc", BENCH_SPSC);
+  return 0;
+}
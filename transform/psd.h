@@ -0,0 +1,248 @@
+#ifndef PSD_H
+#define PSD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+
+#include "transform/fft.h"
+#include "util/mathdef.h"
+#include "util/typedef.h"
+#include "util/util.h"
+
+/*
+ * Streaming Welch PSD on top of fft_t.
+ * psd_add_value() is the producer (ISR side): every sample is written twice into a mirrored
+ * ring of 2 * FFT_POINT_SIZE, so the latest frame is always one contiguous span and the
+ * producer never waits for the consumer. Every hop_size samples a new frame is published, its
+ * start and then its sequence number with release stores.
+ * psd_run() is the consumer: the window is applied while loading the fft scratch buffer,
+ * which is the only copy per frame. A frame is overwritten FFT_POINT_SIZE samples after it was
+ * published, so the sequence number is read again after the copy and a frame the producer may
+ * have reached meanwhile is dropped and counted in frame_torn.
+ */
+
+#define PSD_RING_SIZE (LF(1) * FFT_POINT_SIZE)
+#define PSD_BIN_NUM   (FFT_POINT_SIZE / 2)
+
+#ifndef PSD_PEAK_MAX
+#define PSD_PEAK_MAX (4U)
+#endif
+
+typedef enum {
+  PSD_WINDOW_RECT,
+  PSD_WINDOW_HANN,
+  PSD_WINDOW_HAMMING,
+  PSD_WINDOW_BLACKMAN,
+} psd_window_e;
+
+typedef struct {
+  FP32         sample_rate_hz;
+  psd_window_e e_window;
+  U32          hop_size;  // 帧移, [1, FFT_POINT_SIZE]
+  FP32         avg_alpha; // 指数平均系数, (0, 1]
+  U32          peak_num;  // 峰值个数, [0, PSD_PEAK_MAX]
+} psd_cfg_t;
+
+typedef struct {
+  FP32 val;
+} psd_in_t;
+
+typedef struct {
+  FP32 psd[PSD_BIN_NUM];
+  U32  peak_num;
+  FP32 peak_freq_hz[PSD_PEAK_MAX];
+  FP32 peak_val[PSD_PEAK_MAX];
+  U32  frame_cnt;
+  U32  frame_drop;
+  U32  frame_torn; // 复制时已被覆盖的帧
+} psd_out_t;
+
+typedef struct {
+  FP32         ring[LF(1) * PSD_RING_SIZE];
+  FP32         win[FFT_POINT_SIZE];
+  FP32         scale;
+  U32          idx_added;
+  U32          hop_cnt;
+  volatile U32 frame_start;
+  volatile U32 frame_seq;
+  U32          frame_done;
+  fft_t        fft;
+} psd_lo_t;
+
+typedef struct {
+  psd_cfg_t cfg;
+  psd_in_t  in;
+  psd_out_t out;
+  psd_lo_t  lo;
+} psd_t;
+
+#define DECL_PSD_PTRS(psd)                                                                         \
+  psd_t     *p   = (psd);                                                                          \
+  psd_cfg_t *cfg = &p->cfg;                                                                        \
+  psd_in_t  *in  = &p->in;                                                                         \
+  psd_out_t *out = &p->out;                                                                        \
+  psd_lo_t  *lo  = &p->lo;
+
+#define DECL_PSD_PTRS_PREFIX(psd, prefix)                                                          \
+  psd_t     *prefix##_p   = (psd);                                                                 \
+  psd_cfg_t *prefix##_cfg = &prefix##_p->cfg;                                                      \
+  psd_in_t  *prefix##_in  = &prefix##_p->in;                                                       \
+  psd_out_t *prefix##_out = &prefix##_p->out;                                                      \
+  psd_lo_t  *prefix##_lo  = &prefix##_p->lo;
+
+static inline void
+psd_init(psd_t *psd, psd_cfg_t psd_cfg) {
+  DECL_PSD_PTRS(psd);
+
+  *cfg = psd_cfg;
+  if (cfg->hop_size == 0 || cfg->hop_size > FFT_POINT_SIZE)
+    cfg->hop_size = FFT_POINT_SIZE;
+  if (cfg->avg_alpha <= FP32_0 || cfg->avg_alpha > FP32_1)
+    cfg->avg_alpha = FP32_1;
+  if (cfg->peak_num > PSD_PEAK_MAX)
+    cfg->peak_num = PSD_PEAK_MAX;
+
+  memset(in, 0, sizeof(*in));
+  memset(out, 0, sizeof(*out));
+  memset(lo, 0, sizeof(*lo));
+
+  FP32 pow_sum = FP32_0;
+  for (U32 i = 0; i < FFT_POINT_SIZE; i++) {
+    FP32 x = FP32_2PI * (FP32)i / (FP32)FFT_POINT_SIZE;
+    switch (cfg->e_window) {
+    case PSD_WINDOW_HANN:
+      lo->win[i] = 0.5f - 0.5f * FP32_COS(x);
+      break;
+    case PSD_WINDOW_HAMMING:
+      lo->win[i] = 0.54f - 0.46f * FP32_COS(x);
+      break;
+    case PSD_WINDOW_BLACKMAN:
+      lo->win[i] = 0.42f - 0.5f * FP32_COS(x) + 0.08f * FP32_COS(FP32_2 * x);
+      break;
+    case PSD_WINDOW_RECT:
+    default:
+      lo->win[i] = FP32_1;
+      break;
+    }
+    pow_sum += lo->win[i] * lo->win[i];
+  }
+
+  // one-sided density, units^2 / Hz
+  lo->scale = FP32_2 / (cfg->sample_rate_hz * pow_sum);
+
+  fft_cfg_t fft_cfg;
+  fft_cfg.sample_rate_hz = cfg->sample_rate_hz;
+  fft_init(&lo->fft, fft_cfg);
+}
+
+static inline void
+psd_add_value(psd_t *psd, FP32 value) {
+  DECL_PSD_PTRS(psd);
+
+  U32 idx = lo->idx_added & (PSD_RING_SIZE - 1);
+
+  lo->ring[idx]                 = value;
+  lo->ring[idx + PSD_RING_SIZE] = value;
+  lo->idx_added++;
+
+  // the first frame goes out as soon as the window is full, then one every hop_size samples
+  if (lo->idx_added < FFT_POINT_SIZE
+      || (lo->idx_added > FFT_POINT_SIZE && ++lo->hop_cnt < cfg->hop_size))
+    return;
+
+  lo->hop_cnt = 0;
+  __atomic_store_n(
+      &lo->frame_start, (lo->idx_added - FFT_POINT_SIZE) & (PSD_RING_SIZE - 1), __ATOMIC_RELEASE);
+  __atomic_store_n(&lo->frame_seq, lo->frame_seq + 1U, __ATOMIC_RELEASE);
+}
+
+static inline void
+psd_peak_update(psd_t *psd) {
+  DECL_PSD_PTRS(psd);
+
+  out->peak_num = 0;
+  for (U32 k = 1; k < PSD_BIN_NUM - 1; k++) {
+    FP32 a = out->psd[k - 1], b = out->psd[k], c = out->psd[k + 1];
+    if (b <= a || b < c)
+      continue;
+
+    U32 pos = out->peak_num;
+    while (pos > 0 && out->peak_val[pos - 1] < b)
+      pos--;
+    if (pos >= cfg->peak_num)
+      continue;
+
+    U32 last = MIN(out->peak_num, cfg->peak_num - 1);
+    for (U32 i = last; i > pos; i--) {
+      out->peak_val[i]     = out->peak_val[i - 1];
+      out->peak_freq_hz[i] = out->peak_freq_hz[i - 1];
+    }
+
+    // parabolic interpolation between bins
+    FP32 den   = a - FP32_2 * b + c;
+    FP32 delta = (den != FP32_0) ? FP32_1_DIV_2 * (a - c) / den : FP32_0;
+
+    out->peak_val[pos]     = b;
+    out->peak_freq_hz[pos] = ((FP32)k + delta) * cfg->sample_rate_hz / (FP32)FFT_POINT_SIZE;
+    if (out->peak_num < cfg->peak_num)
+      out->peak_num++;
+  }
+}
+
+static inline BOOL
+psd_run(psd_t *psd) {
+  DECL_PSD_PTRS(psd);
+  DECL_FFT_PTRS_PREFIX(&psd->lo.fft, fft);
+
+  U32 seq = __atomic_load_n(&lo->frame_seq, __ATOMIC_ACQUIRE);
+  if (seq == lo->frame_done)
+    return FALSE;
+
+  out->frame_drop += seq - lo->frame_done - 1;
+  lo->frame_done = seq;
+
+  const FP32 *frame = &lo->ring[__atomic_load_n(&lo->frame_start, __ATOMIC_ACQUIRE)];
+  for (U32 i = 0; i < FFT_POINT_SIZE; i++)
+    fft_lo->buf[i] = frame[i] * lo->win[i];
+
+  // frame seq + j is published j * hop_size samples later, the one copied is safe while
+  // (j + 1) * hop_size samples still fit in the FFT_POINT_SIZE the ring holds beyond it
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  U32 lap = __atomic_load_n(&lo->frame_seq, __ATOMIC_RELAXED) - seq;
+  if ((lap + 1U) * cfg->hop_size > FFT_POINT_SIZE) {
+    out->frame_torn++;
+    return FALSE;
+  }
+
+  arm_rfft_fast_f32(&fft_cfg->S, fft_lo->buf, fft_out->buf, fft_cfg->flag);
+
+  // bin 0 carries DC in re and nyquist in im, DC has no negative twin to fold in
+  fft_out->module[0] = FP32_1_DIV_2 * fft_out->buf[0] * fft_out->buf[0];
+  arm_cmplx_mag_squared_f32(&fft_out->buf[2], &fft_out->module[1], PSD_BIN_NUM - 1);
+
+  FP32 alpha = (out->frame_cnt == 0) ? FP32_1 : cfg->avg_alpha;
+  for (U32 k = 0; k < PSD_BIN_NUM; k++)
+    out->psd[k] += alpha * (fft_out->module[k] * lo->scale - out->psd[k]);
+  out->frame_cnt++;
+
+  psd_peak_update(psd);
+  return TRUE;
+}
+
+static inline BOOL
+psd_run_in(psd_t *psd, FP32 value) {
+  DECL_PSD_PTRS(psd);
+
+  in->val = value;
+  psd_add_value(psd, in->val);
+  return psd_run(psd);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // !PSD_H
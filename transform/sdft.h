@@ -0,0 +1,179 @@
+#ifndef SDFT_H
+#define SDFT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+
+#include "util/mathdef.h"
+#include "util/typedef.h"
+
+/*
+ * Sliding DFT, one O(1) complex update per tracked bin and sample:
+ *   S[n] = x[n] + r * e^(-jw) * S[n-1] - r^N * e^(-jwN) * x[n-N]
+ * With r = 1 rounding errors accumulate forever, so damp left at 0 (or out of range) takes
+ * SDFT_DAMP_DEFAULT, which forgets them within a few windows and costs nothing in amplitude.
+ * The sum runs over the lag k, so a bin holds the conjugate of the usual phasor: a cosine
+ * A * cos(w * n + phi) reads amp A and phase -(w * n + phi) at its newest sample n.
+ * w is free, so bins can follow the electrical frequency instead of the FFT grid. Retuning a bin
+ * rebuilds its state from the window with the new w, O(N) once, so it reads the new frequency
+ * from the next sample on instead of settling over a window with the old one mixed in.
+ */
+
+#ifndef SDFT_POINT_SIZE
+#define SDFT_POINT_SIZE (LF(6))
+#endif
+
+#ifndef SDFT_DAMP_DEFAULT
+#define SDFT_DAMP_DEFAULT (0.9999f)
+#endif
+
+#ifndef SDFT_BIN_MAX
+#define SDFT_BIN_MAX (4U)
+#endif
+
+typedef struct {
+  FP32 sample_rate_hz;
+  FP32 damp;                      // 阻尼系数 r, (0, 1], 0 取默认值
+  U32  bin_num;                   // 跟踪的频点数
+  FP32 bin_freq_hz[SDFT_BIN_MAX]; // 频点频率
+} sdft_cfg_t;
+
+typedef struct {
+  FP32 val;
+} sdft_in_t;
+
+typedef struct {
+  FP32 re[SDFT_BIN_MAX];
+  FP32 im[SDFT_BIN_MAX];
+  FP32 amp[SDFT_BIN_MAX];
+} sdft_out_t;
+
+typedef struct {
+  FP32 buf[SDFT_POINT_SIZE];
+  U32  idx_added;
+  FP32 damp_n;
+  FP32 amp_gain;
+  FP32 coef_re[SDFT_BIN_MAX], coef_im[SDFT_BIN_MAX];
+  FP32 coef_n_re[SDFT_BIN_MAX], coef_n_im[SDFT_BIN_MAX];
+} sdft_lo_t;
+
+typedef struct {
+  sdft_cfg_t cfg;
+  sdft_in_t  in;
+  sdft_out_t out;
+  sdft_lo_t  lo;
+} sdft_t;
+
+#define DECL_SDFT_PTRS(sdft)                                                                       \
+  sdft_t     *p   = (sdft);                                                                        \
+  sdft_cfg_t *cfg = &p->cfg;                                                                       \
+  sdft_in_t  *in  = &p->in;                                                                        \
+  sdft_out_t *out = &p->out;                                                                       \
+  sdft_lo_t  *lo  = &p->lo;
+
+#define DECL_SDFT_PTRS_PREFIX(sdft, prefix)                                                        \
+  sdft_t     *prefix##_p   = (sdft);                                                               \
+  sdft_cfg_t *prefix##_cfg = &prefix##_p->cfg;                                                     \
+  sdft_in_t  *prefix##_in  = &prefix##_p->in;                                                      \
+  sdft_out_t *prefix##_out = &prefix##_p->out;                                                     \
+  sdft_lo_t  *prefix##_lo  = &prefix##_p->lo;
+
+static inline void
+sdft_set_bin(sdft_t *sdft, U32 bin, FP32 freq_hz) {
+  DECL_SDFT_PTRS(sdft);
+
+  if (bin >= SDFT_BIN_MAX)
+    return;
+
+  FP32 w  = FP32_2PI * freq_hz / cfg->sample_rate_hz;
+  FP32 wn = w * (FP32)SDFT_POINT_SIZE;
+
+  cfg->bin_freq_hz[bin] = freq_hz;
+  lo->coef_re[bin]      = cfg->damp * FP32_COS(w);
+  lo->coef_im[bin]      = -cfg->damp * FP32_SIN(w);
+  lo->coef_n_re[bin]    = lo->damp_n * FP32_COS(wn);
+  lo->coef_n_im[bin]    = -lo->damp_n * FP32_SIN(wn);
+
+  // S = sum r^k * e^(-jwk) * x[n-k] over the window, oldest sample first
+  FP32 re = FP32_0, im = FP32_0;
+  for (U32 i = 0; i < SDFT_POINT_SIZE; i++) {
+    FP32 x   = lo->buf[(lo->idx_added + i) & (SDFT_POINT_SIZE - 1U)];
+    FP32 tmp = x + lo->coef_re[bin] * re - lo->coef_im[bin] * im;
+    im       = lo->coef_re[bin] * im + lo->coef_im[bin] * re;
+    re       = tmp;
+  }
+  out->re[bin] = re;
+  out->im[bin] = im;
+}
+
+static inline void
+sdft_init(sdft_t *sdft, sdft_cfg_t sdft_cfg) {
+  DECL_SDFT_PTRS(sdft);
+
+  *cfg = sdft_cfg;
+  if (cfg->damp <= FP32_0 || cfg->damp > FP32_1)
+    cfg->damp = SDFT_DAMP_DEFAULT;
+  if (cfg->bin_num > SDFT_BIN_MAX)
+    cfg->bin_num = SDFT_BIN_MAX;
+
+  memset(in, 0, sizeof(*in));
+  memset(out, 0, sizeof(*out));
+  memset(lo, 0, sizeof(*lo));
+
+  lo->damp_n = FP32_1;
+  for (U32 i = 0; i < SDFT_POINT_SIZE; i++)
+    lo->damp_n *= cfg->damp;
+
+  // normalise so that a sine of amplitude A reads A in out->amp
+  lo->amp_gain = (cfg->damp < FP32_1) ? FP32_2 * (FP32_1 - cfg->damp) / (FP32_1 - lo->damp_n)
+                                      : FP32_2 / (FP32)SDFT_POINT_SIZE;
+
+  for (U32 i = 0; i < cfg->bin_num; i++)
+    sdft_set_bin(sdft, i, cfg->bin_freq_hz[i]);
+}
+
+static inline void
+sdft_add_value(sdft_t *sdft, FP32 value) {
+  DECL_SDFT_PTRS(sdft);
+
+  FP32 oldest = lo->buf[lo->idx_added];
+
+  lo->buf[lo->idx_added] = value;
+  lo->idx_added          = (lo->idx_added + 1U) & (SDFT_POINT_SIZE - 1U);
+
+  for (U32 i = 0; i < cfg->bin_num; i++) {
+    FP32 re = value - lo->coef_n_re[i] * oldest + lo->coef_re[i] * out->re[i]
+              - lo->coef_im[i] * out->im[i];
+    FP32 im = -lo->coef_n_im[i] * oldest + lo->coef_re[i] * out->im[i]
+              + lo->coef_im[i] * out->re[i];
+
+    out->re[i] = re;
+    out->im[i] = im;
+  }
+}
+
+static inline void
+sdft_run(sdft_t *sdft) {
+  DECL_SDFT_PTRS(sdft);
+
+  for (U32 i = 0; i < cfg->bin_num; i++)
+    out->amp[i] = lo->amp_gain * FP32_SQRT(out->re[i] * out->re[i] + out->im[i] * out->im[i]);
+}
+
+static inline void
+sdft_run_in(sdft_t *sdft, FP32 value) {
+  DECL_SDFT_PTRS(sdft);
+
+  in->val = value;
+  sdft_add_value(sdft, in->val);
+  sdft_run(sdft);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // !SDFT_H
@@ -82,6 +82,31 @@ fast_expf(FP32 x) {
   return v.f;
 }
 
+/*
+ * Odd polynomial for atan on [-1, 1], folded out to the four quadrants, error about 1e-5 rad.
+ */
+static inline FP32
+fast_atan2f(FP32 y, FP32 x) {
+  FP32 ax = (x < 0.0f) ? -x : x;
+  FP32 ay = (y < 0.0f) ? -y : y;
+  if (ax == 0.0f && ay == 0.0f)
+    return 0.0f;
+
+  FP32 z  = (ay > ax) ? ax / ay : ay / ax;
+  FP32 z2 = z * z;
+  FP32 a  = 0.0208351f;
+  a       = a * z2 - 0.0851330f;
+  a       = a * z2 + 0.1801410f;
+  a       = a * z2 - 0.3302995f;
+  a       = (a * z2 + 0.9998660f) * z;
+
+  if (ay > ax)
+    a = 1.5707963267948966192313216916398f - a;
+  if (x < 0.0f)
+    a = 3.1415926535897932384626433832795f - a;
+  return (y < 0.0f) ? -a : a;
+}
+
 static inline FP32
 fast_absf(FP32 x) {
   FP32 y = x;
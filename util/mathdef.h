@@ -15,27 +15,29 @@ extern "C" {
 #include "typedef.h"
 
 #ifdef FAST_MATH
-#define FP32_SIN(x)    fast_sinf(x)
-#define FP32_COS(x)    fast_cosf(x)
-#define FP32_TAN(x)    fast_tanf(x)
-#define FP32_EXP(x)    fast_expf(x)
-#define FP32_ABS(x)    fast_absf(x)
-#define FP32_SQRT(x)   fast_sqrtf(x)
-#define FP32_MOD(x, y) fast_modf(x, y) // __hardfp_fmodf
+#define FP32_SIN(x)      fast_sinf(x)
+#define FP32_COS(x)      fast_cosf(x)
+#define FP32_TAN(x)      fast_tanf(x)
+#define FP32_EXP(x)      fast_expf(x)
+#define FP32_ATAN2(y, x) fast_atan2f(y, x)
+#define FP32_ABS(x)      fast_absf(x)
+#define FP32_SQRT(x)     fast_sqrtf(x)
+#define FP32_MOD(x, y)   fast_modf(x, y) // __hardfp_fmodf
 #elif defined(ARM_MATH)
-#define FP32_SIN(x)         arm_sin_f32(x)
-#define FP32_COS(x)         arm_cos_f32(x)
-#define FP32_ATAN2(y, x, r) arm_atan2_f32(y, x, r)
-#define FP32_ABS(x)         fast_absf(x)
-#define FP32_EXP(x)         fast_expf(x)
-#define FP32_SQRT(x)        fast_sqrtf(x)
-#define FP32_MOD(x, y)      fast_modf(x, y) // __hardfp_fmodf
+#define FP32_SIN(x)      arm_sin_f32(x)
+#define FP32_COS(x)      arm_cos_f32(x)
+#define FP32_ATAN2(y, x) fast_atan2f(y, x)
+#define FP32_ABS(x)      fast_absf(x)
+#define FP32_EXP(x)      fast_expf(x)
+#define FP32_SQRT(x)     fast_sqrtf(x)
+#define FP32_MOD(x, y)   fast_modf(x, y) // __hardfp_fmodf
 #else
 #define FP32_SIN(x)      sinf(x)
 #define FP32_COS(x)      cosf(x)
 #define FP32_EXP(x)      expf(x)
 #define FP32_ATAN2(y, x) atan2f(y, x)
 #define FP32_ABS(x)      fabsf(x)
+#define FP32_SQRT(x)     sqrtf(x)
 #define FP32_MOD(x, y)   fmodf(x, y) // __hardfp_fmodf
 #endif
 
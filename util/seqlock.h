@@ -0,0 +1,67 @@
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+
+#include "typedef.h"
+
+/*
+ * Single writer sequence lock. The writer makes the count odd, copies the record and makes it even
+ * again, it never waits for anyone. A reader copies the record between two reads of the count and
+ * takes it only if both are the same even value, otherwise it copies again.
+ * Meant for a control interrupt publishing to a thread or another core, the writer cost is the
+ * copy plus two stores and two fences (dmb on cortex-m, plain stores on x86).
+ */
+
+typedef struct {
+  volatile U32 seq;
+} seqlock_t;
+
+static inline void
+seqlock_init(seqlock_t *lock) {
+  lock->seq = 0;
+}
+
+static inline void
+seqlock_write(seqlock_t *lock, void *dst, const void *src, U32 size) {
+  U32 seq = __atomic_load_n(&lock->seq, __ATOMIC_RELAXED);
+  __atomic_store_n(&lock->seq, seq + 1U, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(dst, src, size);
+  __atomic_store_n(&lock->seq, seq + 2U, __ATOMIC_RELEASE);
+}
+
+/*
+ * One attempt, TRUE when dst holds a consistent copy.
+ */
+static inline BOOL
+seqlock_try_read(const seqlock_t *lock, void *dst, const void *src, U32 size) {
+  U32 seq = __atomic_load_n(&lock->seq, __ATOMIC_ACQUIRE);
+  if (seq & 1U)
+    return FALSE;
+  memcpy(dst, src, size);
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(&lock->seq, __ATOMIC_RELAXED) == seq;
+}
+
+/*
+ * Copies until consistent, returns the number of retries. Must not be called from a context that
+ * preempts the writer, it would spin forever on an odd count.
+ */
+static inline U32
+seqlock_read(const seqlock_t *lock, void *dst, const void *src, U32 size) {
+  U32 retry = 0;
+  while (!seqlock_try_read(lock, dst, src, size))
+    retry++;
+  return retry;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // !SEQLOCK_H
@@ -67,6 +67,8 @@ typedef struct {
   FP32 lq;
   FP32 ls;
   FP32 rs;
+  FP32 flux;
+  FP32 j; // 转子转动惯量, kg*m^2
 } motor_param_t;
 
 #ifdef __cplusplus
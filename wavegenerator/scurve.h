@@ -0,0 +1,183 @@
+#ifndef SCURVE_H
+#define SCURVE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+
+#include "util/errdef.h"
+#include "util/mathdef.h"
+#include "util/typedef.h"
+
+/*
+ * Jerk limited point to point trajectory, rest to rest.
+ * scurve_plan() lays out the seven constant jerk segments once per move (jerk up, constant acc,
+ * jerk down, cruise and the mirror image), shrinking the peak velocity and acceleration for short
+ * moves, and stores the start state of every segment. scurve_run() then only steps the segment
+ * index forward and evaluates one cubic, so the per tick cost does not depend on the move.
+ * Time is counted in ticks so a long move does not drift.
+ */
+
+#define SCURVE_SEG_NUM (7U)
+
+typedef struct {
+  FP32 freq_hz;  // 调用频率
+  FP32 vel_max;  // 速度上限
+  FP32 acc_max;  // 加速度上限
+  FP32 jerk_max; // 加加速度上限
+} scurve_cfg_t;
+
+typedef struct {
+  FP32 pos_start;
+  FP32 pos_end;
+} scurve_in_t;
+
+typedef struct {
+  FP32 pos, vel, acc, jerk;
+  BOOL is_done;
+} scurve_out_t;
+
+typedef struct {
+  FP32 t0[SCURVE_SEG_NUM]; // 段起始时间
+  FP32 p0[SCURVE_SEG_NUM]; // 段起始状态
+  FP32 v0[SCURVE_SEG_NUM];
+  FP32 a0[SCURVE_SEG_NUM];
+  FP32 j[SCURVE_SEG_NUM];
+  FP32 t_end;
+  U32  seg;
+  U32  tick;
+} scurve_lo_t;
+
+typedef struct {
+  scurve_cfg_t cfg;
+  scurve_in_t  in;
+  scurve_out_t out;
+  scurve_lo_t  lo;
+} scurve_t;
+
+#define DECL_SCURVE_PTRS(scurve)                                                                   \
+  scurve_t     *p   = (scurve);                                                                    \
+  scurve_cfg_t *cfg = &p->cfg;                                                                     \
+  scurve_in_t  *in  = &p->in;                                                                      \
+  scurve_out_t *out = &p->out;                                                                     \
+  scurve_lo_t  *lo  = &p->lo;
+
+#define DECL_SCURVE_PTRS_PREFIX(scurve, prefix)                                                    \
+  scurve_t     *prefix##_p   = (scurve);                                                           \
+  scurve_cfg_t *prefix##_cfg = &prefix##_p->cfg;                                                   \
+  scurve_in_t  *prefix##_in  = &prefix##_p->in;                                                    \
+  scurve_out_t *prefix##_out = &prefix##_p->out;                                                   \
+  scurve_lo_t  *prefix##_lo  = &prefix##_p->lo;
+
+static inline void
+scurve_init(scurve_t *scurve, scurve_cfg_t scurve_cfg) {
+  DECL_SCURVE_PTRS(scurve);
+
+  *cfg = scurve_cfg;
+  memset(in, 0, sizeof(*in));
+  memset(out, 0, sizeof(*out));
+  memset(lo, 0, sizeof(*lo));
+  out->is_done = TRUE;
+}
+
+static inline ret_e
+scurve_plan(scurve_t *scurve, FP32 pos_start, FP32 pos_end) {
+  DECL_SCURVE_PTRS(scurve);
+
+  FP32 vm = cfg->vel_max, am = cfg->acc_max, jm = cfg->jerk_max;
+  if (vm <= FP32_0 || am <= FP32_0 || jm <= FP32_0)
+    return FAIL;
+
+  in->pos_start = pos_start;
+  in->pos_end   = pos_end;
+
+  FP32 dist = FP32_ABS(pos_end - pos_start);
+  FP32 dir  = (pos_end >= pos_start) ? FP32_1 : -FP32_1;
+
+  // full profile first, acc ramps of tj with a constant part of ta between them
+  FP32 tj = am / jm, ta, tv;
+  if (vm * jm < am * am) {
+    tj = FP32_SQRT(vm / jm);
+    ta = FP32_0;
+  } else {
+    ta = vm / am - tj;
+  }
+  FP32 v = vm;
+
+  if (v * (FP32_2 * tj + ta) > dist) {
+    // too short to cruise, peak velocity from v^2 / am + v * tj = dist
+    tj = am / jm;
+    v  = (-am * tj + FP32_SQRT(am * am * tj * tj + 4.0f * am * dist)) * FP32_1_DIV_2;
+    ta = v / am - tj;
+    if (ta < FP32_0 || v > vm) {
+      // not even the acceleration limit is reached, dist = 2 * jm * tj^3
+      tj = cbrtf(dist / (FP32_2 * jm));
+      ta = FP32_0;
+    }
+    tv = FP32_0;
+  } else {
+    tv = (dist - v * (FP32_2 * tj + ta)) / v;
+  }
+
+  FP32 dt[SCURVE_SEG_NUM] = {tj, ta, tj, tv, tj, ta, tj};
+  FP32 dj[SCURVE_SEG_NUM] = {jm, FP32_0, -jm, FP32_0, -jm, FP32_0, jm};
+
+  FP32 t = FP32_0, pos = pos_start, vel = FP32_0, acc = FP32_0;
+  for (U32 i = 0; i < SCURVE_SEG_NUM; i++) {
+    lo->t0[i] = t;
+    lo->p0[i] = pos;
+    lo->v0[i] = vel;
+    lo->a0[i] = acc;
+    lo->j[i]  = dj[i] * dir;
+
+    FP32 d = dt[i];
+    pos += d * (vel + d * (acc * FP32_1_DIV_2 + d * lo->j[i] / 6.0f));
+    vel += d * (acc + d * lo->j[i] * FP32_1_DIV_2);
+    acc += d * lo->j[i];
+    t += d;
+  }
+
+  lo->t_end    = t;
+  lo->seg      = 0;
+  lo->tick     = 0;
+  out->is_done = FALSE;
+  return OK;
+}
+
+static inline void
+scurve_run(scurve_t *scurve) {
+  DECL_SCURVE_PTRS(scurve);
+
+  if (out->is_done)
+    return;
+
+  FP32 t = (FP32)(++lo->tick) * FP32_HZ_TO_S(cfg->freq_hz);
+  if (t >= lo->t_end) {
+    out->pos     = in->pos_end;
+    out->vel     = FP32_0;
+    out->acc     = FP32_0;
+    out->jerk    = FP32_0;
+    out->is_done = TRUE;
+    return;
+  }
+
+  while (lo->seg + 1U < SCURVE_SEG_NUM && t >= lo->t0[lo->seg + 1U])
+    lo->seg++;
+
+  U32  i   = lo->seg;
+  FP32 tau = t - lo->t0[i];
+  FP32 j   = lo->j[i];
+
+  out->jerk = j;
+  out->acc  = lo->a0[i] + tau * j;
+  out->vel  = lo->v0[i] + tau * (lo->a0[i] + tau * j * FP32_1_DIV_2);
+  out->pos  = lo->p0[i] + tau * (lo->v0[i] + tau * (lo->a0[i] * FP32_1_DIV_2 + tau * j / 6.0f));
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // !SCURVE_H